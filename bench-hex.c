@@ -0,0 +1,215 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hex.h"
+#include "util.h"
+
+/*
+ * Compare hex.c against the sprintf()/per-nibble code dj-c7 used to use, on
+ * packet sized (16 byte) buffers and on large buffers.
+ */
+
+#define DATA_LEN 16
+
+/* the previous implementation, kept here for comparison */
+static void
+ref_encode(char *pkt, const unsigned char *buf, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; i++) {
+		sprintf(pkt, "%02X", buf[i]);
+		pkt += 2;
+	}
+}
+
+static int_fast16_t
+ref_decode_hex_nibble(char c)
+{
+	if ('A' <= c && c <= 'F') {
+		return c - 'A' + 10;
+	} else if ('0' <= c && c <= '9') {
+		return c - '0';
+	} else
+		return -1;
+}
+
+static int_fast16_t
+ref_decode_hex(const char buf[static 2])
+{
+	int_fast16_t r1 = ref_decode_hex_nibble(buf[0]);
+	if (r1 < 0)
+		return r1;
+
+	int_fast16_t r2 = ref_decode_hex_nibble(buf[1]);
+	if (r2 < 0)
+		return r2;
+
+	return r1 << 4 | r2;
+}
+
+static int
+ref_decode_hex_buf(size_t len, const char in[static len * 2], uint8_t out[static len])
+{
+	size_t i;
+	for (i = 0; i < len; i ++) {
+		int_fast16_t r = ref_decode_hex(in + i * 2);
+		if (r < 0)
+			return r;
+		out[i] = r;
+	}
+
+	return 0;
+}
+
+static int
+self_check(uint64_t *rng)
+{
+	uint8_t in[200] = { 0 }, out[200];
+	char hex[400], ref[401];
+	size_t len;
+	for (len = 0; len <= sizeof(in); len++) {
+		size_t i;
+		for (i = 0; i < len; i++)
+			in[i] = rng_next(rng);
+
+		hex_encode(hex, in, len);
+		ref_encode(ref, in, len);
+		if (memcmp(hex, ref, len * 2)) {
+			fprintf(stderr, "E: encode of %zu bytes differs from sprintf\n", len);
+			return -1;
+		}
+
+		if (hex_decode(out, hex, len, NULL) || memcmp(in, out, len)) {
+			fprintf(stderr, "E: round trip of %zu bytes failed\n", len);
+			return -1;
+		}
+
+		/* every position must be caught & reported */
+		for (i = 0; i < len * 2; i++) {
+			static const char bad[] = { 'G', 'g', 'a', 'f', '/', ':', '@', '`', ' ', '\0', '\x80', '\xff' };
+			char saved = hex[i];
+			size_t err_pos = SIZE_MAX;
+			hex[i] = bad[rng_next(rng) % sizeof(bad)];
+			if (!hex_decode(out, hex, len, &err_pos) || err_pos != i) {
+				fprintf(stderr, "E: bad char at %zu of %zu reported at %zu\n", i, len * 2, err_pos);
+				return -1;
+			}
+			hex[i] = saved;
+		}
+	}
+
+	return 0;
+}
+
+static void
+report(const char *name, size_t len, size_t iter, uint64_t ns)
+{
+	printf("%-28s %8zu %10.1f ns/op %10.1f MB/s\n", name, len,
+			(double)ns / iter, (double)len * iter * 1e3 / ns);
+}
+
+static volatile uint8_t sink;
+
+static void
+bench(size_t len, size_t iter, uint64_t *rng)
+{
+	uint8_t *in = malloc(len), *out = malloc(len);
+	char *hex = malloc(len * 2 + 1);
+	if (!in || !out || !hex) {
+		fprintf(stderr, "E: could not allocate %zu bytes\n", len);
+		exit(EXIT_FAILURE);
+	}
+
+	size_t i;
+	for (i = 0; i < len; i++)
+		in[i] = rng_next(rng);
+
+	uint64_t t = now_ns();
+	for (i = 0; i < iter; i++) {
+		ref_encode(hex, in, len);
+		sink = hex[i % (len * 2)];
+	}
+	report("encode sprintf (old)", len, iter, now_ns() - t);
+
+	t = now_ns();
+	for (i = 0; i < iter; i++) {
+		hex_encode(hex, in, len);
+		sink = hex[i % (len * 2)];
+	}
+	report("hex_encode", len, iter, now_ns() - t);
+
+	t = now_ns();
+	for (i = 0; i < iter; i++) {
+		if (ref_decode_hex_buf(len, hex, out))
+			exit(EXIT_FAILURE);
+		sink = out[i % len];
+	}
+	report("decode_hex_buf (old)", len, iter, now_ns() - t);
+
+	t = now_ns();
+	for (i = 0; i < iter; i++) {
+		if (hex_decode(out, hex, len, NULL))
+			exit(EXIT_FAILURE);
+		sink = out[i % len];
+	}
+	report("hex_decode", len, iter, now_ns() - t);
+
+	free(in);
+	free(out);
+	free(hex);
+}
+
+static const char *opts = "hS:";
+
+static void usage_(const char *prgm, int e)
+{
+	FILE *f;
+	if (e)
+		f = stderr;
+	else
+		f = stdout;
+
+	fprintf(f,
+"%sUsage: %s [options]\n"
+"Options: -%s\n"
+"  -S <seed>     random seed (default: 1)\n"
+	, e?"\n":"", prgm, opts);
+
+	exit(e);
+}
+#define usage(e) usage_(argc?argv[0]:"bench-hex", e)
+
+int main(int argc, char *argv[])
+{
+	uint64_t seed = 1;
+	int opt, e = 0;
+
+	while ((opt = getopt(argc, argv, opts)) != -1) {
+		switch (opt) {
+		case 'h':
+			usage(EXIT_SUCCESS);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			e++;
+			break;
+		}
+	}
+
+	if (e)
+		usage(EXIT_FAILURE);
+
+	uint64_t rng = seed;
+	if (self_check(&rng))
+		exit(EXIT_FAILURE);
+
+	bench(DATA_LEN, 1 << 20, &rng);
+	bench(1 << 20, 64, &rng);
+	return 0;
+}
@@ -0,0 +1,182 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "util.h"
+
+/*
+ * Insert lots of random 16 byte blocks into a `struct memory` and report how
+ * the per-insert cost scales as the number of ranges grows & merges.
+ */
+
+#define BLOCK_LEN 16
+
+/*
+ * Walk the ranges and make sure they agree with the set of blocks we
+ * inserted.
+ */
+static int
+verify(const struct memory *m, const uint8_t *present, size_t space)
+{
+	size_t ranges = 0, expect_ranges = 0, bytes = 0, expect_bytes = 0;
+	size_t i;
+	for (i = 0; i < space; i++) {
+		if (present[i]) {
+			expect_bytes += BLOCK_LEN;
+			if (!i || !present[i - 1])
+				expect_ranges++;
+		}
+	}
+
+	const struct memory_range *r, *prev = NULL;
+	memory_for_each(m, r) {
+		if (prev && prev->off + prev->len >= r->off) {
+			fprintf(stderr, "E: ranges at %#zx and %#zx overlap or touch\n", prev->off, r->off);
+			return -1;
+		}
+
+		for (i = 0; i < r->len; i += BLOCK_LEN) {
+			size_t blk = (r->off + i) / BLOCK_LEN;
+			uint8_t v = (uint8_t)blk;
+			if (!present[blk] || r->data[i] != v) {
+				fprintf(stderr, "E: bad block %#zx\n", blk);
+				return -1;
+			}
+		}
+
+		bytes += r->len;
+		ranges++;
+		prev = r;
+	}
+
+	if (ranges != expect_ranges || ranges != memory_range_ct(m) || bytes != expect_bytes) {
+		fprintf(stderr, "E: have %zu ranges (%zu counted), %zu bytes, expected %zu ranges, %zu bytes\n",
+				memory_range_ct(m), ranges, bytes, expect_ranges, expect_bytes);
+		return -1;
+	}
+
+	return 0;
+}
+
+static const char *opts = "hn:s:S:";
+
+static void usage_(const char *prgm, int e)
+{
+	FILE *f;
+	if (e)
+		f = stderr;
+	else
+		f = stdout;
+
+	fprintf(f,
+"%sUsage: %s [options]\n"
+"Options: -%s\n"
+"  -n <blocks>   number of 16 byte blocks to insert (default: 4194304)\n"
+"  -s <blocks>   size of the address space in blocks (default: 2 * n)\n"
+"  -S <seed>     random seed (default: 1)\n"
+	, e?"\n":"", prgm, opts);
+
+	exit(e);
+}
+#define usage(e) usage_(argc?argv[0]:"bench-memory", e)
+
+int main(int argc, char *argv[])
+{
+	size_t n = 4 << 20;
+	size_t space = 0;
+	uint64_t seed = 1;
+	int opt, e = 0;
+
+	while ((opt = getopt(argc, argv, opts)) != -1) {
+		switch (opt) {
+		case 'h':
+			usage(EXIT_SUCCESS);
+			break;
+		case 'n':
+			n = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			space = strtoull(optarg, NULL, 0);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			e++;
+			break;
+		}
+	}
+
+	if (e)
+		usage(EXIT_FAILURE);
+
+	if (!space)
+		space = n * 2;
+	if (!n || !space) {
+		fprintf(stderr, "E: need a non-zero block count and space\n");
+		exit(EXIT_FAILURE);
+	}
+
+	uint8_t *present = calloc(space, 1);
+	if (!present) {
+		fprintf(stderr, "E: could not allocate block map\n");
+		exit(EXIT_FAILURE);
+	}
+
+	struct memory m;
+	memory_init(&m);
+
+	printf("%12s %12s %10s\n", "inserts", "ranges", "ns/insert");
+
+	uint64_t rng = seed;
+	uint64_t start = now_ns(), last = start;
+	size_t i, next_report = 1024, last_i = 0;
+	for (i = 0; i < n; i++) {
+		size_t blk = rng_next(&rng) % space;
+		uint8_t block[BLOCK_LEN];
+		memset(block, (uint8_t)blk, sizeof(block));
+
+		if (memory_insert(&m, block, sizeof(block), (uint64_t)blk * BLOCK_LEN)) {
+			fprintf(stderr, "E: insert of block %zu failed\n", blk);
+			exit(EXIT_FAILURE);
+		}
+		present[blk] = 1;
+
+		if (i + 1 == next_report || i + 1 == n) {
+			uint64_t t = now_ns();
+			printf("%12zu %12zu %10.1f\n", i + 1, memory_range_ct(&m),
+					(double)(t - last) / (i + 1 - last_i));
+			last = t;
+			last_i = i + 1;
+			next_report *= 2;
+		}
+	}
+
+	uint64_t total = now_ns() - start;
+	printf("total: %zu inserts in %.3f s, %.1f ns/insert\n", n,
+			total / 1e9, (double)total / n);
+
+	uint64_t t = now_ns();
+	size_t ct = 0;
+	const struct memory_range *r;
+	memory_for_each(&m, r)
+		ct++;
+	printf("iterate: %zu ranges in %.3f ms\n", ct, (now_ns() - t) / 1e6);
+
+	t = now_ns();
+	size_t hits = 0;
+	for (i = 0; i < n; i++)
+		hits += !!memory_find(&m, (rng_next(&rng) % space) * BLOCK_LEN);
+	printf("lookup: %zu lookups (%zu hits), %.1f ns/lookup\n", n, hits,
+			(double)(now_ns() - t) / n);
+
+	if (verify(&m, present, space))
+		exit(EXIT_FAILURE);
+
+	memory_destroy(&m);
+	free(present);
+	return 0;
+}
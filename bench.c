@@ -0,0 +1,597 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bindiff.h"
+#include "chan.h"
+#include "dj-proto.h"
+#include "fallback.h"
+#include "fingerprint.h"
+#include "hex.h"
+#include "memory.h"
+#include "print.h"
+#include "squelch.h"
+#include "util.h"
+
+/*
+ * Microbenchmarks for the per-packet hot paths.
+ *
+ * Each benchmark cycles through a pool of inputs generated from a fixed seed,
+ * is warmed up, then timed over several rounds of at least -t ms each; the
+ * fastest round is reported. The output is also the format of the baseline
+ * file (bench.baseline): `bench <name>` gives the lines to add or refresh
+ * there for the entries a change affects, and `bench -b bench.baseline`
+ * compares against it. configure builds bench without the sanitizers.
+ */
+
+#define POOL 256
+
+/* the DJ-C7's packets, checked against dj_c7 in setup() */
+#define DATA_LEN 16
+#define PKT_BYTES DJ_PKT_LEN(4, 2, DATA_LEN)
+/* where the data starts in a packet */
+#define DATA_AT (4 + 2 * 2 + 1)
+#define FP_KINDS 256
+#define CHANS 16384
+
+/*
+ * A made up radio with every channel field mapped, the DJ-C7's memories
+ * aren't: used flag, BCD rx in 10 Hz, binary tx, mode/tone/power bits and an
+ * 8 byte name.
+ */
+static const uint8_t bench_mods[4] = { CHAN_MOD_FM, CHAN_MOD_NFM, CHAN_MOD_AM, CHAN_NO_VALUE };
+static const struct chan_layout bench_layout = {
+	.model = "bench",
+	.stride = 32,
+	.count = CHANS,
+	.first = 1,
+	.used = { .off = 0, .shift = 7, .bits = 1 },
+	.rx = { .off = 4, .width = 4, .enc = CHAN_ENC_BCD_BE, .unit = 10 },
+	.tx = { .off = 8, .width = 4, .enc = CHAN_ENC_LE, .unit = 1 },
+	.rx_mod = { .off = 1, .shift = 0, .bits = 2, .map = bench_mods },
+	.tx_mod = { .off = 1, .shift = 2, .bits = 2, .map = bench_mods },
+	.rx_tone = { .off = 2, .shift = 0, .bits = 3 },
+	.rx_code = { .off = 12, .bits = 8 },
+	.tx_tone = { .off = 2, .shift = 3, .bits = 3 },
+	.tx_code = { .off = 13, .bits = 8 },
+	.power = { .off = 3, .shift = 0, .bits = 2 },
+	.name = { .off = 16, .len = 8, .pad = ' ' },
+};
+
+static struct {
+	uint8_t data[POOL][DATA_LEN];
+	char pkts[POOL][PKT_BYTES];
+	struct dj_pkt decoded[POOL];
+	uint8_t binary[POOL][64];
+	/* two clone sized images differing in a few bytes */
+	uint8_t image[2][0x8000];
+	uint64_t changed[0x8000 / 64];
+	struct bitcount bitcount;
+	/* clone images of FP_KINDS kinds, learned into fp */
+	uint8_t kinds[FP_KINDS][0x1000];
+	struct fp_index fp;
+	size_t order[0x1000 / DATA_LEN];
+	/* a bench_layout image and the channels decoded from it */
+	uint8_t chan_image[CHANS * 32];
+	struct chan_table chans;
+	/* a smaller radio than bench_layout, and rules for converting to it */
+	struct chan_caps small;
+	struct fb_prog rules;
+	/* an unsquelch condition for each channel, as text and compiled */
+	char sq_text[CHANS][48];
+	struct sq_prog sq[CHANS];
+	FILE *null;
+} in;
+
+static volatile uint64_t sink;
+
+static void
+setup(uint64_t seed)
+{
+	uint64_t rng = seed;
+	size_t i, j;
+	if (dj_c7.data_len != DATA_LEN || dj_c7.pkt_len != PKT_BYTES) {
+		fprintf(stderr, "E: the DJ-C7's packets are not what bench expects\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < POOL; i++) {
+		for (j = 0; j < DATA_LEN; j++)
+			in.data[i][j] = rng_next(&rng);
+		for (j = 0; j < sizeof(in.binary[i]); j++)
+			in.binary[i][j] = rng_next(&rng);
+
+		pkt_encode(&dj_c7, (i * DATA_LEN) % dj_c7.mem_size, in.data[i], in.pkts[i]);
+		if (pkt_decode(&dj_c7, &in.decoded[i], in.pkts[i]) < 0) {
+			fprintf(stderr, "E: could not decode a generated packet\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < sizeof(in.image[0]); i++)
+		in.image[0][i] = in.image[1][i] = rng_next(&rng);
+	for (i = 0; i < 32; i++)
+		in.image[1][rng_next(&rng) % sizeof(in.image[1])] ^= 1 << (i % 8);
+
+	if (bitcount_init(&in.bitcount, sizeof(in.image[0]))) {
+		fprintf(stderr, "E: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* kinds sharing most of their bytes, as firmware variants do */
+	struct fp_sample samples[FP_KINDS];
+	static char labels[FP_KINDS][16];
+	for (i = 0; i < FP_KINDS; i++) {
+		for (j = 0; j < sizeof(in.kinds[i]); j++)
+			in.kinds[i][j] = i ? in.kinds[0][j] : rng_next(&rng);
+		for (j = 0; j < 64; j++)
+			in.kinds[i][rng_next(&rng) % sizeof(in.kinds[i])] = rng_next(&rng);
+		snprintf(labels[i], sizeof(labels[i]), "kind%zu", i);
+		samples[i] = (struct fp_sample){ labels[i], in.kinds[i], sizeof(in.kinds[i]) };
+	}
+	if (fp_learn(&in.fp, samples, FP_KINDS))
+		exit(EXIT_FAILURE);
+
+	/* a shuffled clone's worth of blocks */
+	size_t n = sizeof(in.order) / sizeof(in.order[0]);
+	for (i = 0; i < n; i++)
+		in.order[i] = i;
+	for (i = n - 1; i > 0; i--) {
+		j = rng_next(&rng) % (i + 1);
+		size_t t = in.order[i];
+		in.order[i] = in.order[j];
+		in.order[j] = t;
+	}
+
+	/* most memories in use, with a plausible 2m channel in each */
+	for (i = 0; i < CHANS; i++) {
+		uint8_t *rec = in.chan_image + i * bench_layout.stride;
+		uint64_t r = rng_next(&rng);
+		uint32_t khz = 144000 + r % 4000 / 5 * 5;
+		rec[0] = (r >> 32) % 8 ? 0x80 : 0;
+		rec[1] = (r >> 36) % 3 | ((r >> 38) % 3) << 2;
+		rec[2] = (1 + (r >> 40) % 4) | (1 + (r >> 42) % 4) << 3;
+		rec[3] = 1 + (r >> 44) % 3;
+		rec[12] = (r >> 48) % chan_ctcss_ct;
+		rec[13] = (r >> 56) % chan_ctcss_ct;
+		/* BCD of khz * 100, tx 600 kHz down */
+		uint32_t v = khz * 100;
+		for (j = 4; j-- > 0; v /= 100)
+			rec[4 + j] = (v / 10 % 10) << 4 | v % 10;
+		v = (khz - 600) * 1000;
+		for (j = 0; j < 4; j++)
+			rec[8 + j] = v >> (j * 8);
+		snprintf((char *)rec + 16, 9, "CH%-6zu", i);
+	}
+	chan_table_init(&in.chans);
+	if (chan_decode(&in.chans, &bench_layout, in.chan_image, sizeof(in.chan_image)) < 0)
+		exit(EXIT_FAILURE);
+
+	/* 12.5 kHz steps, no AM, 6 byte names and half the memories */
+	chan_caps_from_layout(&in.small, &bench_layout);
+	in.small.model = "bench/small";
+	in.small.rx.step = in.small.tx.step = 12500;
+	in.small.mods &= ~(1 << CHAN_MOD_AM);
+	in.small.name_len = 6;
+	in.small.count = CHANS / 2;
+	if (fb_compile(&in.rules,
+			"unfit=rx round\n"
+			"unfit=tx round\n"
+			"model=bench mod=AM set mod=FM\n"
+			"unfit=name truncate\n"
+			"unfit=number drop\n", "bench"))
+		exit(EXIT_FAILURE);
+
+	/* mostly a channel's own tone, some with more to them */
+	for (i = 0; i < CHANS; i++) {
+		unsigned ctcss = chan_ctcss_dhz[in.chans.rx_code[i] % chan_ctcss_ct];
+		uint16_t dcs = chan_dcs[in.chans.rx_code[i] % chan_dcs_ct];
+		const char *fmt[] = {
+			"ctcss=%u.%u",
+			"ctcss=%u.%u & s>=3",
+			"(ctcss=%u.%u | dcs=%03u) & !page=12",
+			"carrier",
+		};
+		snprintf(in.sq_text[i], sizeof(in.sq_text[i]), fmt[i % 4],
+				ctcss / 10, ctcss % 10, dcs);
+		if (sq_compile(&in.sq[i], in.sq_text[i]))
+			exit(EXIT_FAILURE);
+	}
+
+	in.null = fopen("/dev/null", "w");
+	if (!in.null) {
+		fprintf(stderr, "E: could not open /dev/null\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void
+b_pkt_encode(size_t iter)
+{
+	size_t i;
+	char pkt[PKT_BYTES];
+	for (i = 0; i < iter; i++) {
+		size_t k = i % POOL;
+		pkt_encode(&dj_c7, k * DATA_LEN, in.data[k], pkt);
+		sink += pkt[PKT_BYTES - 2];
+	}
+}
+
+static void
+b_pkt_decode(size_t iter)
+{
+	size_t i;
+	struct dj_pkt p;
+	for (i = 0; i < iter; i++) {
+		if (pkt_decode(&dj_c7, &p, in.pkts[i % POOL]) < 0)
+			exit(EXIT_FAILURE);
+		sink += p.data[0];
+	}
+}
+
+static void
+b_hex_decode(size_t iter)
+{
+	size_t i;
+	uint8_t out[DATA_LEN];
+	for (i = 0; i < iter; i++) {
+		/* the data field of a packet */
+		if (hex_decode(out, in.pkts[i % POOL] + DATA_AT, DATA_LEN, NULL))
+			exit(EXIT_FAILURE);
+		sink += out[0];
+	}
+}
+
+static void
+b_pkt_is_ok(size_t iter)
+{
+	size_t i;
+	for (i = 0; i < iter; i++)
+		sink += pkt_is_ok(&dj_c7, &in.decoded[i % POOL]);
+}
+
+static void
+b_print_pkt(size_t iter)
+{
+	size_t i;
+	for (i = 0; i < iter; i++)
+		print_bytes_as_cstring(in.pkts[i % POOL], PKT_BYTES, in.null);
+}
+
+static void
+b_print_binary(size_t iter)
+{
+	size_t i;
+	for (i = 0; i < iter; i++)
+		print_bytes_as_cstring(in.binary[i % POOL], sizeof(in.binary[0]), in.null);
+}
+
+static void
+b_print_hexdump(size_t iter)
+{
+	size_t i;
+	for (i = 0; i < iter; i++)
+		print_hexdump(in.binary, sizeof(in.binary), 0, in.null);
+}
+
+static void
+b_bindiff_pair(size_t iter)
+{
+	size_t i;
+	for (i = 0; i < iter; i++)
+		sink += bindiff_pair(in.image[0], in.image[1], sizeof(in.image[0]),
+				in.changed, NULL);
+}
+
+static void
+b_bitcount_add(size_t iter)
+{
+	size_t i;
+	for (i = 0; i < iter; i++)
+		bitcount_add_xor(&in.bitcount, in.image[0], in.image[1]);
+	sink += in.bitcount.pending;
+}
+
+static void
+b_fp_classify(size_t iter)
+{
+	size_t i;
+	struct fp_result r;
+	for (i = 0; i < iter; i++) {
+		fp_classify(&in.fp, in.kinds[i % FP_KINDS], sizeof(in.kinds[0]), &r);
+		sink += r.hits;
+	}
+}
+
+/* one op is converting every memory of a CHANS memory image */
+static void
+b_chan_decode(size_t iter)
+{
+	size_t i;
+	struct chan_table t;
+	chan_table_init(&t);
+	for (i = 0; i < iter; i++) {
+		t.ct = 0;
+		t.names_len = 0;
+		if (chan_decode(&t, &bench_layout, in.chan_image, sizeof(in.chan_image)) < 0)
+			exit(EXIT_FAILURE);
+		sink += t.ct;
+	}
+	chan_table_destroy(&t);
+}
+
+static void
+b_chan_encode(size_t iter)
+{
+	size_t i;
+	static uint8_t image[sizeof(in.chan_image)];
+	for (i = 0; i < iter; i++) {
+		if (chan_encode(&in.chans, &bench_layout, image, sizeof(image)))
+			exit(EXIT_FAILURE);
+		sink += image[i % sizeof(image)];
+	}
+}
+
+/* one op is converting every channel of in.chans for in.small */
+static void
+b_fb_apply(size_t iter)
+{
+	size_t i;
+	struct chan_table t;
+	struct fb_report r;
+	chan_table_init(&t);
+	fb_report_init(&r);
+	for (i = 0; i < iter; i++) {
+		if (fb_apply(&in.rules, &in.small, &in.chans, &t, &r))
+			exit(EXIT_FAILURE);
+		sink += r.ct;
+	}
+	fb_report_destroy(&r);
+	chan_table_destroy(&t);
+}
+
+/* one op is compiling every channel's unsquelch condition */
+static void
+b_sq_compile(size_t iter)
+{
+	size_t i, j;
+	struct sq_prog p;
+	for (i = 0; i < iter; i++) {
+		for (j = 0; j < CHANS; j++) {
+			if (sq_compile(&p, in.sq_text[j]))
+				exit(EXIT_FAILURE);
+			sink += p.op_ct;
+		}
+	}
+}
+
+/* one op is matching every channel's unsquelch condition to a radio */
+static void
+b_sq_match(size_t iter)
+{
+	static const struct sq_caps caps = {
+		.tones = 1 << CHAN_TONE_NONE | 1 << CHAN_TONE_CTCSS,
+		.s_max = 9,
+	};
+	size_t i, j;
+	for (i = 0; i < iter; i++) {
+		for (j = 0; j < CHANS; j++) {
+			struct sq_setting s;
+			sink += sq_match(&in.sq[j], &caps, &s);
+		}
+	}
+}
+
+/* one op is a whole clone's worth of inserts into an empty memory */
+static void
+memory_clone(size_t iter, bool shuffled)
+{
+	size_t i, j, n = sizeof(in.order) / sizeof(in.order[0]);
+	for (i = 0; i < iter; i++) {
+		struct memory m;
+		memory_init(&m);
+		for (j = 0; j < n; j++) {
+			size_t blk = shuffled ? in.order[j] : j;
+			if (memory_insert(&m, in.data[blk % POOL], DATA_LEN, blk * DATA_LEN))
+				exit(EXIT_FAILURE);
+		}
+		sink += memory_range_ct(&m);
+		memory_destroy(&m);
+	}
+}
+
+static void
+b_memory_insert_seq(size_t iter)
+{
+	memory_clone(iter, false);
+}
+
+static void
+b_memory_insert_rand(size_t iter)
+{
+	memory_clone(iter, true);
+}
+
+struct bench {
+	const char *name;
+	void (*fn)(size_t iter);
+	/* bytes handled per op, for the throughput column */
+	size_t bytes;
+};
+
+static const struct bench benches[] = {
+	{ "pkt_encode",              b_pkt_encode,         PKT_BYTES },
+	{ "pkt_decode",              b_pkt_decode,         PKT_BYTES },
+	{ "hex_decode/16",           b_hex_decode,         DATA_LEN * 2 },
+	{ "pkt_is_ok",               b_pkt_is_ok,          PKT_BYTES },
+	{ "print_bytes_as_cstring/pkt", b_print_pkt,       PKT_BYTES },
+	{ "print_bytes_as_cstring/bin", b_print_binary,    64 },
+	{ "print_hexdump/16k",       b_print_hexdump,      POOL * 64 },
+	{ "bindiff_pair/32k",        b_bindiff_pair,       0x8000 },
+	{ "bitcount_add_xor/32k",    b_bitcount_add,       0x8000 },
+	{ "fp_classify/256",         b_fp_classify,        0x1000 },
+	{ "memory_insert/clone-seq", b_memory_insert_seq,  0x1000 },
+	{ "memory_insert/clone-rand", b_memory_insert_rand, 0x1000 },
+	{ "chan_decode/16k",         b_chan_decode,        CHANS * 32 },
+	{ "chan_encode/16k",         b_chan_encode,        CHANS * 32 },
+	{ "fb_apply/16k",            b_fb_apply,           CHANS * 32 },
+	{ "sq_compile/16k",          b_sq_compile,         sizeof(in.sq_text) },
+	{ "sq_match/16k",            b_sq_match,           CHANS * 32 },
+};
+
+/* the fastest of @rounds rounds, in ns/op */
+static double
+run(const struct bench *b, uint64_t min_ns, unsigned rounds)
+{
+	/* warm up, and find an iteration count that takes long enough */
+	size_t iter = 1;
+	for (;;) {
+		uint64_t t = now_ns();
+		b->fn(iter);
+		t = now_ns() - t;
+		if (t >= min_ns / 4)
+			break;
+		iter *= 2;
+	}
+	iter *= 4;
+
+	double best = 0;
+	unsigned r;
+	for (r = 0; r < rounds; r++) {
+		uint64_t t = now_ns();
+		b->fn(iter);
+		double ns = (double)(now_ns() - t) / iter;
+		if (!r || ns < best)
+			best = ns;
+	}
+
+	return best;
+}
+
+/* ns/op of @name in the baseline, 0 if it isn't there */
+static double
+baseline_lookup(FILE *f, const char *name)
+{
+	char line[256];
+	rewind(f);
+	while (fgets(line, sizeof(line), f)) {
+		char n[128];
+		double ns;
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%127s %lf", n, &ns) == 2 && !strcmp(n, name))
+			return ns;
+	}
+	return 0;
+}
+
+static const char *opts = "hS:t:r:b:";
+
+static void usage_(const char *prgm, int e)
+{
+	FILE *f;
+	if (e)
+		f = stderr;
+	else
+		f = stdout;
+
+	fprintf(f,
+"%sUsage: %s [options] [<name>...]\n"
+"Run the benchmarks, or only those whose names start with a <name>\n"
+"Options: -%s\n"
+"  -S <seed>      random seed for the inputs (default: 1)\n"
+"  -t <ms>        minimum length of a timed round (default: 200)\n"
+"  -r <rounds>    timed rounds, the fastest is reported (default: 5)\n"
+"  -b <baseline>  also show the change from a previous run's output\n"
+	, e?"\n":"", prgm, opts);
+
+	exit(e);
+}
+#define usage(e) usage_(argc?argv[0]:"bench", e)
+
+int main(int argc, char *argv[])
+{
+	uint64_t seed = 1;
+	uint64_t min_ns = 200000000;
+	unsigned rounds = 5;
+	const char *baseline_file = NULL;
+	int opt, e = 0;
+
+	while ((opt = getopt(argc, argv, opts)) != -1) {
+		switch (opt) {
+		case 'h':
+			usage(EXIT_SUCCESS);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			min_ns = strtoull(optarg, NULL, 0) * 1000000;
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			baseline_file = optarg;
+			break;
+		default:
+			e++;
+			break;
+		}
+	}
+
+	if (!rounds) {
+		fprintf(stderr, "E: -r must be at least 1\n");
+		e++;
+	}
+
+	if (e)
+		usage(EXIT_FAILURE);
+
+	FILE *baseline = NULL;
+	if (baseline_file) {
+		baseline = fopen(baseline_file, "r");
+		if (!baseline) {
+			fprintf(stderr, "E: could not open baseline '%s'\n", baseline_file);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	setup(seed);
+
+	printf("# %-30s %12s %12s%s\n", "name", "ns/op", "MB/s", baseline ? "       change" : "");
+	size_t i;
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		const struct bench *b = &benches[i];
+		if (optind < argc) {
+			int a;
+			for (a = optind; a < argc; a++)
+				if (!strncmp(b->name, argv[a], strlen(argv[a])))
+					break;
+			if (a == argc)
+				continue;
+		}
+
+		double ns = run(b, min_ns, rounds);
+		printf("  %-30s %12.2f %12.1f", b->name, ns, b->bytes * 1e3 / ns);
+		if (baseline) {
+			double base = baseline_lookup(baseline, b->name);
+			if (base > 0)
+				printf(" %+11.1f%%", (ns - base) * 100 / base);
+			else
+				printf(" %12s", "new");
+		}
+		putchar('\n');
+		fflush(stdout);
+	}
+
+	if (baseline)
+		fclose(baseline);
+	bitcount_destroy(&in.bitcount);
+	fp_destroy(&in.fp);
+	fclose(in.null);
+	return 0;
+}
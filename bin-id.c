@@ -1,14 +1,30 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <unistd.h>
 
+#include "bin-index.h"
+#include "bindiff.h"
+#include "intern.h"
+
 /*
  * each file has a set of (property,value) pairs associated with it.
  * we want to do a bit-wise diff on every pair of files that has that property set
  *
  * keep track of the bits that differ for a given property when it's value changes.
- * 
+ *
  * Some of these bits are related to the property
  * If these bits change for other properties, they are less likely to be related to our property
  * If these bits don't change for our property some of the time, they are less likely to be related
@@ -21,14 +37,947 @@
  *
  * Problems:
  *  - only know things for sure if we know the storage mechanism
+ *
+ * The per-bit counts are kept by a bitcount (bindiff.h), which adds a whole
+ * image diff at a time rather than looping over each bit of every pair. The
+ * pairs are split between threads (-j), each counting into its own bitcounts
+ * which are summed afterwards, so the results don't depend on the split.
+ *
+ * With an index (-i, bin-index.h) the counts of the previous run are the
+ * starting point: only the pairs involving files that were added, changed or
+ * removed since are counted (or taken out), and the index is updated.
+ *
+ * A bit's confidence is the fraction of the pairs where the value changed in
+ * which it flipped, times the fraction of pairs where the value stayed the
+ * same in which it did not.
+ */
+
+#define DESC_SUFFIX ".desc.txt"
+
+/* ids of an interned property name and value */
+struct setting {
+	uint32_t prop, value;
+};
+
+/* a setting as parsed, pointing into the mapped description */
+struct raw_setting {
+	const char *name, *value;
+	uint32_t name_len, value_len;
+	size_t line;
+};
+
+struct file {
+	char *path;
+	const uint8_t *data;
+	size_t len;
+
+	const char *desc;
+	size_t desc_len;
+	struct raw_setting *raw;
+
+	/* sorted by property */
+	struct setting *settings;
+	size_t setting_ct;
+	bool failed;
+
+	/* of the image and description, to tell whether the index is up to date */
+	uint64_t hash;
+	/* the index already counts this file's pairs */
+	bool kept;
+};
+
+static struct intern props, values;
+static struct file *files;
+static size_t file_ct, file_alloc;
+
+static double min_confidence = 0.5;
+static bool verbose;
+static unsigned threads;
+static const char *index_path;
+
+static void *
+xrealloc(void *p, size_t sz)
+{
+	p = realloc(p, sz ? sz : 1);
+	if (!p) {
+		fprintf(stderr, "E: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+static uint32_t
+xintern(struct intern *t, const char *s, size_t len)
+{
+	uint32_t id = intern_add(t, s, len);
+	if (id == INTERN_NONE) {
+		fprintf(stderr, "E: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return id;
+}
+
+enum {
+	CH_NAME = 1,
+	CH_VALUE = 2,
+	CH_SPACE = 4,
+};
+
+#define NV (CH_NAME | CH_VALUE)
+static const uint8_t char_class[256] = {
+	['a' ... 'z'] = NV, ['A' ... 'Z'] = NV, ['0' ... '9'] = NV,
+	['['] = NV, [']'] = NV, ['_'] = NV, ['{'] = NV, ['}'] = NV, ['!'] = NV,
+	['@'] = NV, ['$'] = NV, ['%'] = NV, ['^'] = NV, ['&'] = NV, ['*'] = NV,
+	['('] = NV, [')'] = NV, ['+'] = NV, ['<'] = NV, ['>'] = NV, ['~'] = NV,
+	['`'] = NV,
+	/* only in values, for frequencies & offsets */
+	['.'] = CH_VALUE, ['-'] = CH_VALUE,
+	[' '] = CH_SPACE, ['\t'] = CH_SPACE, ['\r'] = CH_SPACE,
+};
+#undef NV
+
+static const char *
+skip_class(const char *s, const char *end, uint8_t class)
+{
+	while (s < end && (char_class[(uint8_t)*s] & class))
+		s++;
+	return s;
+}
+
+__attribute__((format(printf, 6, 7)))
+static int
+parse_error(const char *path, size_t line_nr, const char *line, const char *at,
+		const char *end, const char *fmt, ...)
+{
+	char found[16];
+	if (at == end)
+		snprintf(found, sizeof(found), "end of file");
+	else if (*at == '\n')
+		snprintf(found, sizeof(found), "end of line");
+	else if (*at > ' ' && *at < 0x7f)
+		snprintf(found, sizeof(found), "'%c'", *at);
+	else
+		snprintf(found, sizeof(found), "byte 0x%02x", (uint8_t)*at);
+
+	va_list ap;
+	fprintf(stderr, "E: %s:%zu:%zu: ", path, line_nr, (size_t)(at - line) + 1);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, ", found %s\n", found);
+	return -1;
+}
+
+/* the first '[' or ']' in @name that doesn't pair up, NULL if they all do */
+static const char *
+bad_bracket(const char *name, const char *end)
+{
+	const char *open = NULL;
+	for (; name < end; name++) {
+		if (*name == '[') {
+			if (open)
+				return name;
+			open = name;
+		} else if (*name == ']') {
+			if (!open || name == open + 1)
+				return name;
+			open = NULL;
+		}
+	}
+	return open;
+}
+
+/*
+ * Split f->desc into f->raw in a single pass over the mapped file, without
+ * copying anything. Doesn't touch anything shared, so files can be parsed in
+ * parallel.
  */
+static int
+desc_parse(struct file *f, const char *path)
+{
+	const char *p = f->desc, *end = f->desc + f->desc_len;
+	size_t line_nr = 0, alloc = 0;
+	while (p < end) {
+		const char *line = p;
+		line_nr++;
+
+		p = skip_class(p, end, CH_SPACE);
+		if (p < end && *p == '#') {
+			p = memchr(p, '\n', end - p);
+			p = p ? p + 1 : end;
+			continue;
+		}
+		if (p == end)
+			break;
+		if (*p == '\n') {
+			p++;
+			continue;
+		}
+
+		const char *name = p;
+		p = skip_class(p, end, CH_NAME);
+		if (p == name)
+			return parse_error(path, line_nr, line, p, end, "expected a property name");
+		const char *name_end = p, *b = bad_bracket(name, name_end);
+		if (b)
+			return parse_error(path, line_nr, line, b, end, "unbalanced brackets in '%.*s'",
+					(int)(name_end - name), name);
+
+		p = skip_class(p, end, CH_SPACE);
+		if (p == end || *p != '=')
+			return parse_error(path, line_nr, line, p, end, "expected '=' after '%.*s'",
+					(int)(name_end - name), name);
+
+		const char *v = skip_class(p + 1, end, CH_SPACE);
+		p = skip_class(v, end, CH_VALUE);
+		if (p == v)
+			return parse_error(path, line_nr, line, p, end, "expected a value for '%.*s'",
+					(int)(name_end - name), name);
+		const char *v_end = p;
+
+		p = skip_class(p, end, CH_SPACE);
+		if (p < end && *p != '\n')
+			return parse_error(path, line_nr, line, p, end,
+					"expected the end of the line after '%.*s'",
+					(int)(v_end - v), v);
+		p++;
+
+		if (f->setting_ct == alloc) {
+			alloc = alloc ? alloc * 2 : 16;
+			f->raw = xrealloc(f->raw, alloc * sizeof(*f->raw));
+		}
+		f->raw[f->setting_ct++] = (struct raw_setting){
+			.name = name,
+			.name_len = name_end - name,
+			.value = v,
+			.value_len = v_end - v,
+			.line = line_nr,
+		};
+	}
+
+	return 0;
+}
+
+/* a quick (non-cryptographic) hash, @seed chains several buffers */
+static uint64_t
+hash64(const void *data, size_t len, uint64_t seed)
+{
+	const uint8_t *p = data;
+	uint64_t h = seed ^ (len * 0x9e3779b97f4a7c15);
+	size_t i;
+	for (i = 0; i + 8 <= len; i += 8) {
+		uint64_t v;
+		memcpy(&v, p + i, sizeof(v));
+		h = (h ^ v) * 0xbf58476d1ce4e5b9;
+		h ^= h >> 31;
+	}
+	for (; i < len; i++)
+		h = (h ^ p[i]) * 0x100000001b3;
+	/* splitmix64's finalizer */
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111eb;
+	return h ^ (h >> 31);
+}
+
+/* map all of @path read only, an empty file is NULL */
+static int
+map_file(const char *path, const void **data, size_t *len)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "E: could not open '%s': %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		fprintf(stderr, "E: could not stat '%s': %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	*len = st.st_size;
+	*data = NULL;
+	if (*len) {
+		void *m = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (m == MAP_FAILED) {
+			fprintf(stderr, "E: could not map '%s': %s\n", path, strerror(errno));
+			close(fd);
+			return -1;
+		}
+		*data = m;
+	}
+
+	close(fd);
+	return 0;
+}
+
+static void
+file_load(struct file *f)
+{
+	const void *data, *desc;
+	char *desc_path;
+	if (asprintf(&desc_path, "%s" DESC_SUFFIX, f->path) < 0) {
+		f->failed = true;
+		return;
+	}
+
+	if (map_file(f->path, &data, &f->len) || map_file(desc_path, &desc, &f->desc_len)) {
+		f->failed = true;
+	} else {
+		f->data = data;
+		f->desc = desc;
+		f->failed = desc_parse(f, desc_path);
+		f->hash = hash64(f->desc, f->desc_len, hash64(f->data, f->len, 0));
+	}
+	free(desc_path);
+}
+
+static int
+desc_filter(const struct dirent *d)
+{
+	size_t len = strlen(d->d_name), sl = strlen(DESC_SUFFIX);
+	return len > sl && !strcmp(d->d_name + len - sl, DESC_SUFFIX);
+}
+
+/* add the files of @dir_path, they are loaded by load_files() */
 static void process_dir(const char *dir_path)
 {
-	(void)dir_path;
+	struct dirent **ents;
+	int n = scandir(dir_path, &ents, desc_filter, alphasort);
+	if (n < 0) {
+		fprintf(stderr, "E: could not read directory '%s': %s\n", dir_path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	int i;
+	for (i = 0; i < n; i++) {
+		const char *name = ents[i]->d_name;
+		size_t bin_len = strlen(name) - strlen(DESC_SUFFIX);
+
+		if (file_ct == file_alloc) {
+			file_alloc = file_alloc ? file_alloc * 2 : 64;
+			files = xrealloc(files, file_alloc * sizeof(*files));
+		}
+		struct file *f = &files[file_ct++];
+		memset(f, 0, sizeof(*f));
+		if (asprintf(&f->path, "%s/%.*s", dir_path, (int)bin_len, name) < 0) {
+			fprintf(stderr, "E: out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		free(ents[i]);
+	}
+	free(ents);
+}
+
+/* run @fn(@arg, n) on min(threads, @max) threads, returning once all have */
+static void
+run_threads(void *(*fn)(void *), void *arg, size_t size, size_t max)
+{
+	size_t i, n = threads < max ? threads : max;
+	if (n <= 1) {
+		if (max)
+			fn(arg);
+		return;
+	}
+
+	pthread_t *t = xrealloc(NULL, n * sizeof(*t));
+	for (i = 0; i < n; i++) {
+		int r = pthread_create(&t[i], NULL, fn, (char *)arg + i * size);
+		if (r) {
+			fprintf(stderr, "E: could not start a thread: %s\n", strerror(r));
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < n; i++)
+		pthread_join(t[i], NULL);
+	free(t);
+}
+
+static atomic_size_t load_next;
+
+static void *
+load_thread(void *arg)
+{
+	(void)arg;
+	for (;;) {
+		size_t i = atomic_fetch_add(&load_next, 1);
+		if (i >= file_ct)
+			return NULL;
+		file_load(&files[i]);
+	}
+}
+
+static int
+setting_cmp(const void *a_, const void *b_)
+{
+	const struct setting *a = a_, *b = b_;
+	return a->prop < b->prop ? -1 : a->prop > b->prop;
 }
 
+static void
+settings_sort(struct file *f)
+{
+	qsort(f->settings, f->setting_ct, sizeof(*f->settings), setting_cmp);
+}
 
-const char *opts = ":hd:";
+static void
+dup_error(const struct file *f, uint32_t prop)
+{
+	const char *name = intern_str(&props, prop);
+	size_t j, first = 0;
+	for (j = 0; j < f->setting_ct; j++) {
+		const struct raw_setting *r = &f->raw[j];
+		if (r->name_len != strlen(name) || memcmp(r->name, name, r->name_len))
+			continue;
+		if (first) {
+			fprintf(stderr, "E: %s" DESC_SUFFIX ":%zu: '%s' is already set on line %zu\n",
+					f->path, r->line, name, first);
+			return;
+		}
+		first = r->line;
+	}
+}
+
+/*
+ * Map, hash and parse every file, in parallel. Properties and values are
+ * interned afterwards in file order, so their ids don't depend on which thread
+ * got to a file first.
+ */
+static void
+load_files(void)
+{
+	run_threads(load_thread, NULL, 0, file_ct);
+
+	size_t i, j;
+	bool failed = false;
+	for (i = 0; i < file_ct; i++) {
+		struct file *f = &files[i];
+		if (f->failed) {
+			failed = true;
+			continue;
+		}
+
+		f->settings = xrealloc(NULL, f->setting_ct * sizeof(*f->settings));
+		for (j = 0; j < f->setting_ct; j++) {
+			const struct raw_setting *r = &f->raw[j];
+			f->settings[j] = (struct setting){
+				.prop = xintern(&props, r->name, r->name_len),
+				.value = xintern(&values, r->value, r->value_len),
+			};
+		}
+
+		settings_sort(f);
+		/* a property set twice is most likely a mistake in the description */
+		for (j = 1; j < f->setting_ct; j++) {
+			if (f->settings[j].prop == f->settings[j - 1].prop) {
+				dup_error(f, f->settings[j].prop);
+				failed = true;
+				break;
+			}
+		}
+		free(f->raw);
+		f->raw = NULL;
+		if (f->desc)
+			munmap((void *)f->desc, f->desc_len);
+		f->desc = NULL;
+	}
+
+	if (failed)
+		exit(EXIT_FAILURE);
+}
+
+struct member {
+	const uint8_t *data;
+	size_t value;
+};
+
+/* compare member i with members j0 .. j1 - 1 */
+struct task {
+	size_t i, j0, j1;
+};
+
+/* pairs per task, few enough to keep the threads balanced near the end */
+#define TASK_PAIRS 64
+
+/*
+ * Each worker starts with an equal share of the tasks, [next, end), taking
+ * them from the front. One that runs out steals the back half of another's.
+ */
+struct worker {
+	pthread_mutex_t lock;
+	size_t next, end;
+
+	/* per worker counts, summed once all are done */
+	struct bitcount with, without;
+	size_t n_with, n_without;
+
+	struct job *job;
+	size_t id;
+};
+
+struct job {
+	const struct member *m;
+	const struct task *tasks;
+	struct worker *workers;
+	size_t worker_ct;
+};
+
+static bool
+task_take(struct worker *w, size_t *task)
+{
+	bool ok = false;
+	pthread_mutex_lock(&w->lock);
+	if (w->next < w->end) {
+		*task = w->next++;
+		ok = true;
+	}
+	pthread_mutex_unlock(&w->lock);
+	return ok;
+}
+
+static bool
+task_steal(struct worker *w)
+{
+	struct job *job = w->job;
+	size_t k;
+	for (k = 1; k < job->worker_ct; k++) {
+		struct worker *v = &job->workers[(w->id + k) % job->worker_ct];
+		size_t start = 0, end = 0;
+
+		pthread_mutex_lock(&v->lock);
+		if (v->next < v->end) {
+			start = v->next + (v->end - v->next) / 2;
+			end = v->end;
+			v->end = start;
+		}
+		pthread_mutex_unlock(&v->lock);
+
+		if (start < end) {
+			pthread_mutex_lock(&w->lock);
+			w->next = start;
+			w->end = end;
+			pthread_mutex_unlock(&w->lock);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void *
+pair_thread(void *arg)
+{
+	struct worker *w = arg;
+	const struct member *m = w->job->m;
+	size_t t, j;
+
+	do {
+		while (task_take(w, &t)) {
+			const struct task *task = &w->job->tasks[t];
+			for (j = task->j0; j < task->j1; j++) {
+				const struct member *a = &m[task->i], *b = &m[j];
+				if (a->value != b->value) {
+					bitcount_add_xor(&w->with, a->data, b->data);
+					w->n_with++;
+				} else {
+					bitcount_add_xor(&w->without, a->data, b->data);
+					w->n_without++;
+				}
+			}
+		}
+	} while (task_steal(w));
+
+	bitcount_flush(&w->with);
+	bitcount_flush(&w->without);
+	return NULL;
+}
+
+/* counts for one property, a pair at a time or from the index */
+struct counts {
+	uint32_t *with, *without;
+	uint64_t n_with, n_without;
+};
+
+/*
+ * Count the pairs of the @n members @m that involve a member from @first on:
+ * each of those against every member before it. The counts are added to @c,
+ * or taken away if @subtract.
+ */
+static void
+count_pairs(const struct member *m, size_t n, size_t first, size_t len,
+		struct worker *workers, struct counts *c, bool subtract)
+{
+	size_t i, j, task_ct = 0, task_alloc = 0;
+	struct task *tasks = NULL;
+	for (i = first; i < n; i++) {
+		for (j = 0; j < i; j += TASK_PAIRS) {
+			if (task_ct == task_alloc) {
+				task_alloc = task_alloc ? task_alloc * 2 : 256;
+				tasks = xrealloc(tasks, task_alloc * sizeof(*tasks));
+			}
+			tasks[task_ct++] = (struct task){
+				.i = i, .j0 = j, .j1 = j + TASK_PAIRS < i ? j + TASK_PAIRS : i,
+			};
+		}
+	}
+
+	struct job job = {
+		.m = m,
+		.tasks = tasks,
+		.workers = workers,
+		.worker_ct = threads < task_ct ? threads : task_ct,
+	};
+	for (i = 0; i < job.worker_ct; i++) {
+		struct worker *w = &workers[i];
+		w->next = task_ct * i / job.worker_ct;
+		w->end = task_ct * (i + 1) / job.worker_ct;
+		w->n_with = w->n_without = 0;
+		memset(w->with.count, 0, len * 8 * sizeof(*w->with.count));
+		memset(w->without.count, 0, len * 8 * sizeof(*w->without.count));
+		w->job = &job;
+	}
+
+	run_threads(pair_thread, workers, sizeof(*workers), task_ct);
+
+	/* sums of integers, so the same whichever worker did what */
+	for (i = 0; i < job.worker_ct; i++) {
+		const struct worker *w = &workers[i];
+		if (subtract) {
+			for (j = 0; j < len * 8; j++) {
+				c->with[j] -= w->with.count[j];
+				c->without[j] -= w->without.count[j];
+			}
+			c->n_with -= w->n_with;
+			c->n_without -= w->n_without;
+		} else {
+			for (j = 0; j < len * 8; j++) {
+				c->with[j] += w->with.count[j];
+				c->without[j] += w->without.count[j];
+			}
+			c->n_with += w->n_with;
+			c->n_without += w->n_without;
+		}
+	}
+	free(tasks);
+}
+
+/*
+ * The files of @f (@n of them, the @kept ones or the others) that set each
+ * property, with the value they set it to: those setting property p are
+ * m[first[p]] .. m[first[p + 1] - 1].
+ */
+struct by_prop {
+	size_t *first;
+	struct member *m;
+};
+
+static void
+by_prop_init(struct by_prop *bp, const struct file *f, size_t n, bool kept)
+{
+	size_t i, j, total = 0;
+	bp->first = xrealloc(NULL, (props.ct + 1) * sizeof(*bp->first));
+	memset(bp->first, 0, (props.ct + 1) * sizeof(*bp->first));
+	for (i = 0; i < n; i++) {
+		if (f[i].kept != kept)
+			continue;
+		for (j = 0; j < f[i].setting_ct; j++)
+			bp->first[f[i].settings[j].prop + 1]++;
+		total += f[i].setting_ct;
+	}
+	for (i = 0; i < props.ct; i++)
+		bp->first[i + 1] += bp->first[i];
+
+	/* fill in file order, using first[p] as the next free slot for p */
+	bp->m = xrealloc(NULL, total * sizeof(*bp->m));
+	for (i = 0; i < n; i++) {
+		if (f[i].kept != kept)
+			continue;
+		for (j = 0; j < f[i].setting_ct; j++) {
+			const struct setting *st = &f[i].settings[j];
+			bp->m[bp->first[st->prop]++] = (struct member){ f[i].data, st->value };
+		}
+	}
+	/* which leaves each first[p] where first[p + 1] started */
+	memmove(bp->first + 1, bp->first, props.ct * sizeof(*bp->first));
+	bp->first[0] = 0;
+}
+
+static void
+by_prop_destroy(struct by_prop *bp)
+{
+	free(bp->first);
+	free(bp->m);
+}
+
+/* append the members of @prop in @bp to the @ct in @m */
+static size_t
+add_members(struct member *m, size_t ct, const struct by_prop *bp, uint32_t prop)
+{
+	size_t n = bp->first[prop + 1] - bp->first[prop];
+	memcpy(m + ct, bp->m + bp->first[prop], n * sizeof(*m));
+	return ct + n;
+}
+
+static void
+print_prop(size_t prop, size_t len, const struct counts *c)
+{
+	size_t i;
+	if (!c->n_with) {
+		if (verbose)
+			fprintf(stderr, "I: '%s' never changes value, skipping\n", intern_str(&props, prop));
+		return;
+	}
+
+	for (i = 0; i < len * 8; i++) {
+		uint32_t w = c->with[i], nw = c->without[i];
+		if (!w)
+			continue;
+		double conf = (double)w / c->n_with;
+		if (c->n_without)
+			conf *= 1 - (double)nw / c->n_without;
+		if (conf < min_confidence)
+			continue;
+
+		printf("0x%04zx:%zu = %s %.3f", i / 8, i % 8, intern_str(&props, prop), conf);
+		if (verbose)
+			printf(" (in %u/%" PRIu64 " changes, %u/%" PRIu64 " non-changes)",
+					w, c->n_with, nw, c->n_without);
+		putchar('\n');
+	}
+}
+
+static int
+path_cmp(const void *a, const void *b)
+{
+	return strcmp((*(struct file *const *)a)->path, (*(struct file *const *)b)->path);
+}
+
+static int
+prop_name_cmp(const void *a, const void *b)
+{
+	return strcmp(intern_str(&props, *(const size_t *)a), intern_str(&props, *(const size_t *)b));
+}
+
+/*
+ * Use @ix: files whose path and hash are unchanged are kept (their pairs are
+ * already counted), the other files it has are returned in @old_ct as the ones
+ * whose pairs must be taken out.
+ */
+static struct file *
+index_match(const struct bin_index *ix, size_t *old_ct)
+{
+	struct file *old = xrealloc(NULL, ix->file_ct * sizeof(*old));
+	struct file **by_path = xrealloc(NULL, ix->file_ct * sizeof(*by_path));
+	size_t i, j;
+	for (i = 0; i < ix->file_ct; i++) {
+		const struct bin_index_file *xf = &ix->files[i];
+		old[i] = (struct file){
+			.path = (char *)xf->path,
+			.hash = xf->hash,
+			.data = xf->data,
+			.len = ix->len,
+		};
+		by_path[i] = &old[i];
+	}
+	qsort(by_path, ix->file_ct, sizeof(*by_path), path_cmp);
+
+	/* mark kept on both sides */
+	for (i = 0; i < file_ct; i++) {
+		struct file *f = &files[i], **o;
+		o = bsearch(&f, by_path, ix->file_ct, sizeof(*by_path), path_cmp);
+		if (o && (*o)->hash == f->hash)
+			(*o)->kept = f->kept = true;
+	}
+	free(by_path);
+
+	/* keep only the others, with their settings as interned here */
+	*old_ct = 0;
+	for (i = 0; i < ix->file_ct; i++) {
+		if (old[i].kept)
+			continue;
+		const struct bin_index_file *xf = &ix->files[i];
+		struct file *o = &old[(*old_ct)++];
+		*o = old[i];
+
+		o->settings = xrealloc(NULL, xf->setting_ct * sizeof(*o->settings));
+		o->setting_ct = xf->setting_ct;
+		for (j = 0; j < xf->setting_ct; j++) {
+			const char *p = ix->props[xf->settings[2 * j]];
+			const char *v = ix->values[xf->settings[2 * j + 1]];
+			o->settings[j] = (struct setting){
+				.prop = xintern(&props, p, strlen(p)),
+				.value = xintern(&values, v, strlen(v)),
+			};
+		}
+		settings_sort(o);
+	}
+
+	return old;
+}
+
+/* start @c from the index's count record @rec, SIZE_MAX for none */
+static void
+index_counts(const struct bin_index *ix, size_t rec, size_t len, struct counts *c)
+{
+	size_t j;
+	memset(c->with, 0, len * 8 * sizeof(*c->with));
+	memset(c->without, 0, len * 8 * sizeof(*c->without));
+	c->n_with = c->n_without = 0;
+	if (rec == SIZE_MAX)
+		return;
+
+	const struct bin_index_counts *ic = &ix->counts[rec];
+	c->n_with = ic->n_with;
+	c->n_without = ic->n_without;
+	for (j = 0; j < ic->bit_ct; j++) {
+		uint32_t bit, w, nw;
+		bin_index_bit(ic, j, &bit, &w, &nw);
+		c->with[bit] = w;
+		c->without[bit] = nw;
+	}
+}
+
+static void
+process(void)
+{
+	load_files();
+
+	size_t i, j, len = SIZE_MAX;
+	for (i = 0; i < file_ct; i++)
+		if (files[i].len < len)
+			len = files[i].len;
+	for (i = 0; i < file_ct; i++)
+		if (files[i].len != len)
+			fprintf(stderr, "W: '%s' is %zu bytes, only comparing the first %zu\n",
+					files[i].path, files[i].len, len);
+
+	struct bin_index ix = { 0 };
+	struct file *old = NULL;
+	size_t old_ct = 0;
+	if (index_path) {
+		int r = bin_index_load(&ix, index_path);
+		if (r < 0) {
+			fprintf(stderr, "E: remove '%s' to rebuild it\n", index_path);
+			exit(EXIT_FAILURE);
+		}
+		if (!r && ix.len != len) {
+			fprintf(stderr, "W: index '%s' is for %zu byte images, not %zu, rebuilding it\n",
+					index_path, ix.len, len);
+			bin_index_unload(&ix);
+		}
+		old = index_match(&ix, &old_ct);
+	}
+
+	if (verbose) {
+		size_t kept = 0;
+		for (i = 0; i < file_ct; i++)
+			kept += files[i].kept;
+		fprintf(stderr, "I: %zu files, %zu unchanged, %zu new or changed, %zu removed or changed\n",
+				file_ct, kept, file_ct - kept, old_ct);
+	}
+
+	struct counts c = {
+		.with = xrealloc(NULL, len * 8 * sizeof(*c.with)),
+		.without = xrealloc(NULL, len * 8 * sizeof(*c.without)),
+	};
+	struct worker *workers = xrealloc(NULL, threads * sizeof(*workers));
+	bool nomem = false;
+	for (i = 0; i < threads; i++) {
+		struct worker *w = &workers[i];
+		pthread_mutex_init(&w->lock, NULL);
+		w->id = i;
+		nomem = nomem || bitcount_init(&w->with, len) || bitcount_init(&w->without, len);
+	}
+	if (nomem) {
+		fprintf(stderr, "E: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	struct bin_index_writer iw;
+	if (index_path) {
+		if (bin_index_create(&iw, index_path, len, props.ct, values.ct, file_ct, props.ct))
+			exit(EXIT_FAILURE);
+		for (i = 0; i < props.ct; i++)
+			bin_index_put_string(&iw, intern_str(&props, i));
+		for (i = 0; i < values.ct; i++)
+			bin_index_put_string(&iw, intern_str(&values, i));
+
+		uint32_t *s = NULL;
+		for (i = 0; i < file_ct; i++) {
+			const struct file *f = &files[i];
+			s = xrealloc(s, 2 * f->setting_ct * sizeof(*s));
+			for (j = 0; j < f->setting_ct; j++) {
+				s[2 * j] = f->settings[j].prop;
+				s[2 * j + 1] = f->settings[j].value;
+			}
+			bin_index_put_file(&iw, f->path, f->hash, s, f->setting_ct, f->data, len);
+		}
+		free(s);
+	}
+
+	/* by name, so the output doesn't depend on the order files were added in */
+	size_t *order = xrealloc(NULL, props.ct * sizeof(*order));
+	for (i = 0; i < props.ct; i++)
+		order[i] = i;
+	qsort(order, props.ct, sizeof(*order), prop_name_cmp);
+
+	/* the index's count record for each property */
+	size_t *rec = xrealloc(NULL, props.ct * sizeof(*rec));
+	for (i = 0; i < props.ct; i++)
+		rec[i] = SIZE_MAX;
+	for (i = 0; i < ix.count_ct; i++) {
+		const char *name = ix.props[ix.counts[i].prop];
+		uint32_t id = intern_find(&props, name, strlen(name));
+		if (id != INTERN_NONE)
+			rec[id] = i;
+	}
+
+	struct by_prop kept_bp, added_bp, old_bp;
+	by_prop_init(&kept_bp, files, file_ct, true);
+	by_prop_init(&added_bp, files, file_ct, false);
+	by_prop_init(&old_bp, old, old_ct, false);
+
+	struct member *m = xrealloc(NULL, (file_ct + old_ct) * sizeof(*m));
+	for (i = 0; i < props.ct; i++) {
+		size_t prop = order[i];
+		index_counts(&ix, rec[prop], len, &c);
+
+		size_t kept = add_members(m, 0, &kept_bp, prop);
+		size_t n = add_members(m, kept, &old_bp, prop);
+		count_pairs(m, n, kept, len, workers, &c, true);
+		n = add_members(m, kept, &added_bp, prop);
+		count_pairs(m, n, kept, len, workers, &c, false);
+
+		print_prop(prop, len, &c);
+		if (index_path)
+			bin_index_put_counts(&iw, prop, c.n_with, c.n_without,
+					c.with, c.without, len * 8);
+	}
+	free(m);
+	by_prop_destroy(&kept_bp);
+	by_prop_destroy(&added_bp);
+	by_prop_destroy(&old_bp);
+	free(rec);
+	free(order);
+
+	if (index_path && bin_index_commit(&iw))
+		exit(EXIT_FAILURE);
+
+	for (i = 0; i < threads; i++) {
+		bitcount_destroy(&workers[i].with);
+		bitcount_destroy(&workers[i].without);
+		pthread_mutex_destroy(&workers[i].lock);
+	}
+	free(workers);
+	free(c.with);
+	free(c.without);
+	for (i = 0; i < old_ct; i++)
+		free(old[i].settings);
+	free(old);
+	bin_index_unload(&ix);
+}
+
+const char *opts = ":hd:c:vj:i:";
 
 static void
 usage_(const char *prgmname, int e)
@@ -42,6 +991,11 @@ usage_(const char *prgmname, int e)
 	fprintf(f,
 "Usage: %s [-d <datadir>]...\n"
 "Opts: %s\n"
+"  -d <datadir>   add the images in <datadir> (may be given more than once)\n"
+"  -c <min>       only show bits with at least this confidence (default: 0.5)\n"
+"  -v             also show the counts behind each confidence\n"
+"  -j <threads>   threads to use (default: one per CPU)\n"
+"  -i <index>     start from (and update) the counts saved in <index>\n"
 "\n"
 "Given a set of binary files with corresponding descriptions named\n"
 "<binary-file>.desc.txt guess the meaning of bits & bytes within a binary\n"
@@ -52,20 +1006,21 @@ usage_(const char *prgmname, int e)
 " line := comment_line | property_line\n"
 " comment_line := '#.*'\n"
 " property_line := property '=' prop_value\n"
-" prop_value := property\n"
+" prop_value := '[][a-zA-Z0-9_{}!@$%%^&*()+<>~`.-]'\n"
 " property := '[][a-zA-Z0-9_{}!@$%%^&*()+<>~`'\n"
 "Example:\n"
 " displayed_frequency = 144000\n"
 " band_frequency[1] = 144000\n"
 "\n"
-"Omitted properties are allowed to be any value\n"
+"Brackets in a property name must pair up, a property may only be set once\n"
+"per file, and omitted properties are allowed to be any value\n"
 "\n"
 "There are trade-offs in how precise one is in describing a property.\n"
 "\n"
 "Output format:\n"
-"   <hex-byte-address>:<bit> = <property_name>\n"
+"   <hex-byte-address>:<bit> = <property_name> <confidence>\n"
 "Example:\n"
-"   0x412562:4 = band_1\n"
+"   0x412562:4 = band_1 0.875\n"
 "\n"
 "Each line indicates a location that is probably connected to that property\n"
 "Note that if the input data (and description) is insufficient, more bits will\n"
@@ -88,8 +1043,34 @@ int main(int argc, char *argv[])
 		case 'd':
 			process_dir(optarg);
 			break;
+		case 'c':
+			min_confidence = strtod(optarg, NULL);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'j':
+			threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			index_path = optarg;
+			break;
 		case '?':
+		case ':':
 			usage(EXIT_FAILURE);
 		}
 	}
+
+	if (file_ct < 2) {
+		fprintf(stderr, "E: need at least 2 described images (-d)\n");
+		usage(EXIT_FAILURE);
+	}
+
+	if (!threads) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = n > 0 ? n : 1;
+	}
+
+	process();
+	return 0;
 }
@@ -0,0 +1,340 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bin-index.h"
+
+#define HDR_LEN 48
+#define BIT_REC_LEN 12
+
+static void
+put_le32(uint8_t *p, uint32_t v)
+{
+	size_t i;
+	for (i = 0; i < 4; i++)
+		p[i] = v >> (i * 8);
+}
+
+static uint32_t
+get_le32(const uint8_t *p)
+{
+	uint32_t v = 0;
+	size_t i;
+	for (i = 0; i < 4; i++)
+		v |= (uint32_t)p[i] << (i * 8);
+	return v;
+}
+
+static void
+put_le64(uint8_t *p, uint64_t v)
+{
+	size_t i;
+	for (i = 0; i < 8; i++)
+		p[i] = v >> (i * 8);
+}
+
+static uint64_t
+get_le64(const uint8_t *p)
+{
+	uint64_t v = 0;
+	size_t i;
+	for (i = 0; i < 8; i++)
+		v |= (uint64_t)p[i] << (i * 8);
+	return v;
+}
+
+/* bounds checked reading of the mapped index */
+struct cursor {
+	const uint8_t *p, *end;
+	bool bad;
+};
+
+static const uint8_t *
+take(struct cursor *c, uint64_t len)
+{
+	if (c->bad || len > (size_t)(c->end - c->p)) {
+		c->bad = true;
+		return NULL;
+	}
+	const uint8_t *p = c->p;
+	c->p += len;
+	return p;
+}
+
+static uint32_t
+take_le32(struct cursor *c)
+{
+	const uint8_t *p = take(c, 4);
+	return p ? get_le32(p) : 0;
+}
+
+static uint64_t
+take_le64(struct cursor *c)
+{
+	const uint8_t *p = take(c, 8);
+	return p ? get_le64(p) : 0;
+}
+
+static const char *
+take_string(struct cursor *c)
+{
+	uint32_t len = take_le32(c);
+	const uint8_t *s = take(c, (uint64_t)len + 1);
+	if (!s || s[len]) {
+		c->bad = true;
+		return NULL;
+	}
+	return (const char *)s;
+}
+
+/* an array of @n from the file, which is at least @min_size bytes per element */
+static void *
+alloc_array(struct cursor *c, uint64_t n, size_t size, size_t min_size)
+{
+	if (c->bad || n > (size_t)(c->end - c->p) / min_size) {
+		c->bad = true;
+		return NULL;
+	}
+	void *p = calloc(n ? n : 1, size);
+	if (!p)
+		c->bad = true;
+	return p;
+}
+
+int bin_index_load(struct bin_index *ix, const char *path)
+{
+	memset(ix, 0, sizeof(*ix));
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno == ENOENT)
+			return 1;
+		fprintf(stderr, "E: could not open index '%s': %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		fprintf(stderr, "E: could not stat index '%s': %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	ix->map_len = st.st_size;
+	if (ix->map_len < HDR_LEN) {
+		fprintf(stderr, "E: '%s' is not a bin-id index\n", path);
+		close(fd);
+		return -1;
+	}
+
+	ix->map = mmap(NULL, ix->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ix->map == MAP_FAILED) {
+		fprintf(stderr, "E: could not map index '%s': %s\n", path, strerror(errno));
+		ix->map = NULL;
+		return -1;
+	}
+
+	struct cursor c = { .p = ix->map, .end = (uint8_t *)ix->map + ix->map_len };
+	if (memcmp(take(&c, 8), BIN_INDEX_MAGIC, 8)) {
+		fprintf(stderr, "E: '%s' is not a bin-id index\n", path);
+		goto err;
+	}
+
+	ix->len = take_le64(&c);
+	uint64_t prop_ct = take_le64(&c), value_ct = take_le64(&c);
+	uint64_t file_ct = take_le64(&c), count_ct = take_le64(&c);
+	/* every file holds len bytes, and bits are counted in a uint32 */
+	if (ix->len > ix->map_len || ix->len > UINT32_MAX / 8)
+		c.bad = true;
+
+	size_t i, j;
+	ix->props = alloc_array(&c, prop_ct, sizeof(*ix->props), 5);
+	for (i = 0; !c.bad && i < prop_ct; i++)
+		ix->props[i] = take_string(&c);
+	ix->prop_ct = prop_ct;
+
+	ix->values = alloc_array(&c, value_ct, sizeof(*ix->values), 5);
+	for (i = 0; !c.bad && i < value_ct; i++)
+		ix->values[i] = take_string(&c);
+	ix->value_ct = value_ct;
+
+	ix->files = alloc_array(&c, file_ct, sizeof(*ix->files), 17 + ix->len);
+	ix->file_ct = c.bad ? 0 : file_ct;
+	for (i = 0; !c.bad && i < file_ct; i++) {
+		struct bin_index_file *f = &ix->files[i];
+		f->path = take_string(&c);
+		f->hash = take_le64(&c);
+		uint32_t n = take_le32(&c);
+		f->settings = alloc_array(&c, n, 2 * sizeof(*f->settings), 8);
+		f->setting_ct = c.bad ? 0 : n;
+		for (j = 0; !c.bad && j < 2 * (size_t)n; j++) {
+			f->settings[j] = take_le32(&c);
+			if (f->settings[j] >= (j % 2 ? value_ct : prop_ct))
+				c.bad = true;
+		}
+		f->data = take(&c, ix->len);
+	}
+
+	ix->counts = alloc_array(&c, count_ct, sizeof(*ix->counts), 28);
+	ix->count_ct = c.bad ? 0 : count_ct;
+	for (i = 0; !c.bad && i < count_ct; i++) {
+		struct bin_index_counts *ct = &ix->counts[i];
+		ct->prop = take_le32(&c);
+		ct->n_with = take_le64(&c);
+		ct->n_without = take_le64(&c);
+		ct->bit_ct = take_le64(&c);
+		if (ct->prop >= prop_ct || ct->bit_ct > ix->len * 8
+				|| ct->bit_ct > (size_t)(c.end - c.p) / BIT_REC_LEN)
+			c.bad = true;
+		ct->bits = take(&c, ct->bit_ct * BIT_REC_LEN);
+		for (j = 0; !c.bad && j < ct->bit_ct; j++)
+			if (get_le32(ct->bits + j * BIT_REC_LEN) >= ix->len * 8)
+				c.bad = true;
+	}
+
+	if (c.bad || c.p != c.end) {
+		fprintf(stderr, "E: index '%s' is truncated or corrupt\n", path);
+		goto err;
+	}
+
+	return 0;
+
+err:
+	bin_index_unload(ix);
+	return -1;
+}
+
+void bin_index_unload(struct bin_index *ix)
+{
+	size_t i;
+	for (i = 0; ix->files && i < ix->file_ct; i++)
+		free(ix->files[i].settings);
+	free(ix->files);
+	free(ix->props);
+	free(ix->values);
+	free(ix->counts);
+	if (ix->map)
+		munmap(ix->map, ix->map_len);
+	memset(ix, 0, sizeof(*ix));
+}
+
+void bin_index_bit(const struct bin_index_counts *c, size_t i,
+		uint32_t *bit, uint32_t *with, uint32_t *without)
+{
+	const uint8_t *p = c->bits + i * BIT_REC_LEN;
+	*bit = get_le32(p);
+	*with = get_le32(p + 4);
+	*without = get_le32(p + 8);
+}
+
+static void
+put(struct bin_index_writer *w, const void *data, size_t len)
+{
+	fwrite(data, 1, len, w->f);
+}
+
+static void
+put32(struct bin_index_writer *w, uint32_t v)
+{
+	uint8_t b[4];
+	put_le32(b, v);
+	put(w, b, sizeof(b));
+}
+
+static void
+put64(struct bin_index_writer *w, uint64_t v)
+{
+	uint8_t b[8];
+	put_le64(b, v);
+	put(w, b, sizeof(b));
+}
+
+int bin_index_create(struct bin_index_writer *w, const char *path, size_t len,
+		size_t prop_ct, size_t value_ct, size_t file_ct, size_t count_ct)
+{
+	w->path = strdup(path);
+	if (!w->path || asprintf(&w->tmp_path, "%s.tmp", path) < 0) {
+		fprintf(stderr, "E: out of memory\n");
+		free(w->path);
+		return -1;
+	}
+
+	w->f = fopen(w->tmp_path, "wb");
+	if (!w->f) {
+		fprintf(stderr, "E: could not create '%s': %s\n", w->tmp_path, strerror(errno));
+		free(w->path);
+		free(w->tmp_path);
+		return -1;
+	}
+
+	put(w, BIN_INDEX_MAGIC, 8);
+	put64(w, len);
+	put64(w, prop_ct);
+	put64(w, value_ct);
+	put64(w, file_ct);
+	put64(w, count_ct);
+	return 0;
+}
+
+void bin_index_put_string(struct bin_index_writer *w, const char *s)
+{
+	size_t len = strlen(s);
+	put32(w, len);
+	put(w, s, len + 1);
+}
+
+void bin_index_put_file(struct bin_index_writer *w, const char *path, uint64_t hash,
+		const uint32_t *settings, size_t setting_ct, const uint8_t *data, size_t len)
+{
+	size_t i;
+	bin_index_put_string(w, path);
+	put64(w, hash);
+	put32(w, setting_ct);
+	for (i = 0; i < 2 * setting_ct; i++)
+		put32(w, settings[i]);
+	put(w, data, len);
+}
+
+void bin_index_put_counts(struct bin_index_writer *w, uint32_t prop,
+		uint64_t n_with, uint64_t n_without,
+		const uint32_t *with, const uint32_t *without, size_t bits)
+{
+	size_t i, ct = 0;
+	for (i = 0; i < bits; i++)
+		ct += with[i] || without[i];
+
+	put32(w, prop);
+	put64(w, n_with);
+	put64(w, n_without);
+	put64(w, ct);
+	for (i = 0; i < bits; i++) {
+		if (!with[i] && !without[i])
+			continue;
+		put32(w, i);
+		put32(w, with[i]);
+		put32(w, without[i]);
+	}
+}
+
+int bin_index_commit(struct bin_index_writer *w)
+{
+	int r = 0;
+	if (ferror(w->f) | fclose(w->f)) {
+		fprintf(stderr, "E: could not write '%s'\n", w->tmp_path);
+		r = -1;
+	} else if (rename(w->tmp_path, w->path)) {
+		fprintf(stderr, "E: could not replace '%s': %s\n", w->path, strerror(errno));
+		r = -1;
+	}
+
+	if (r)
+		unlink(w->tmp_path);
+	free(w->path);
+	free(w->tmp_path);
+	return r;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+/*
+ * bin-id's index: the per-bit counts from a previous run, plus enough about
+ * the files they came from to update them when files are added, changed or
+ * removed, without comparing every pair again.
+ *
+ * Each file's image is kept so the pairs it was part of can be subtracted
+ * once it changes or goes away, even though the file itself no longer has
+ * that content.
+ *
+ * File format (little endian):
+ *
+ *   header:
+ *     8 bytes   "RPBINID1"
+ *     8 bytes   le64, image length (every image is this long)
+ *     8 bytes   le64, number of property names
+ *     8 bytes   le64, number of values
+ *     8 bytes   le64, number of files
+ *     8 bytes   le64, number of count records
+ *
+ *   strings, property names then values:
+ *     4 bytes   le32, length
+ *     length bytes, then a 0 byte
+ *
+ *   files:
+ *     4 bytes   le32, path length
+ *     path, then a 0 byte
+ *     8 bytes   le64, hash of the image and description
+ *     4 bytes   le32, number of settings
+ *     settings  le32 property, le32 value (indexes into the strings)
+ *     the image
+ *
+ *   count records:
+ *     4 bytes   le32, property
+ *     8 bytes   le64, pairs where the value changed
+ *     8 bytes   le64, pairs where it did not
+ *     8 bytes   le64, number of bits with a count
+ *     bits      le32 bit (byte * 8 + bit), le32 changed count, le32 unchanged count
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define BIN_INDEX_MAGIC "RPBINID1"
+
+struct bin_index_file {
+	const char *path;
+	uint64_t hash;
+	/* setting_ct property, value pairs */
+	uint32_t *settings;
+	size_t setting_ct;
+	const uint8_t *data;
+};
+
+struct bin_index_counts {
+	uint32_t prop;
+	uint64_t n_with, n_without;
+	size_t bit_ct;
+	/* bit_ct records of 3 le32s, as in the file */
+	const uint8_t *bits;
+};
+
+struct bin_index {
+	size_t len;
+	/* point into the mapped file */
+	const char **props, **values;
+	size_t prop_ct, value_ct;
+	struct bin_index_file *files;
+	size_t file_ct;
+	struct bin_index_counts *counts;
+	size_t count_ct;
+
+	void *map;
+	size_t map_len;
+};
+
+/*
+ * Map and check the index at @path. Returns 0 on success, 1 if there is no
+ * index there, -1 (after printing why) if it can't be used.
+ */
+int bin_index_load(struct bin_index *ix, const char *path);
+void bin_index_unload(struct bin_index *ix);
+
+/* the @i'th bit record of @c */
+void bin_index_bit(const struct bin_index_counts *c, size_t i,
+		uint32_t *bit, uint32_t *with, uint32_t *without);
+
+/*
+ * Writing goes to "<path>.tmp", which replaces @path on commit, so an
+ * interrupted run leaves the previous index alone. Everything must be put in
+ * the order of the file format, with the numbers given to create.
+ */
+struct bin_index_writer {
+	FILE *f;
+	char *path, *tmp_path;
+};
+
+int bin_index_create(struct bin_index_writer *w, const char *path, size_t len,
+		size_t prop_ct, size_t value_ct, size_t file_ct, size_t count_ct);
+void bin_index_put_string(struct bin_index_writer *w, const char *s);
+void bin_index_put_file(struct bin_index_writer *w, const char *path, uint64_t hash,
+		const uint32_t *settings, size_t setting_ct, const uint8_t *data, size_t len);
+/* write the bits with a non-zero count in @with or @without (@bits long) */
+void bin_index_put_counts(struct bin_index_writer *w, uint32_t prop,
+		uint64_t n_with, uint64_t n_without,
+		const uint32_t *with, const uint32_t *without, size_t bits);
+/* returns 0 on success, -1 (after printing why, and removing the temporary) on failure */
+int bin_index_commit(struct bin_index_writer *w);
@@ -0,0 +1,281 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bindiff.h"
+
+#if defined(__SSE2__) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define BINDIFF_AVX2 1
+# include <immintrin.h>
+#else
+# define BINDIFF_AVX2 0
+#endif
+
+static inline uint64_t
+load64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/* one bit per non-zero byte of @x, byte 0 in bit 0 (little endian) */
+static inline unsigned
+nonzero_bytes(uint64_t x)
+{
+	const uint64_t lo7 = 0x7f7f7f7f7f7f7f7f;
+	/* the top bit of each byte is set iff the byte is non-zero */
+	uint64_t t = (((x & lo7) + lo7) | x) & ~lo7;
+	/* gather the 8 top bits into the top byte */
+	return (t >> 7) * 0x0102040810204080 >> 56;
+}
+
+static uint64_t
+pair_scalar(const uint8_t *a, const uint8_t *b, size_t len, size_t start,
+		uint64_t *changed, uint8_t *bits)
+{
+	uint64_t pop = 0;
+	size_t i = start;
+
+	for (; i + 8 <= len; i += 8) {
+		uint64_t x = load64(a + i) ^ load64(b + i);
+		if (!x)
+			continue;
+		if (bits) {
+			uint64_t o = load64(bits + i) | x;
+			memcpy(bits + i, &o, sizeof(o));
+		}
+		pop += __builtin_popcountll(x);
+		changed[i / 64] |= (uint64_t)nonzero_bytes(x) << (i % 64);
+	}
+
+	for (; i < len; i++) {
+		uint8_t x = a[i] ^ b[i];
+		if (!x)
+			continue;
+		if (bits)
+			bits[i] |= x;
+		pop += __builtin_popcount(x);
+		changed[i / 64] |= (uint64_t)1 << (i % 64);
+	}
+
+	return pop;
+}
+
+#if BINDIFF_AVX2
+__attribute__((target("avx2")))
+static inline __m256i
+popcount_bytes_avx2(__m256i v)
+{
+	const __m256i lut = _mm256_setr_epi8(
+			0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+			0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low = _mm256_set1_epi8(0x0f);
+	return _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(v, low)),
+			_mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+}
+
+/* whole 64 byte blocks, returns how many bytes were done */
+__attribute__((target("avx2")))
+static size_t
+pair_avx2(const uint8_t *a, const uint8_t *b, size_t len, uint64_t *changed,
+		uint8_t *bits, uint64_t *pop)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i acc = zero;
+	size_t i;
+	for (i = 0; i + 64 <= len; i += 64) {
+		__m256i x0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i)),
+				_mm256_loadu_si256((const __m256i *)(b + i)));
+		__m256i x1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i + 32)),
+				_mm256_loadu_si256((const __m256i *)(b + i + 32)));
+
+		uint32_t same0 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x0, zero));
+		uint32_t same1 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x1, zero));
+		uint64_t m = ~((uint64_t)same1 << 32 | same0);
+		changed[i / 64] = m;
+		if (!m)
+			continue;
+
+		if (bits) {
+			__m256i *o0 = (__m256i *)(bits + i), *o1 = (__m256i *)(bits + i + 32);
+			_mm256_storeu_si256(o0, _mm256_or_si256(_mm256_loadu_si256(o0), x0));
+			_mm256_storeu_si256(o1, _mm256_or_si256(_mm256_loadu_si256(o1), x1));
+		}
+
+		/* per byte counts are at most 16 here, summed into 64 bit lanes */
+		__m256i c = _mm256_add_epi8(popcount_bytes_avx2(x0), popcount_bytes_avx2(x1));
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(c, zero));
+	}
+
+	uint64_t lanes[4];
+	_mm256_storeu_si256((__m256i *)lanes, acc);
+	*pop = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	return i;
+}
+
+/* called from several threads by bin-id */
+static bool
+have_avx2(void)
+{
+	static atomic_int have = -1;
+	int h = atomic_load_explicit(&have, memory_order_relaxed);
+	if (h < 0) {
+		__builtin_cpu_init();
+		h = !!__builtin_cpu_supports("avx2");
+		atomic_store_explicit(&have, h, memory_order_relaxed);
+	}
+	return h;
+}
+#endif
+
+uint64_t bindiff_pair(const uint8_t *a, const uint8_t *b, size_t len,
+		uint64_t *changed, uint8_t *bits)
+{
+	uint64_t pop = 0;
+	size_t done = 0;
+
+#if BINDIFF_AVX2
+	if (len >= 64 && have_avx2())
+		done = pair_avx2(a, b, len, changed, bits, &pop);
+#endif
+
+	size_t w;
+	for (w = done / 64; w < bindiff_words(len); w++)
+		changed[w] = 0;
+
+	return pop + pair_scalar(a, b, len, done, changed, bits);
+}
+
+/*
+ * The planes are laid out in groups of 32 image bytes (4 words): the group's
+ * plane k is the 4 words at planes[(g * BITCOUNT_PLANES + k) * 4]. Word q of a
+ * group holds bytes q * 8 .. q * 8 + 7 of it, little endian, so bit j of word
+ * (g * 4 + q) is counter (g * 4 + q) * 64 + j.
+ */
+#define GROUP_BYTES 32
+
+static size_t
+bitcount_groups(const struct bitcount *c)
+{
+	return (c->len + GROUP_BYTES - 1) / GROUP_BYTES;
+}
+
+int bitcount_init(struct bitcount *c, size_t len)
+{
+	c->len = len;
+	c->pending = 0;
+	c->planes = calloc(bitcount_groups(c) * BITCOUNT_PLANES * 4 + 1, sizeof(*c->planes));
+	c->count = calloc(len * 8 + 1, sizeof(*c->count));
+	if (!c->planes || !c->count) {
+		bitcount_destroy(c);
+		return -1;
+	}
+	return 0;
+}
+
+void bitcount_destroy(struct bitcount *c)
+{
+	free(c->planes);
+	free(c->count);
+	c->planes = NULL;
+	c->count = NULL;
+}
+
+void bitcount_flush(struct bitcount *c)
+{
+	size_t g, k, q, words = (c->len + 7) / 8;
+	for (g = 0; g < bitcount_groups(c); g++) {
+		uint64_t *p = c->planes + g * BITCOUNT_PLANES * 4;
+		for (k = 0; k < BITCOUNT_PLANES; k++) {
+			for (q = 0; q < 4; q++) {
+				uint64_t v = p[k * 4 + q];
+				if (!v)
+					continue;
+				p[k * 4 + q] = 0;
+
+				/* only whole words of the image can have bits set */
+				size_t w = g * 4 + q;
+				if (w >= words)
+					continue;
+				uint32_t *cnt = c->count + w * 64;
+				do {
+					cnt[__builtin_ctzll(v)] += (uint32_t)1 << k;
+					v &= v - 1;
+				} while (v);
+			}
+		}
+	}
+	c->pending = 0;
+}
+
+/* add @x to the counters of one word of a group's planes @p */
+static inline void
+add_word(uint64_t *p, uint64_t x)
+{
+	unsigned k;
+	for (k = 0; x && k < BITCOUNT_PLANES; k++) {
+		uint64_t carry = p[k * 4] & x;
+		p[k * 4] ^= x;
+		x = carry;
+	}
+}
+
+static void
+add_scalar(struct bitcount *c, const uint8_t *a, const uint8_t *b, size_t start)
+{
+	size_t i;
+	for (i = start; i < c->len; i += 8) {
+		uint64_t x;
+		if (i + 8 <= c->len) {
+			x = load64(a + i) ^ load64(b + i);
+		} else {
+			uint8_t ta[8] = { 0 }, tb[8] = { 0 };
+			memcpy(ta, a + i, c->len - i);
+			memcpy(tb, b + i, c->len - i);
+			x = load64(ta) ^ load64(tb);
+		}
+		if (!x)
+			continue;
+		size_t g = i / GROUP_BYTES, q = i % GROUP_BYTES / 8;
+		add_word(c->planes + g * BITCOUNT_PLANES * 4 + q, x);
+	}
+}
+
+#if BINDIFF_AVX2
+/* whole groups, returns how many bytes were done */
+__attribute__((target("avx2")))
+static size_t
+add_avx2(struct bitcount *c, const uint8_t *a, const uint8_t *b)
+{
+	size_t i;
+	for (i = 0; i + GROUP_BYTES <= c->len; i += GROUP_BYTES) {
+		__m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i)),
+				_mm256_loadu_si256((const __m256i *)(b + i)));
+		__m256i *p = (__m256i *)(c->planes + i / GROUP_BYTES * BITCOUNT_PLANES * 4);
+		unsigned k;
+		for (k = 0; !_mm256_testz_si256(x, x) && k < BITCOUNT_PLANES; k++) {
+			__m256i v = _mm256_loadu_si256(p + k);
+			_mm256_storeu_si256(p + k, _mm256_xor_si256(v, x));
+			x = _mm256_and_si256(v, x);
+		}
+	}
+	return i;
+}
+#endif
+
+void bitcount_add_xor(struct bitcount *c, const uint8_t *a, const uint8_t *b)
+{
+	/* keep every count in the planes below 1 << BITCOUNT_PLANES */
+	if (c->pending == ((size_t)1 << BITCOUNT_PLANES) - 1)
+		bitcount_flush(c);
+	c->pending++;
+
+	size_t done = 0;
+#if BINDIFF_AVX2
+	if (have_avx2())
+		done = add_avx2(c, a, b);
+#endif
+	add_scalar(c, a, b, done);
+}
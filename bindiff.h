@@ -0,0 +1,55 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Kernels for comparing binary images a word (or vector) at a time.
+ *
+ * Byte masks have one bit per byte: byte i is bit (i % 64) of word (i / 64).
+ */
+
+/* words needed for the byte mask of @len bytes */
+static inline size_t bindiff_words(size_t len)
+{
+	return (len + 63) / 64;
+}
+
+/*
+ * Compare @len bytes of @a and @b: overwrite @changed (bindiff_words(@len)
+ * words) with the mask of bytes that differ, OR the differing bits (a ^ b)
+ * into @bits unless it is NULL, and return how many bits differ.
+ */
+uint64_t bindiff_pair(const uint8_t *a, const uint8_t *b, size_t len,
+		uint64_t *changed, uint8_t *bits);
+
+/*
+ * Per-bit counters over many image pairs: how many times each bit of an image
+ * differed between the pairs added.
+ *
+ * The counts are kept bit-sliced: plane k holds bit k of every bit's count, so
+ * adding a pair is a carry-save ripple through the planes a whole word (or
+ * vector) of image bits at a time, stopping as soon as there is no carry.
+ * Image diffs are mostly zero, so most words cost a load and an xor. The planes
+ * are folded into plain counters before they could overflow, and by
+ * bitcount_flush().
+ */
+#define BITCOUNT_PLANES 16
+
+struct bitcount {
+	/* bytes of image counted */
+	size_t len;
+	/* additions since the planes were last folded into count */
+	size_t pending;
+	/* BITCOUNT_PLANES 32 byte planes for each 32 bytes of image */
+	uint64_t *planes;
+	/* len * 8 counters, bit b of byte i is count[i * 8 + b] */
+	uint32_t *count;
+};
+
+/* returns 0 on success, -1 if out of memory */
+int bitcount_init(struct bitcount *c, size_t len);
+void bitcount_destroy(struct bitcount *c);
+/* count the bits that differ between @a and @b (c->len bytes each) */
+void bitcount_add_xor(struct bitcount *c, const uint8_t *a, const uint8_t *b);
+/* fold the planes into c->count, which is then up to date */
+void bitcount_flush(struct bitcount *c);
@@ -0,0 +1,584 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chan.h"
+
+const char *const chan_mod_names[] = {
+	[CHAN_MOD_UNKNOWN] = "unknown",
+	[CHAN_MOD_FM] = "FM",
+	[CHAN_MOD_NFM] = "NFM",
+	[CHAN_MOD_WFM] = "WFM",
+	[CHAN_MOD_AM] = "AM",
+	[CHAN_MOD_USB] = "USB",
+	[CHAN_MOD_LSB] = "LSB",
+	[CHAN_MOD_CW] = "CW",
+};
+const size_t chan_mod_ct = sizeof(chan_mod_names) / sizeof(chan_mod_names[0]);
+
+const char *const chan_tone_names[] = {
+	[CHAN_TONE_UNKNOWN] = "unknown",
+	[CHAN_TONE_NONE] = "none",
+	[CHAN_TONE_CTCSS] = "ctcss",
+	[CHAN_TONE_DCS] = "dcs",
+	[CHAN_TONE_DCS_INV] = "dcs-inv",
+};
+const size_t chan_tone_ct = sizeof(chan_tone_names) / sizeof(chan_tone_names[0]);
+
+const uint16_t chan_ctcss_dhz[] = {
+	670, 693, 719, 744, 770, 797, 825, 854, 885, 915,
+	948, 974, 1000, 1035, 1072, 1109, 1148, 1188, 1230, 1273,
+	1318, 1365, 1413, 1462, 1514, 1567, 1598, 1622, 1655, 1679,
+	1713, 1738, 1773, 1799, 1835, 1862, 1899, 1928, 1966, 1995,
+	2035, 2065, 2107, 2181, 2257, 2291, 2336, 2418, 2503, 2541,
+};
+const size_t chan_ctcss_ct = sizeof(chan_ctcss_dhz) / sizeof(chan_ctcss_dhz[0]);
+
+const uint16_t chan_dcs[] = {
+	23, 25, 26, 31, 32, 36, 43, 47, 51, 53,
+	54, 65, 71, 72, 73, 74, 114, 115, 116, 122,
+	125, 131, 132, 134, 143, 145, 152, 155, 156, 162,
+	165, 172, 174, 205, 212, 223, 225, 226, 243, 244,
+	245, 246, 251, 252, 255, 261, 263, 265, 266, 271,
+	274, 306, 311, 315, 325, 331, 332, 343, 346, 351,
+	356, 364, 365, 371, 411, 412, 413, 423, 431, 432,
+	445, 446, 452, 454, 455, 462, 464, 465, 466, 503,
+	506, 516, 523, 526, 532, 546, 565, 606, 612, 624,
+	627, 631, 632, 654, 662, 664, 703, 712, 723, 731,
+	732, 734, 743, 754,
+};
+const size_t chan_dcs_ct = sizeof(chan_dcs) / sizeof(chan_dcs[0]);
+
+/*
+ * All that is known of the DJ-C7's memories so far is that 0x0d60 gets its
+ * high bit set once the first one is written (see dj-proto.h). Where the
+ * other memories are and how a record is laid out haven't been mapped, so
+ * this only finds whether memory 1 is in use. Fields get filled in here as
+ * they are found (bin-id is the tool for that).
+ */
+const struct chan_layout chan_dj_c7 = {
+	.model = "dj-c7",
+	.base = 0x0d60,
+	.count = 1,
+	.first = 1,
+	.used = { .off = 0, .shift = 7, .bits = 1 },
+};
+
+void chan_table_init(struct chan_table *t)
+{
+	memset(t, 0, sizeof(*t));
+}
+
+void chan_table_destroy(struct chan_table *t)
+{
+	free(t->number);
+	free(t->rx_hz);
+	free(t->tx_hz);
+	free(t->rx_mod);
+	free(t->tx_mod);
+	free(t->rx_tone);
+	free(t->rx_code);
+	free(t->tx_tone);
+	free(t->tx_code);
+	free(t->power);
+	free(t->groups);
+	free(t->name_off);
+	free(t->name_len);
+	free(t->names);
+	memset(t, 0, sizeof(*t));
+}
+
+static int names_reserve(struct chan_table *t, size_t len);
+
+static int
+grow(void *p, size_t n, size_t size)
+{
+	void *np = realloc(*(void **)p, n * size);
+	if (!np)
+		return -1;
+	*(void **)p = np;
+	return 0;
+}
+
+int chan_table_reserve(struct chan_table *t, size_t n)
+{
+	if (n <= t->cap - t->ct)
+		return 0;
+
+	size_t cap = t->cap ? t->cap : 64;
+	while (cap - t->ct < n)
+		cap *= 2;
+
+	/* columns that did grow stay grown, cap is only raised once all have */
+	if (grow(&t->number, cap, sizeof(*t->number))
+			|| grow(&t->rx_hz, cap, sizeof(*t->rx_hz))
+			|| grow(&t->tx_hz, cap, sizeof(*t->tx_hz))
+			|| grow(&t->rx_mod, cap, sizeof(*t->rx_mod))
+			|| grow(&t->tx_mod, cap, sizeof(*t->tx_mod))
+			|| grow(&t->rx_tone, cap, sizeof(*t->rx_tone))
+			|| grow(&t->rx_code, cap, sizeof(*t->rx_code))
+			|| grow(&t->tx_tone, cap, sizeof(*t->tx_tone))
+			|| grow(&t->tx_code, cap, sizeof(*t->tx_code))
+			|| grow(&t->power, cap, sizeof(*t->power))
+			|| grow(&t->groups, cap, sizeof(*t->groups))
+			|| grow(&t->name_off, cap, sizeof(*t->name_off))
+			|| grow(&t->name_len, cap, sizeof(*t->name_len)))
+		return -1;
+
+	t->cap = cap;
+	return 0;
+}
+
+int chan_table_copy(struct chan_table *dst, const struct chan_table *src)
+{
+	dst->ct = 0;
+	dst->names_len = 0;
+	if (chan_table_reserve(dst, src->ct) || names_reserve(dst, src->names_len))
+		return -1;
+	if (!src->ct)
+		return 0;
+
+	size_t n = src->ct;
+	memcpy(dst->number, src->number, n * sizeof(*src->number));
+	memcpy(dst->rx_hz, src->rx_hz, n * sizeof(*src->rx_hz));
+	memcpy(dst->tx_hz, src->tx_hz, n * sizeof(*src->tx_hz));
+	memcpy(dst->rx_mod, src->rx_mod, n * sizeof(*src->rx_mod));
+	memcpy(dst->tx_mod, src->tx_mod, n * sizeof(*src->tx_mod));
+	memcpy(dst->rx_tone, src->rx_tone, n * sizeof(*src->rx_tone));
+	memcpy(dst->rx_code, src->rx_code, n * sizeof(*src->rx_code));
+	memcpy(dst->tx_tone, src->tx_tone, n * sizeof(*src->tx_tone));
+	memcpy(dst->tx_code, src->tx_code, n * sizeof(*src->tx_code));
+	memcpy(dst->power, src->power, n * sizeof(*src->power));
+	memcpy(dst->groups, src->groups, n * sizeof(*src->groups));
+	memcpy(dst->name_off, src->name_off, n * sizeof(*src->name_off));
+	memcpy(dst->name_len, src->name_len, n * sizeof(*src->name_len));
+	memcpy(dst->names, src->names, src->names_len);
+	dst->ct = n;
+	dst->names_len = src->names_len;
+	return 0;
+}
+
+void chan_table_keep(struct chan_table *t, const uint8_t *keep)
+{
+	size_t i, n = 0;
+	for (i = 0; i < t->ct; i++) {
+		if (!keep[i])
+			continue;
+		if (n != i) {
+			t->number[n] = t->number[i];
+			t->rx_hz[n] = t->rx_hz[i];
+			t->tx_hz[n] = t->tx_hz[i];
+			t->rx_mod[n] = t->rx_mod[i];
+			t->tx_mod[n] = t->tx_mod[i];
+			t->rx_tone[n] = t->rx_tone[i];
+			t->rx_code[n] = t->rx_code[i];
+			t->tx_tone[n] = t->tx_tone[i];
+			t->tx_code[n] = t->tx_code[i];
+			t->power[n] = t->power[i];
+			t->groups[n] = t->groups[i];
+			t->name_off[n] = t->name_off[i];
+			t->name_len[n] = t->name_len[i];
+		}
+		n++;
+	}
+	t->ct = n;
+}
+
+/* room for @len more bytes of names */
+static int
+names_reserve(struct chan_table *t, size_t len)
+{
+	if (len <= t->names_cap - t->names_len)
+		return 0;
+
+	size_t cap = t->names_cap ? t->names_cap : 1024;
+	while (cap - t->names_len < len)
+		cap *= 2;
+	if (cap > UINT32_MAX || grow(&t->names, cap, 1))
+		return -1;
+	t->names_cap = cap;
+	return 0;
+}
+
+/* every channel's name starts out as the empty string at names[0] */
+static int
+names_init(struct chan_table *t)
+{
+	if (t->names_len)
+		return 0;
+	if (names_reserve(t, 1))
+		return -1;
+	t->names[t->names_len++] = '\0';
+	return 0;
+}
+
+static void
+blank(struct chan_table *t, size_t i, uint32_t number)
+{
+	t->number[i] = number;
+	t->rx_hz[i] = 0;
+	t->tx_hz[i] = 0;
+	t->rx_mod[i] = CHAN_MOD_UNKNOWN;
+	t->tx_mod[i] = CHAN_MOD_UNKNOWN;
+	t->rx_tone[i] = CHAN_TONE_UNKNOWN;
+	t->rx_code[i] = 0;
+	t->tx_tone[i] = CHAN_TONE_UNKNOWN;
+	t->tx_code[i] = 0;
+	t->power[i] = 0;
+	t->groups[i] = 0;
+	t->name_off[i] = 0;
+	t->name_len[i] = 0;
+}
+
+size_t chan_add(struct chan_table *t, uint32_t number)
+{
+	if (names_init(t) || chan_table_reserve(t, 1))
+		return CHAN_NONE;
+
+	size_t i = t->ct++;
+	blank(t, i, number);
+	return i;
+}
+
+int chan_set_name(struct chan_table *t, size_t i, const char *name, size_t len)
+{
+	if (len > UINT16_MAX || names_reserve(t, len + 1))
+		return -1;
+
+	t->name_off[i] = t->names_len;
+	t->name_len[i] = len;
+	memcpy(t->names + t->names_len, name, len);
+	t->names_len += len;
+	t->names[t->names_len++] = '\0';
+	return 0;
+}
+
+static uint64_t
+num_get(const struct chan_num *f, const uint8_t *rec)
+{
+	const uint8_t *p = rec + f->off;
+	uint64_t v = 0;
+	size_t i;
+	for (i = 0; i < f->width; i++) {
+		uint8_t b = p[f->enc == CHAN_ENC_BCD_LE || f->enc == CHAN_ENC_LE ? f->width - 1 - i : i];
+		if (f->enc == CHAN_ENC_BCD_BE || f->enc == CHAN_ENC_BCD_LE)
+			v = v * 100 + (b >> 4) * 10 + (b & 0xf);
+		else
+			v = v << 8 | b;
+	}
+	return v * f->unit;
+}
+
+/* returns -1 if @hz doesn't fit in @f */
+static int
+num_put(const struct chan_num *f, uint8_t *rec, uint64_t hz)
+{
+	if (hz % f->unit)
+		return -1;
+
+	uint64_t v = hz / f->unit;
+	bool bcd = f->enc == CHAN_ENC_BCD_BE || f->enc == CHAN_ENC_BCD_LE;
+	uint8_t b[8];
+	size_t i;
+	for (i = f->width; i--;) {
+		if (bcd) {
+			b[i] = (v / 10 % 10) << 4 | v % 10;
+			v /= 100;
+		} else {
+			b[i] = v;
+			v >>= 8;
+		}
+	}
+	if (v)
+		return -1;
+
+	uint8_t *p = rec + f->off;
+	for (i = 0; i < f->width; i++)
+		p[f->enc == CHAN_ENC_BCD_LE || f->enc == CHAN_ENC_LE ? f->width - 1 - i : i] = b[i];
+	return 0;
+}
+
+static unsigned
+bits_raw(const struct chan_bits *f, const uint8_t *rec)
+{
+	return rec[f->off] >> f->shift & ((1u << f->bits) - 1);
+}
+
+/* the value, 0 (unknown) if the raw value has none */
+static uint8_t
+bits_get(const struct chan_bits *f, const uint8_t *rec)
+{
+	unsigned raw = bits_raw(f, rec);
+	if (!f->map)
+		return raw;
+	return f->map[raw] == CHAN_NO_VALUE ? 0 : f->map[raw];
+}
+
+/* returns -1 if @v can't be stored in @f */
+static int
+bits_put(const struct chan_bits *f, uint8_t *rec, uint8_t v)
+{
+	unsigned raw, n = 1u << f->bits;
+	if (f->map) {
+		for (raw = 0; raw < n; raw++)
+			if (f->map[raw] == v)
+				break;
+	} else
+		raw = v;
+	if (raw >= n)
+		return -1;
+
+	uint8_t mask = (n - 1) << f->shift;
+	rec[f->off] = (rec[f->off] & ~mask) | raw << f->shift;
+	return 0;
+}
+
+static size_t
+num_end(const struct chan_num *f)
+{
+	return f->width ? f->off + f->width : 0;
+}
+
+static size_t
+bits_end(const struct chan_bits *f)
+{
+	return f->bits ? f->off + 1u : 0;
+}
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+static void
+freq_caps(struct chan_freq_caps *c, const struct chan_num *f)
+{
+	*c = (struct chan_freq_caps){ .step = 1, .max = UINT64_MAX };
+	if (!f->width)
+		return;
+
+	uint64_t top = 0;
+	size_t i;
+	for (i = 0; i < f->width; i++) {
+		if (f->enc == CHAN_ENC_BCD_BE || f->enc == CHAN_ENC_BCD_LE)
+			top = top * 100 + 99;
+		else
+			top = top << 8 | 0xff;
+	}
+	c->step = f->unit;
+	c->max = top > UINT64_MAX / f->unit ? UINT64_MAX / f->unit * f->unit : top * f->unit;
+}
+
+/* the values a small field can hold, as a bitmask */
+static uint32_t
+bits_caps(const struct chan_bits *f)
+{
+	if (!f->bits)
+		return UINT32_MAX;
+
+	uint32_t caps = 0;
+	unsigned raw, n = 1u << f->bits;
+	for (raw = 0; raw < n; raw++) {
+		unsigned v = f->map ? f->map[raw] : raw;
+		if (v < 32)
+			caps |= 1u << v;
+	}
+	return caps;
+}
+
+void chan_caps_from_layout(struct chan_caps *c, const struct chan_layout *l)
+{
+	*c = (struct chan_caps){
+		.model = l->model,
+		.first = l->first,
+		.count = l->count,
+		.mods = bits_caps(&l->rx_mod) & bits_caps(&l->tx_mod),
+		.rx_tones = bits_caps(&l->rx_tone),
+		.tx_tones = bits_caps(&l->tx_tone),
+		.name_len = l->name.len ? l->name.len : SIZE_MAX,
+	};
+	freq_caps(&c->rx, &l->rx);
+	freq_caps(&c->tx, &l->tx);
+
+	/* levels 1 .. n, as long as they run unbroken */
+	if (!l->power.bits) {
+		c->power_levels = UINT8_MAX;
+		return;
+	}
+	uint32_t power = bits_caps(&l->power);
+	while (c->power_levels < 31 && power >> (c->power_levels + 1) & 1)
+		c->power_levels++;
+}
+
+/* bytes of a record that @l's fields use */
+static size_t
+record_len(const struct chan_layout *l)
+{
+	size_t n = MAX(num_end(&l->rx), num_end(&l->tx));
+	n = MAX(n, bits_end(&l->used));
+	n = MAX(n, bits_end(&l->rx_mod));
+	n = MAX(n, bits_end(&l->tx_mod));
+	n = MAX(n, bits_end(&l->rx_tone));
+	n = MAX(n, bits_end(&l->rx_code));
+	n = MAX(n, bits_end(&l->tx_tone));
+	n = MAX(n, bits_end(&l->tx_code));
+	n = MAX(n, bits_end(&l->power));
+	return MAX(n, l->name.len ? l->name.off + (size_t)l->name.len : 0);
+}
+
+static int
+check_len(const struct chan_layout *l, size_t len)
+{
+	size_t need = l->count ? l->base + (l->count - 1) * l->stride + record_len(l) : 0;
+	if (need > len) {
+		fprintf(stderr, "E: a %s image needs %zu bytes for its memories, have %zu\n",
+				l->model, need, len);
+		return -1;
+	}
+	return 0;
+}
+
+int chan_decode(struct chan_table *t, const struct chan_layout *l,
+		const uint8_t *image, size_t len)
+{
+	if (check_len(l, len))
+		return -1;
+
+	if (names_init(t) || chan_table_reserve(t, l->count)) {
+		fprintf(stderr, "E: out of memory\n");
+		return -1;
+	}
+
+	size_t n;
+	int added = 0;
+	for (n = 0; n < l->count; n++) {
+		const uint8_t *rec = image + l->base + n * l->stride;
+		if (l->used.bits && !bits_raw(&l->used, rec))
+			continue;
+
+		size_t i = chan_add(t, l->first + n);
+		if (i == CHAN_NONE) {
+			fprintf(stderr, "E: out of memory\n");
+			return -1;
+		}
+
+		if (l->rx.width)
+			t->rx_hz[i] = num_get(&l->rx, rec);
+		if (l->tx.width)
+			t->tx_hz[i] = num_get(&l->tx, rec);
+		if (l->rx_mod.bits)
+			t->rx_mod[i] = bits_get(&l->rx_mod, rec);
+		if (l->tx_mod.bits)
+			t->tx_mod[i] = bits_get(&l->tx_mod, rec);
+		if (l->rx_tone.bits)
+			t->rx_tone[i] = bits_get(&l->rx_tone, rec);
+		if (l->rx_code.bits)
+			t->rx_code[i] = bits_get(&l->rx_code, rec);
+		if (l->tx_tone.bits)
+			t->tx_tone[i] = bits_get(&l->tx_tone, rec);
+		if (l->tx_code.bits)
+			t->tx_code[i] = bits_get(&l->tx_code, rec);
+		if (l->power.bits)
+			t->power[i] = bits_get(&l->power, rec);
+
+		if (l->name.len) {
+			const char *s = (const char *)rec + l->name.off;
+			size_t name_len = l->name.len;
+			while (name_len && (s[name_len - 1] == l->name.pad || !s[name_len - 1]))
+				name_len--;
+			if (chan_set_name(t, i, s, name_len)) {
+				fprintf(stderr, "E: out of memory\n");
+				return -1;
+			}
+		}
+		added++;
+	}
+	return added;
+}
+
+/*
+ * A small field, if @known and mapped. Returns -1 (after warning) if it can't
+ * be stored.
+ */
+static int
+put_bits(const struct chan_layout *l, const struct chan_bits *f, const char *what,
+		uint8_t *rec, uint32_t number, uint8_t v, bool known)
+{
+	if (!known || !f->bits || !bits_put(f, rec, v))
+		return 0;
+	fprintf(stderr, "W: %s memory %" PRIu32 ": can't store %s %u\n", l->model, number, what, v);
+	return -1;
+}
+
+static int
+put_num(const struct chan_layout *l, const struct chan_num *f, const char *what,
+		uint8_t *rec, uint32_t number, uint64_t hz)
+{
+	if (!hz || !f->width || !num_put(f, rec, hz))
+		return 0;
+	fprintf(stderr, "W: %s memory %" PRIu32 ": can't store %s %" PRIu64 " Hz\n",
+			l->model, number, what, hz);
+	return -1;
+}
+
+int chan_encode(const struct chan_table *t, const struct chan_layout *l,
+		uint8_t *image, size_t len)
+{
+	if (check_len(l, len))
+		return -1;
+
+	uint8_t *in_use = calloc(l->count / 8 + 1, 1);
+	if (!in_use) {
+		fprintf(stderr, "E: out of memory\n");
+		return -1;
+	}
+
+	size_t i;
+	int lossy = 0;
+	for (i = 0; i < t->ct; i++) {
+		uint32_t number = t->number[i];
+		size_t n = number - (size_t)l->first;
+		if (number < l->first || n >= l->count) {
+			fprintf(stderr, "W: %s has no memory %" PRIu32 "\n", l->model, number);
+			lossy++;
+			continue;
+		}
+
+		uint8_t *rec = image + l->base + n * l->stride;
+		in_use[n / 8] |= 1 << (n % 8);
+		int e = 0;
+		if (l->used.bits)
+			bits_put(&l->used, rec, 1);
+
+		e |= put_num(l, &l->rx, "rx frequency", rec, number, t->rx_hz[i]);
+		e |= put_num(l, &l->tx, "tx frequency", rec, number, t->tx_hz[i]);
+		e |= put_bits(l, &l->rx_mod, "rx modulation", rec, number, t->rx_mod[i], t->rx_mod[i]);
+		e |= put_bits(l, &l->tx_mod, "tx modulation", rec, number, t->tx_mod[i], t->tx_mod[i]);
+		e |= put_bits(l, &l->rx_tone, "unsquelch kind", rec, number, t->rx_tone[i], t->rx_tone[i]);
+		e |= put_bits(l, &l->rx_code, "unsquelch code", rec, number, t->rx_code[i],
+				t->rx_tone[i] >= CHAN_TONE_CTCSS);
+		e |= put_bits(l, &l->tx_tone, "tx tone kind", rec, number, t->tx_tone[i], t->tx_tone[i]);
+		e |= put_bits(l, &l->tx_code, "tx tone code", rec, number, t->tx_code[i],
+				t->tx_tone[i] >= CHAN_TONE_CTCSS);
+		e |= put_bits(l, &l->power, "power level", rec, number, t->power[i], t->power[i]);
+
+		if (l->name.len && t->name_len[i]) {
+			if (t->name_len[i] > l->name.len) {
+				fprintf(stderr, "W: %s memory %" PRIu32 ": name '%s' is longer than %u\n",
+						l->model, number, chan_name(t, i), l->name.len);
+				e = -1;
+			} else {
+				memset(rec + l->name.off, l->name.pad, l->name.len);
+				memcpy(rec + l->name.off, chan_name(t, i), t->name_len[i]);
+			}
+		}
+
+		lossy += !!e;
+	}
+
+	size_t n;
+	for (n = 0; l->used.bits && n < l->count; n++)
+		if (!(in_use[n / 8] & (1 << (n % 8))))
+			bits_put(&l->used, image + l->base + n * l->stride, 0);
+
+	free(in_use);
+	return lossy;
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+/*
+ * Generalized channels (the "memory entries" of DESIGN), stored as columns:
+ * one array per field, indexed by the channel's position in the table, rather
+ * than an object per channel. Conversions and queries walk only the columns
+ * they need, and a table of tens of thousands of channels is a dozen
+ * allocations.
+ *
+ * Frequencies are integer Hz. Modulation, tones and power are small enums
+ * (0 always meaning "unknown", so a field a radio doesn't have or that hasn't
+ * been decoded stays distinguishable from any real setting). Names live in
+ * one arena.
+ *
+ * Radio images are converted in bulk through a chan_layout, which says where
+ * each field lives in a channel's record and how it is encoded. Fields a
+ * layout doesn't map are left unknown by chan_decode() and their bytes are
+ * left alone by chan_encode(), so decoding and re-encoding an image never
+ * loses what isn't understood yet.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHAN_NONE SIZE_MAX
+
+enum chan_mod {
+	CHAN_MOD_UNKNOWN,
+	CHAN_MOD_FM,
+	CHAN_MOD_NFM,
+	CHAN_MOD_WFM,
+	CHAN_MOD_AM,
+	CHAN_MOD_USB,
+	CHAN_MOD_LSB,
+	CHAN_MOD_CW,
+};
+
+/* for reading and printing, indexed by the enums */
+extern const char *const chan_mod_names[];
+extern const size_t chan_mod_ct;
+extern const char *const chan_tone_names[];
+extern const size_t chan_tone_ct;
+
+/* the kind of an unsquelch condition or tx tone, the code says which one */
+enum chan_tone {
+	CHAN_TONE_UNKNOWN,
+	CHAN_TONE_NONE,
+	/* code is an index into chan_ctcss_dhz[] */
+	CHAN_TONE_CTCSS,
+	/* code is an index into chan_dcs[], the _INV variant is inverted */
+	CHAN_TONE_DCS,
+	CHAN_TONE_DCS_INV,
+};
+
+/* the standard CTCSS tones, in tenths of a Hz */
+extern const uint16_t chan_ctcss_dhz[];
+extern const size_t chan_ctcss_ct;
+/* the standard DCS codes, the octal digits written as a decimal number */
+extern const uint16_t chan_dcs[];
+extern const size_t chan_dcs_ct;
+
+struct chan_table {
+	size_t ct, cap;
+
+	/* the radio's memory number */
+	uint32_t *number;
+	uint64_t *rx_hz;
+	uint64_t *tx_hz;
+	uint8_t *rx_mod;
+	uint8_t *tx_mod;
+	/* unsquelch condition */
+	uint8_t *rx_tone;
+	uint8_t *rx_code;
+	uint8_t *tx_tone;
+	uint8_t *tx_code;
+	/* 1 is the lowest the radio has, 0 unknown */
+	uint8_t *power;
+	/* bit n set: in group n */
+	uint64_t *groups;
+
+	/* names[name_off[i]] is channel i's name, name_len[i] bytes and a 0 */
+	uint32_t *name_off;
+	uint16_t *name_len;
+	char *names;
+	size_t names_len, names_cap;
+};
+
+void chan_table_init(struct chan_table *t);
+void chan_table_destroy(struct chan_table *t);
+/* make room for @n more channels, returns -1 if out of memory */
+int chan_table_reserve(struct chan_table *t, size_t n);
+/* replace @dst's channels with a copy of @src's, returns -1 if out of memory */
+int chan_table_copy(struct chan_table *dst, const struct chan_table *src);
+/* keep only the channels with @keep[i] set, in order */
+void chan_table_keep(struct chan_table *t, const uint8_t *keep);
+
+/* add a channel with every field unknown, returns its index (CHAN_NONE if out of memory) */
+size_t chan_add(struct chan_table *t, uint32_t number);
+/*
+ * Returns -1 if out of memory. The old name stays in the arena, which only
+ * matters if names are changed over and over.
+ */
+int chan_set_name(struct chan_table *t, size_t i, const char *name, size_t len);
+
+static inline const char *chan_name(const struct chan_table *t, size_t i)
+{
+	return t->names + t->name_off[i];
+}
+
+/* a frequency, @width bytes (0 for not mapped) counting in @unit Hz */
+enum chan_enc {
+	CHAN_ENC_BCD_BE,
+	CHAN_ENC_BCD_LE,
+	CHAN_ENC_BE,
+	CHAN_ENC_LE,
+};
+
+struct chan_num {
+	uint16_t off;
+	uint8_t width;
+	uint8_t enc;
+	uint32_t unit;
+};
+
+/*
+ * A small field: @bits bits (0 for not mapped) starting at bit @shift of the
+ * byte at @off. If @map is given, it holds the value for each raw value, and
+ * CHAN_NO_VALUE for raw values that mean nothing known.
+ */
+#define CHAN_NO_VALUE 0xff
+
+struct chan_bits {
+	uint16_t off;
+	uint8_t shift;
+	uint8_t bits;
+	const uint8_t *map;
+};
+
+/* a name of up to @len bytes (0 for not mapped), padded with @pad */
+struct chan_text {
+	uint16_t off;
+	uint8_t len;
+	char pad;
+};
+
+struct chan_layout {
+	const char *model;
+	/* memory n (counting from @first) has its record at base + n * stride */
+	size_t base, stride, count;
+	uint32_t first;
+
+	/* set for memories that are in use, if not mapped all of them are */
+	struct chan_bits used;
+	struct chan_num rx, tx;
+	struct chan_bits rx_mod, tx_mod;
+	struct chan_bits rx_tone, rx_code, tx_tone, tx_code;
+	struct chan_bits power;
+	struct chan_text name;
+};
+
+/* what is known of the DJ-C7's memories, see chan.c */
+extern const struct chan_layout chan_dj_c7;
+
+/* what a radio's memories can hold, as far as its layout says */
+struct chan_freq_caps {
+	/* multiples of step, from min to max */
+	uint64_t step, min, max;
+};
+
+struct chan_caps {
+	const char *model;
+	uint32_t first, count;
+	struct chan_freq_caps rx, tx;
+	/* bit n set: enum value n can be stored */
+	uint32_t mods;
+	uint32_t rx_tones, tx_tones;
+	/* UINT8_MAX if the layout doesn't map power */
+	uint8_t power_levels;
+	size_t name_len;
+};
+
+/* fields @l doesn't map can't be checked, so they hold anything */
+void chan_caps_from_layout(struct chan_caps *c, const struct chan_layout *l);
+
+/* 0 (unknown) always fits */
+static inline bool chan_freq_fits(const struct chan_freq_caps *c, uint64_t hz)
+{
+	return !hz || (hz % c->step == 0 && hz >= c->min && hz <= c->max);
+}
+
+static inline bool chan_enum_fits(uint32_t caps, uint8_t v)
+{
+	return !v || (v < 32 && (caps >> v & 1));
+}
+
+/*
+ * Append the memories in use in @image (@len bytes) to @t. Returns how many
+ * were added, or -1 (after printing why) if @image is too small for @l or
+ * memory ran out.
+ */
+int chan_decode(struct chan_table *t, const struct chan_layout *l,
+		const uint8_t *image, size_t len);
+
+/*
+ * Store @t's channels into @image (@len bytes): every mapped field of their
+ * memories, and memories with no channel in @t are marked unused. Fields that
+ * are unknown (0, or a code whose tone kind is) are left as they were. Values
+ * that @l can't hold exactly (a frequency off its step, a tone the radio
+ * lacks, a name too long, a memory number past the end) are warned about and
+ * not stored.
+ *
+ * Returns the number of channels that were not stored exactly, or -1 (after
+ * printing why) if @image is too small for @l or memory ran out.
+ */
+int chan_encode(const struct chan_table *t, const struct chan_layout *l,
+		uint8_t *image, size_t len);
@@ -1,15 +1,29 @@
 #include <assert.h>
+#include <errno.h>
 #include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <libserialport.h>
 
+#include "dj-live.h"
+#include "dj-proto.h"
+#include "dj-xfer.h"
+#include "fingerprint.h"
+#include "image-file.h"
 #include "print.h"
 #include "memory.h"
+#include "util.h"
+#include "wire-cap.h"
+
+/* captures are written out in chunks of this size */
+#define CAP_BUF_SIZE (1 << 20)
 
 /*
  * Decode stages:
@@ -22,472 +36,987 @@
  */
 
 /*
- * When "sending", radio sends 42 bytes at a time, each ending with a '\r'
- * It expects a '\r\nOK\r\n' in reply acknowledging each piece of data. After a
- * short timeout, it will display "Failed" if no ack is recieved.
- *
- * 0000000000111111111122222222223333333333444
- * 0123456789012345678901234567890123456789012
- * AL~F0XX0W012345678901234567890123456789012\r
- *          |    data bytes in hex          |
- *      ||-> address
- *
- * "AL~F" : 4 bytes: marker, meaning unknown
- * "0AB0" : 4 bytes: address (2 bytes, lowest and highest always zero)
- * "W"    : 1 bytes: action, only 'W' seen
- *        : 32 bytes: data, hex encoded, 16 actual bytes
- * "\r"   : 1 bytes: packet end
- *
- * 0D5D is 27 on unlocked-tx
- * 0D5D is 23 on locked-tx
- *
- * 0D5C is 6c on mprotect on
- * 0D5C is 2c on mprotect off
- *
- * 0D52 is 0A when volume is 10
- * 0D52 is 09 when volume is 9
- *
- * 0D54 is 03 when squelch is 3
- * 0D54 is 04 when squelch is 4
- *
- * 0D5D is 23 when hi-volume
- * 0D5D is 33 when lo-volume
- *
- * 0D5C is 6c when SMA
- * 0D5C is 7c when Ear
- *
- * 0D5D is 33 when rpt normal
- * 0D5D is B3 when rpt star
- *
- * 0D5B is 00 when tone is 1750
- * 0D5B is 01 when tone is 2100
- * 0D5B is 02 when tone is 1000
- * 0D5B is 03 when tone is 1450
- *
- * 0D58 is 00 when APO is off
- * 0D58 is 01 when APO is 30min
- * 0D58 is 02 when APO is 60min
- * 0D58 is 03 when APO is 90min
- *
- * 0D5C is 5C when bs is off
- * 0D5C is 7C when bs is on
- *
- * 0D5C is 5C when beep is on
- * 0D5C is 54 when beep is off
- *
- * 0D5C is 54 when bell is off
- * 0D5C is 55 when bell is on
- *
- * 0D5D is B3 when "busy"
- * 0D5D is F3 when "timer"
- *
- * 0D5D is 23 when step "auto"
- * 0D5D is 03 when step "5"
- *
- * - freq was 145.000
- * 0DC6 is 01 when step 5
- * 0DC6 is 02 when step 6.25
- * 0DC6 is 03 when step 8.33
- * 0DC6 is 04 when step 10
- *
- * When the first memory location is written, 0D60 has it's high bit set (00 vs 80)
- *
+ * Open @name, and unless !@do_config set it up for the radio (9600 8N1, no
+ * flow control). Returns NULL (after printing why) on failure.
  */
-
-#define PKT_BYTES 42
-#define MAGIC_LEN 4
-#define DATA_LEN 16
-
-struct dj_parms {
-	const char *ack;
-	const char magic[MAGIC_LEN];
-	size_t mem_size;
-};
-
-static const struct dj_parms dj_c7 = {
-	.ack = "\r\nOK\r\n",
-	.magic = "AL~F",
-	.mem_size = 0xfff + 1,
-};
-
-struct dj_c7_pkt {
-	uint8_t magic[MAGIC_LEN];
-	uint_fast16_t offset;
-	char action;
-	uint8_t data[DATA_LEN];
-};
-
-static ssize_t
-read_pkt(struct sp_port *port, char buf[static PKT_BYTES], size_t len)
+static struct sp_port *
+port_open(const char *name, bool do_config)
 {
-	(void)len;
-	size_t pos = 0;
+	struct sp_port *port;
+	enum sp_return sr = sp_get_port_by_name(name, &port);
+	if (sr != SP_OK) {
+		fprintf(stderr, "E: failed to get serial port '%s': %d\n", name, sr);
+		return NULL;
+	}
 
-	for (;;) {
-		enum sp_return sr = sp_blocking_read(port, buf + pos, PKT_BYTES - pos, 100);
-		if (sr < 0) {
-			fprintf(stderr, "E: failed to read packet: %d\n", sr);
-			exit(EXIT_FAILURE);
-		}
-		if (sr == 0) {
-			/* nada, print remainder and exit */
-			if (pos) {
-				printf("timed out with data: ");
-				print_bytes_as_cstring(buf, pos, stdout);
-				printf(", flushing\n");
-				pos = 0;
-			} else
-				putc('.', stderr);
-			continue;
-		}
+	sr = sp_open(port, SP_MODE_WRITE | SP_MODE_READ);
+	if (sr != SP_OK) {
+		fprintf(stderr, "E: failed to open port '%s': %d\n", name, sr);
+		goto err_free;
+	}
 
-		/* look for a '\r' */
-		char *end = memchr(buf + pos, '\r', sr);
-		pos += sr;
-		if (end) {
-			return pos;
-		}
+	if (!do_config)
+		return port;
+
+	struct sp_port_config *config;
+	sr = sp_new_config(&config);
+	if (sr != SP_OK) {
+		fprintf(stderr, "E: failed to create port config: %d\n", sr);
+		goto err_close;
 	}
-}
 
-static enum sp_return sp_blocking_write_echocancel(struct sp_port *port, const void *buf, size_t count, unsigned timeout, unsigned echo_timeout)
-{
-	enum sp_return sr1 = sp_blocking_write(port, buf, count, timeout);
-	if (sr1 < 0) {
-		fprintf(stderr, "E: failed to write packet: %d\n", sr1);
-		return sr1;
+	sr = sp_set_config_baudrate(config, 9600);
+	if (sr != SP_OK) {
+		fprintf(stderr, "E: failed to set config baud rate: %d\n", sr);
+		goto err_config;
 	}
 
-	if ((size_t)sr1 != count) {
-		fprintf(stderr, "E: failed to send entire packet, sent %d out of %zu bytes\n", sr1, count);
-		return sr1;
+	sr = sp_set_config_bits(config, 8);
+	if (sr != SP_OK) {
+		fprintf(stderr, "E: failed to set config bits: %d\n", sr);
+		goto err_config;
 	}
 
-	/* We're half-duplex, so do echo cancelation */
-	char echo_buf[sr1];
-	enum sp_return sr2 = sp_blocking_read(port, echo_buf, sizeof(echo_buf), echo_timeout);
-	if (sr2 < 0) {
-		fprintf(stderr, "E: failed to read echo-cancel data\n");
-		return sr2;
+	sr = sp_set_config_parity(config, SP_PARITY_NONE);
+	if (sr != SP_OK) {
+		fprintf(stderr, "E: failed to set config parity: %d\n", sr);
+		goto err_config;
 	}
 
-#if 0
-	printf("canceling: ");
-	print_bytes_as_cstring(echo_buf, sr2, stdout);
-	putchar('\n');
-#endif
+	sr = sp_set_config_stopbits(config, 1);
+	if (sr != SP_OK) {
+		fprintf(stderr, "E: failed to set config stopbits: %d\n", sr);
+		goto err_config;
+	}
 
-	if (sr2 != sr1) {
-		fprintf(stderr, "E: did not read enough echo-cancel data, got %d out of %d bytes\n", sr2, sr1);
-		return SP_ERR_FAIL;
+	sr = sp_set_config_flowcontrol(config, SP_FLOWCONTROL_NONE);
+	if (sr != SP_OK) {
+		fprintf(stderr, "E: failed to set config flow control: %d\n", sr);
+		goto err_config;
 	}
 
-	if (memcmp(buf, echo_buf, sr1)) {
-		fprintf(stderr, "E: echo-cancel data is not equal to sent data\n");
-		return SP_ERR_FAIL;
+	sr = sp_set_config(port, config);
+	if (sr != SP_OK) {
+		fprintf(stderr, "E: failed to apply configuration to port '%s': %d\n", name, sr);
+		goto err_config;
 	}
 
-	return sr1;
+	sp_free_config(config);
+	return port;
+
+err_config:
+	sp_free_config(config);
+err_close:
+	sp_close(port);
+err_free:
+	sp_free_port(port);
+	return NULL;
 }
 
-static void pkt_encode(const struct dj_parms *p, uint_fast16_t offset, const unsigned char *buf, char *pkt)
+static void
+port_close(struct sp_port *port)
 {
-	memcpy(pkt, p->magic, sizeof(p->magic));
-	pkt += sizeof(p->magic);
+	sp_close(port);
+	sp_free_port(port);
+}
 
-	assert(offset <= 0xffff);
-	sprintf((char *)pkt, "%04" PRIXFAST16, offset);
+/* set by -w, everything read from and written to the ports goes into it */
+static struct wire_cap *cap;
 
-	pkt += 4;
+static void
+cap_finish(void)
+{
+	wire_cap_close(cap);
+}
 
-	*pkt = 'W';
-	
-	pkt ++;
+/*
+ * Set by SIGINT and SIGTERM. Transfers stop at the next wakeup and dj-c7
+ * exits through its usual paths, so a hung transfer interrupted by hand still
+ * leaves its capture, trace and partial image behind. A second signal kills
+ * it outright.
+ *
+ * Both are blocked except while waiting (in ppoll() with wait_mask, or for
+ * the user), so one that arrives just after interrupted was checked still
+ * ends the wait rather than being missed.
+ */
+static volatile sig_atomic_t interrupted;
+static sigset_t wait_mask;
 
-	size_t i;
-	for (i = 0; i < DATA_LEN; i++) {
-		sprintf((char *)pkt, "%02X", buf[i]);
-		pkt += 2;
-	}
+static void
+on_signal(int sig)
+{
+	interrupted = sig;
+}
 
-	*pkt = '\r';
+static void
+catch_signals(void)
+{
+	struct sigaction sa = {
+		.sa_handler = on_signal,
+		/* no SA_RESTART, so ppoll() returns */
+		.sa_flags = SA_RESETHAND,
+	};
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	sigset_t block;
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGTERM);
+	sigprocmask(SIG_BLOCK, &block, &wait_mask);
 }
 
-static int_fast16_t
-decode_hex_nibble(char c)
+/* with -F, images to send must be identified as being for this radio */
+static struct fp_index *fp;
+static bool fp_force;
+
+/* with -a, only the blocks covering these ranges are transferred */
+static struct dj_range *live;
+static size_t live_ct;
+
+/*
+ * Do whatever I/O @x can without blocking, capturing it as channel @chan.
+ *
+ * Returns 1 if it should be called again straight away, 0 if it is waiting on
+ * the port or its deadline, -1 if the port failed.
+ */
+static int
+xfer_step(struct dj_xfer *x, struct sp_port *port, unsigned chan, uint64_t now)
 {
-	if ('A' <= c && c <= 'F') {
-		return c - 'A' + 10;
-	} else if ('0' <= c && c <= '9') {
-		return c - '0';
-	} else
+	const char *out;
+	size_t out_len = dj_xfer_pending(x, &out);
+	if (out_len) {
+		enum sp_return sr = sp_nonblocking_write(port, out, out_len);
+		if (sr < 0) {
+			fprintf(stderr, "E: failed to write packet: %d\n", sr);
+			return -1;
+		}
+		if (sr) {
+			if (cap)
+				wire_cap_record(cap, chan, WIRE_TX, out, sr, now);
+			dj_xfer_wrote(x, sr, now);
+		}
+	}
+
+	char buf[DJ_PKT_MAX];
+	enum sp_return sr = sp_nonblocking_read(port, buf, sizeof(buf));
+	if (sr < 0) {
+		fprintf(stderr, "E: failed to read packet: %d\n", sr);
 		return -1;
+	}
+	if (sr) {
+		if (cap)
+			wire_cap_record(cap, chan, WIRE_RX, buf, sr, now);
+		dj_xfer_input(x, buf, sr, now);
+		return 1;
+	}
+
+	if (now >= x->deadline) {
+		dj_xfer_timeout(x, now);
+		return 1;
+	}
+
+	return 0;
 }
 
-static int_fast16_t
-decode_hex(char buf[static 2])
+static struct pollfd
+xfer_pollfd(const struct dj_xfer *x, int fd)
 {
-	int_fast16_t r1 = decode_hex_nibble(buf[0]);
-	if (r1 < 0)
-		return r1;
-	
-	int_fast16_t r2 = decode_hex_nibble(buf[1]);
-	if (r2 < 0)
-		return r2;
-
-	return r1 << 4 | r2;
+	const char *out;
+	return (struct pollfd){
+		.fd = fd,
+		.events = POLLIN | (dj_xfer_pending(x, &out) ? POLLOUT : 0),
+	};
 }
 
+/* wait in ppoll() until one of @pfd is ready or @deadline passes */
 static int
-decode_hex_buf(size_t len, char in[static len * 2], uint8_t out[static len])
+poll_until(struct pollfd *pfd, size_t ct, uint64_t deadline, uint64_t now)
 {
-	size_t i;
-	for (i = 0; i < len; i ++) {
-		int_fast16_t r = decode_hex(in + i * 2);
-		if (r < 0) {
-			fprintf(stderr, "E: decode hex failed at offset %zu out of %zu\n", i * 2, len);
-			return r;
-		}
+	struct timespec ts, *tsp = NULL;
+	if (deadline != UINT64_MAX) {
+		uint64_t d = deadline > now ? deadline - now : 0;
+		ts = (struct timespec){ .tv_sec = d / 1000000000, .tv_nsec = d % 1000000000 };
+		tsp = &ts;
+	}
 
-		out[i] = r;
+	if (ppoll(pfd, ct, tsp, &wait_mask) < 0 && errno != EINTR) {
+		fprintf(stderr, "E: failed to wait for port: %s\n", strerror(errno));
+		return -1;
 	}
-	
+
 	return 0;
 }
 
-static int_least32_t
-decode_hex_16(char buf[static 4])
+/* set by -T, every transfer (single or batch) records into it */
+static struct dj_trace *trace;
+static const char *trace_file;
+
+/*
+ * Dump the records so far to trace_file: Chrome's trace format if it ends in
+ * ".json", JSON lines otherwise. Done after each transfer, so an interrupted
+ * or failed one, which is the interesting kind, is included.
+ */
+static void
+trace_save(void)
 {
-	int_fast16_t r = decode_hex(buf);
-	if (r < 0)
-		return r;
+	if (!trace)
+		return;
 
-	int_fast16_t r2 = decode_hex(buf + 2);
-	if (r2 < 0)
-		return r2;
+	FILE *out = fopen(trace_file, "w");
+	if (!out) {
+		fprintf(stderr, "E: could not open trace file '%s'\n", trace_file);
+		return;
+	}
 
-	return r << 8 | r2;
+	size_t len = strlen(trace_file);
+	if (len >= 5 && !strcmp(trace_file + len - 5, ".json"))
+		dj_trace_write_chrome(trace, out);
+	else
+		dj_trace_write_jsonl(trace, out);
+
+	if (fclose(out))
+		fprintf(stderr, "E: error writing trace file '%s'\n", trace_file);
 }
 
+/* print the timing summary, at exit */
+static void
+trace_finish(void)
+{
+	dj_trace_report(trace, stderr);
+	trace_save();
+	dj_trace_destroy(trace);
+}
+
+/*
+ * Drive @x over @port until it finishes, doing non-blocking I/O and sleeping
+ * in poll() until the port is ready or the current phase's deadline passes.
+ *
+ * Returns 0 if the transfer completed, -1 if it failed.
+ */
 static int
-pkt_decode(struct dj_c7_pkt *pkt, char buf[static PKT_BYTES])
+xfer_run(struct dj_xfer *x, struct sp_port *port)
 {
-	memcpy(pkt->magic, buf, sizeof(pkt->magic));
-	buf += sizeof(pkt->magic);
-	int_least32_t off = decode_hex_16(buf);
-	if (off >= 0)
-		pkt->offset = off;
-	else
-		pkt->offset = 0;
-	buf += 4;
-	pkt->action = *buf;
-	buf ++;
-	int r = decode_hex_buf(sizeof(pkt->data), buf, pkt->data);
-
-	if (off < 0) {
-		fprintf(stderr, "E: offset decode failed: %"PRIdLEAST32"\n", off);
+	x->trace = trace;
+
+	int fd;
+	enum sp_return sr = sp_get_port_handle(port, &fd);
+	if (sr != SP_OK) {
+		fprintf(stderr, "E: failed to get port handle: %d\n", sr);
 		return -1;
 	}
 
-	if (r < 0) {
-		fprintf(stderr, "E: data decode failed: %d\n", r);
-		memset(pkt->data, 0, sizeof(pkt->data));
-		return -2;
-	}
+	int ret = -1;
+	while (!dj_xfer_finished(x)) {
+		if (interrupted) {
+			fprintf(stderr, "E: interrupted\n");
+			goto out;
+		}
 
-	return 0;
-}
+		uint64_t now = now_ns();
 
+		int r = xfer_step(x, port, 0, now);
+		if (r < 0)
+			goto out;
+		if (r)
+			continue;
+
+		struct pollfd pfd = xfer_pollfd(x, fd);
+		if (poll_until(&pfd, 1, x->deadline, now) < 0)
+			goto out;
+	}
+	ret = x->phase == DJ_PHASE_DONE ? 0 : -1;
+
+out:
+	/* each finished transfer is on disk, whatever happens next */
+	if (cap)
+		wire_cap_flush(cap);
+	trace_save();
+	return ret;
+}
 
-static bool
-pkt_is_ok(const struct dj_parms *p, struct dj_c7_pkt *pkt)
+/*
+ * Read an image to upload, at most p->mem_size bytes. Returns the number of
+ * bytes read, trailing partial blocks are not counted.
+ */
+static size_t
+read_image(const struct dj_parms *p, const char *file, uint8_t **image)
 {
-	int e = 0;
-	if (memcmp(pkt->magic, p->magic, sizeof(pkt->magic))) {
-		fprintf(stderr, "W: magic mis-match, have ");
-		print_bytes_as_cstring(pkt->magic, sizeof(pkt->magic), stderr);
-		fprintf(stderr, "\n");
-		e++;
+	FILE *in = fopen(file, "r");
+	if (!in) {
+		fprintf(stderr, "E: could not open file '%s'\n", file);
+		exit(EXIT_FAILURE);
 	}
 
-	if (pkt->action != 'W') {
-		fprintf(stderr, "W: unknown action '%c' (%d)\n", pkt->action, pkt->action);
-		e++;
+	*image = malloc(p->mem_size + 1);
+	assert(*image);
+
+	size_t len = fread(*image, 1, p->mem_size + 1, in);
+	if (ferror(in)) {
+		fprintf(stderr, "E: error reading file '%s'\n", file);
+		exit(EXIT_FAILURE);
 	}
+	fclose(in);
 
-	if (pkt->offset & 0xf) {
-		fprintf(stderr, "E: low nibble in offset set: %#04"PRIxFAST16"\n", pkt->offset);
-		e++;
+	if (len > p->mem_size) {
+		fprintf(stderr, "E: '%s' is larger than the radio's memory (%#zx bytes)\n", file, p->mem_size);
+		exit(EXIT_FAILURE);
 	}
 
-	if (pkt->offset > p->mem_size) {
-		fprintf(stderr, "E: offset exceeds memory size: %#04"PRIxFAST16" > %#04zx\n",
-				pkt->offset, p->mem_size);
-		e++;
+	if (len % p->data_len)
+		fprintf(stderr, "W: ignoring trailing %zu bytes of '%s'\n", len % p->data_len, file);
+
+	return len - len % p->data_len;
+}
+
+/*
+ * Refuse to send @image (@len bytes, from @file) unless the fingerprint index
+ * identifies it as one of @p's, rather than finding out after a slow upload.
+ */
+static void
+check_image(const struct dj_parms *p, const char *file, const uint8_t *image, size_t len)
+{
+	if (!fp)
+		return;
+
+	struct fp_result r;
+	fp_classify(fp, image, len, &r);
+	if (r.identified && fp_label_is(r.best->label, p->name)) {
+		fprintf(stderr, "I: '%s' is a %s image\n", file,
+				r.model_only ? p->name : r.best->label);
+		return;
 	}
 
-	return !e;
+	if (r.identified)
+		fprintf(stderr, "%s: '%s' is a %s image, not %s\n", fp_force ? "W" : "E",
+				file, r.best->label, p->name);
+	else
+		fprintf(stderr, "%s: '%s' is not a known %s image\n", fp_force ? "W" : "E",
+				file, p->name);
+
+	if (!fp_force)
+		exit(EXIT_FAILURE);
 }
 
+struct send_opts {
+	unsigned retries;
+	/* re-send blocks that failed in a second pass */
+	bool second_pass;
+};
+
 static void
-__attribute__((format(printf, 1, 2)))
-check_printf(const char *fmt, ...)
+report_failed(const struct dj_xfer *x)
 {
-	(void)fmt;
+	fprintf(stderr, "E: %zu blocks were not acked:", x->failed_ct);
+	size_t i;
+	for (i = 0; i < x->failed_ct; i++)
+		fprintf(stderr, " %#04zx", x->failed[i] * x->p->data_len);
+	putc('\n', stderr);
 }
 
+/*
+ * Run an upload that has been set up in @x to completion, then deal with any
+ * blocks the radio never acked. Exits if the radio doesn't end up with the
+ * entire image.
+ */
+static void
+send_finish(const struct dj_parms *p, struct sp_port *port, const struct send_opts *o,
+		const uint8_t *image, size_t len, struct dj_xfer *x)
+{
+	if (xfer_run(x, port) < 0)
+		exit(EXIT_FAILURE);
+
+	if (!x->failed_ct)
+		return;
+
+	report_failed(x);
+	if (!o->second_pass)
+		exit(EXIT_FAILURE);
+
+	size_t ct = x->failed_ct;
+	size_t *plan = malloc(ct * sizeof(*plan));
+	assert(plan);
+	memcpy(plan, x->failed, ct * sizeof(*plan));
+	dj_xfer_destroy(x);
 
-#ifdef DEBUG_SEND
-#define debug_send(...) fprintf(stderr, "SEND: " __VA_ARGS__)
-#else
-#define debug_send(...) check_printf(__VA_ARGS__)
-#endif
+	fprintf(stderr, "I: re-sending %zu blocks\n", ct);
+	dj_xfer_init_send_blocks(x, p, image, len, plan, ct, now_ns());
+	x->retries = o->retries;
+	if (xfer_run(x, port) < 0)
+		exit(EXIT_FAILURE);
+	free(plan);
+
+	if (x->failed_ct) {
+		report_failed(x);
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(stderr, "I: all blocks acked after the second pass\n");
+}
 
-static void dj_send(const struct dj_parms *p, struct sp_port *port, FILE *in)
+static void dj_send(const struct dj_parms *p, struct sp_port *port, const struct send_opts *o,
+		const uint8_t *image, size_t len)
 {
-	unsigned char buf[DATA_LEN];
-	char ack_buf[PKT_BYTES];
-	char pkt[PKT_BYTES];
+	struct dj_xfer x;
+	dj_xfer_init_send(&x, p, image, len, now_ns());
+	x.retries = o->retries;
+	send_finish(p, port, o, image, len, &x);
+	dj_xfer_destroy(&x);
+}
 
-	size_t i;
-	for (i = 0;;) {
-		size_t l = fread(buf, sizeof(buf), 1, in);
-		if (l != 1) {
-			if (feof(in)) {
-				fprintf(stderr, "I: done\n");
-				return;
-			} else {
-				fprintf(stderr, "E: error reading input file\n");
-				return;
-			}
+/*
+ * Upload only the blocks of @image that differ from @base (what the radio is
+ * believed to hold). If @base_cov is non-NULL, blocks not set in it were never
+ * received, so they are sent as if they differ. Radios that don't take
+ * out-of-order writes won't ack the first sparse block, in which case we fall
+ * back to sending everything.
+ */
+static void dj_send_delta(const struct dj_parms *p, struct sp_port *port, const struct send_opts *o,
+		const uint8_t *image, size_t len, const uint8_t *base, const uint8_t *base_cov,
+		size_t base_len)
+{
+	size_t total = len / p->data_len;
+	size_t *plan = malloc(total * sizeof(*plan) + 1);
+	assert(plan);
+
+	size_t i, ct = 0, unknown = 0;
+	for (i = 0; i < total; i++) {
+		size_t off = i * p->data_len;
+		if (base_cov && !(base_cov[i / 8] & (1 << (i % 8)))) {
+			plan[ct++] = i;
+			unknown++;
+		} else if (off + p->data_len > base_len || memcmp(image + off, base + off, p->data_len))
+			plan[ct++] = i;
+	}
+	if (unknown)
+		fprintf(stderr, "W: delta: %zu blocks missing from the baseline, sending them\n",
+				unknown);
+
+	if (!ct) {
+		fprintf(stderr, "I: image matches the baseline, nothing to send\n");
+		free(plan);
+		return;
+	}
+
+	fprintf(stderr, "I: delta: %zu of %zu blocks differ\n", ct, total);
+
+	uint64_t start = now_ns();
+	struct dj_xfer x;
+	dj_xfer_init_send_blocks(&x, p, image, len, plan, ct, start);
+	x.retries = o->retries;
+	x.stop_on_unacked = ct != total;
+	if (x.stop_on_unacked) {
+		if (xfer_run(&x, port) < 0) {
+			if (!x.failed_ct || interrupted)
+				exit(EXIT_FAILURE);
+
+			fprintf(stderr, "W: radio did not ack a sparse write, falling back to a full upload\n");
+			dj_xfer_destroy(&x);
+			free(plan);
+			dj_send(p, port, o, image, len);
+			return;
 		}
+	} else
+		send_finish(p, port, o, image, len, &x);
+	dj_xfer_destroy(&x);
+
+	/* per block the wire carries a packet and an ack */
+	double secs = (now_ns() - start) / 1e9;
+	size_t skipped = total - ct;
+	size_t wire = p->pkt_len + strlen(p->ack);
+	fprintf(stderr, "I: delta: sent %zu of %zu bytes, saved %zu bytes (%zu on the wire) and ~%.1f s\n",
+			ct * p->data_len, len, skipped * p->data_len, skipped * wire,
+			secs / ct * skipped);
+	free(plan);
+}
 
-		pkt_encode(p, i << 4, buf, pkt);
+/*
+ * Data lands in @data (p->mem_size bytes) as each packet arrives, and if
+ * @coverage is non-NULL the block's bit is set once it has been acked.
+ * Blocks the radio never sent are left untouched, as are blocks already set
+ * in @coverage.
+ *
+ * With @resume, clone passes are accepted until every block is covered.
+ */
+static void
+dj_recv(const struct dj_parms *p, struct sp_port *port, uint8_t *data,
+		uint8_t *coverage, bool resume)
+{
+	struct dj_xfer x;
+	if (coverage)
+		dj_xfer_init_recv_missing(&x, p, data, coverage, now_ns());
+	else
+		dj_xfer_init_recv(&x, p, data, now_ns());
+	x.multi_pass = resume;
+	if (resume)
+		fprintf(stderr, "I: resuming, %zu blocks missing\n", x.missing);
+
+	int r = xfer_run(&x, port);
+	if (x.skipped)
+		fprintf(stderr, "I: skipped %zu blocks we already had\n", x.skipped);
+	if (r < 0)
+		exit(EXIT_FAILURE);
+}
 
-		struct dj_c7_pkt p_dec;
-		if (pkt_decode(&p_dec, pkt) < 0) {
-			fprintf(stderr, "E: could not decode a packet I generated: ");
-			print_bytes_as_cstring(pkt, PKT_BYTES, stderr);
-			putc('\n', stderr);
+/*
+ * What a live send knows of @file (already read into @image): all of it,
+ * unless it has a coverage map (as a live receive leaves), in which case just
+ * the blocks that the map lists.
+ */
+static void
+live_known(const struct dj_parms *p, const char *file, const uint8_t *image, size_t len,
+		struct memory *m)
+{
+	char *map_path;
+	if (asprintf(&map_path, "%s.map", file) < 0) {
+		fprintf(stderr, "E: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	bool sparse = !access(map_path, F_OK);
+	free(map_path);
+
+	if (!sparse) {
+		if (memory_insert(m, image, len, 0)) {
+			fprintf(stderr, "E: out of memory\n");
 			exit(EXIT_FAILURE);
 		}
+		return;
+	}
+
+	struct image_file img;
+	if (image_file_open(&img, file, p->mem_size, p->data_len, true))
+		exit(EXIT_FAILURE);
 
-		if (!pkt_is_ok(p, &p_dec)) {
-			fprintf(stderr, "E: a packet I generated was bad\n");
+	size_t i;
+	for (i = 0; i < img.blocks; i++) {
+		if (image_file_has(&img, i) &&
+				memory_insert(m, img.data + i * p->data_len, p->data_len, i * p->data_len)) {
+			fprintf(stderr, "E: out of memory\n");
 			exit(EXIT_FAILURE);
 		}
+	}
+	image_file_close(&img);
+}
 
-		enum sp_return sr1 = sp_blocking_write_echocancel(port, pkt, sizeof(pkt), 0, 200);
-		if (sr1 < 0) {
-			fprintf(stderr, "E: failed to write packet: %d\n", sr1);
-			exit(EXIT_FAILURE);
+/*
+ * Set up @x to send the blocks of @file that cover the -a ranges. Exits if
+ * any of them are not (entirely) in @file.
+ */
+static void
+live_send_init(const struct dj_parms *p, const char *file, struct dj_live *l,
+		struct dj_xfer *x)
+{
+	uint8_t *image;
+	size_t len = read_image(p, file, &image);
+	check_image(p, file, image, len);
+
+	struct memory m;
+	memory_init(&m);
+	live_known(p, file, image, len, &m);
+	free(image);
+
+	int r = dj_live_init_send(l, x, &m, now_ns());
+	memory_destroy(&m);
+	if (r)
+		exit(EXIT_FAILURE);
+}
+
+/*
+ * Merge what a live receive got into @file, keeping the rest of it, and mark
+ * those blocks in its coverage map. Returns the number of blocks that were
+ * not received, or -1 if @file could not be written.
+ */
+static int
+live_save(const struct dj_parms *p, const char *file, const struct dj_live *l)
+{
+	struct memory m;
+	memory_init(&m);
+	int missing = dj_live_merge(l, &m);
+	if (missing < 0) {
+		fprintf(stderr, "E: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	struct image_file img;
+	if (image_file_open(&img, file, p->mem_size, p->data_len, true)) {
+		memory_destroy(&m);
+		return -1;
+	}
+
+	/* as for live_known(), an image without a map is all known */
+	if (img.unmapped) {
+		fprintf(stderr, "I: '%s' has no coverage map, marking all of it as present\n", file);
+		size_t b;
+		for (b = 0; b < img.blocks; b++)
+			image_file_mark(&img, b);
+	}
+
+	const struct memory_range *r;
+	memory_for_each(&m, r) {
+		memcpy(img.data + r->off, r->data, r->len);
+
+		size_t b;
+		for (b = r->off / p->data_len; b < (r->off + r->len) / p->data_len; b++)
+			image_file_mark(&img, b);
+	}
+	image_file_close(&img);
+	memory_destroy(&m);
+
+	if (missing) {
+		fprintf(stderr, "W: %d blocks were not received:", missing);
+		size_t i;
+		for (i = 0; i < l->plan_len; i++)
+			if (!(l->coverage[l->plan[i] / 8] & (1 << (l->plan[i] % 8))))
+				fprintf(stderr, " %#04zx", l->plan[i] * p->data_len);
+		putc('\n', stderr);
+	}
+	return missing;
+}
+
+/*
+ * Batch mode: drive many radios at once from one poll() loop. The manifest
+ * has one transfer per line:
+ *
+ *	<port> <send|receive> <image>
+ *
+ * Blank lines and lines starting with '#' are ignored. Sends of identical
+ * images share one set of pre-encoded packets.
+ */
+struct batch_image {
+	uint8_t *data;
+	size_t len;
+	char *pkts;
+};
+
+struct batch_job {
+	char *port_name;
+	char *file;
+	char action;
+
+	struct sp_port *port;
+	int fd;
+	struct dj_xfer x;
+
+	/* receive */
+	struct image_file img;
+
+	/* with -a, the blocks to transfer (and, receiving, where they land) */
+	struct dj_live live;
+
+	size_t total_blocks;
+	size_t reported_blocks;
+	bool done;
+	bool ok;
+};
+
+struct batch {
+	const struct dj_parms *p;
+	struct batch_job *jobs;
+	size_t job_ct;
+	struct batch_image *images;
+	size_t image_ct;
+};
+
+static void
+batch_parse(struct batch *b, const char *manifest)
+{
+	FILE *in = fopen(manifest, "r");
+	if (!in) {
+		fprintf(stderr, "E: could not open manifest '%s'\n", manifest);
+		exit(EXIT_FAILURE);
+	}
+
+	char *line = NULL;
+	size_t line_cap = 0, line_nr = 0, job_cap = 0;
+	while (getline(&line, &line_cap, in) >= 0) {
+		line_nr++;
+
+		char *save, *f[4];
+		size_t i;
+		for (i = 0; i < 4; i++) {
+			f[i] = strtok_r(i ? NULL : line, " \t\r\n", &save);
+			if (!f[i])
+				break;
 		}
 
-		if ((size_t)sr1 != sizeof(pkt)) {
-			fprintf(stderr, "E: failed to send entire packet, sent %d out of %zu bytes\n", sr1, sizeof(pkt));
+		if (!i || f[0][0] == '#')
+			continue;
+
+		if (i != 3) {
+			fprintf(stderr, "E: %s:%zu: expected '<port> <send|receive> <image>'\n",
+					manifest, line_nr);
 			exit(EXIT_FAILURE);
 		}
 
-		debug_send("I: sent %d bytes\n", sr1);
-
-		enum sp_return sr = sp_blocking_read(port, ack_buf, sizeof(ack_buf), 100);
-		if (sr < 0) {
-			fprintf(stderr, "E: failed to read packet: %d\n", sr);
+		if (strcmp(f[1], "send") && strcmp(f[1], "receive")) {
+			fprintf(stderr, "E: %s:%zu: unknown action '%s'\n", manifest, line_nr, f[1]);
 			exit(EXIT_FAILURE);
 		}
 
-		if ((size_t)sr != strlen(p->ack) || memcmp(p->ack, ack_buf, sr)) {
-			fprintf(stderr, "W: offset %#04zx was not acked, got: ", i << 4);
-			print_bytes_as_cstring(ack_buf, sr, stderr);
-			fprintf(stderr, "\nW: packet was: ");
-			print_bytes_as_cstring(pkt, sizeof(pkt), stderr);
-			putc('\n', stderr);
+		if (b->job_ct == job_cap) {
+			job_cap = job_cap ? job_cap * 2 : 16;
+			b->jobs = realloc(b->jobs, job_cap * sizeof(*b->jobs));
+			assert(b->jobs);
 		}
 
-		i ++;
+		b->jobs[b->job_ct++] = (struct batch_job){
+			.port_name = strdup(f[0]),
+			.action = f[1][0],
+			.file = strdup(f[2]),
+		};
+	}
+
+	free(line);
+	fclose(in);
+
+	if (!b->job_ct) {
+		fprintf(stderr, "E: manifest '%s' has no entries\n", manifest);
+		exit(EXIT_FAILURE);
 	}
 }
 
-#ifdef DEBUG_RECV
-#define debug_recv(...) fprintf(stderr, "RECV: " __VA_ARGS__)
-#else
-#define debug_recv(...) check_printf(__VA_ARGS__)
-#endif
+/* load @file, sharing the data and packets with an earlier identical image */
+static const struct batch_image *
+batch_image(struct batch *b, const char *file)
+{
+	uint8_t *data;
+	size_t len = read_image(b->p, file, &data);
 
-/*
- * TODO: consider if anyone would want to get a raw-er dump of the transfer
- */
-static void *
-dj_recv(const struct dj_parms *p, struct sp_port *port)
+	size_t i;
+	for (i = 0; i < b->image_ct; i++) {
+		struct batch_image *im = &b->images[i];
+		if (im->len == len && !memcmp(im->data, data, len)) {
+			free(data);
+			return im;
+		}
+	}
+
+	check_image(b->p, file, data, len);
+
+	/* jobs hold pointers into this, so it is sized up front */
+	struct batch_image *im = &b->images[b->image_ct++];
+	im->data = data;
+	im->len = len;
+	im->pkts = malloc(len / b->p->data_len * b->p->pkt_len + 1);
+	assert(im->pkts);
+	dj_xfer_encode(b->p, data, len, im->pkts);
+	return im;
+}
+
+static void
+batch_start(struct batch *b, const struct send_opts *o, bool do_config)
 {
-	/* place to put decoded data */
-	/* FIXME: we just assume data is zero'd in non-included areas
-	 */
-	void *data = calloc(p->mem_size, 1);
-	assert(data);
+	b->images = calloc(b->job_ct, sizeof(*b->images));
+	assert(b->images);
 
-	char buf[PKT_BYTES];
 	size_t i;
-	for (i = 0;;) {
-		ssize_t r = read_pkt(port, buf, sizeof(buf));
-		if (r != sizeof(buf)) {
-			fprintf(stderr, "E: short read of %zd\n", r);
-			continue;
+	for (i = 0; i < b->job_ct; i++) {
+		struct batch_job *j = &b->jobs[i];
+		uint64_t now = now_ns();
+
+		if (live) {
+			if (dj_live_init(&j->live, b->p, live, live_ct))
+				exit(EXIT_FAILURE);
+			j->total_blocks = j->live.plan_len;
+			if (j->action == 's')
+				live_send_init(b->p, j->file, &j->live, &j->x);
+			else {
+				dj_live_init_recv(&j->live, &j->x, now);
+				/* the radio sends everything up to the last one */
+				j->total_blocks = j->live.plan[j->live.plan_len - 1] + 1;
+			}
+			j->x.retries = o->retries;
+		} else if (j->action == 's') {
+			const struct batch_image *im = batch_image(b, j->file);
+			dj_xfer_init_send_pkts(&j->x, b->p, im->data, im->len, im->pkts, now);
+			j->x.retries = o->retries;
+			j->total_blocks = j->x.plan_len;
+		} else {
+			if (image_file_open(&j->img, j->file, b->p->mem_size, b->p->data_len, false))
+				exit(EXIT_FAILURE);
+			dj_xfer_init_recv_missing(&j->x, b->p, j->img.data, j->img.coverage, now);
+			j->total_blocks = j->img.blocks;
+		}
+		/* tagged like the capture's channels */
+		j->x.trace = trace;
+		j->x.trace_chan = i;
+
+		if (cap) {
+			wire_cap_chan(cap, i, j->action == 's' ? WIRE_DIR_SEND : WIRE_DIR_RECV,
+					j->port_name, now);
+			wire_cap_note(cap, i, now, "%s %s %s", j->port_name,
+					j->action == 's' ? "send" : "receive", j->file);
 		}
 
-		debug_recv("read_pkt\n");
+		j->port = port_open(j->port_name, do_config);
+		if (!j->port)
+			exit(EXIT_FAILURE);
 
-		struct dj_c7_pkt pkt;
-		if (pkt_decode(&pkt, buf) < 0) {
-			fprintf(stderr, "E: decode failed, skipping packet\n");
-			continue;
+		enum sp_return sr = sp_get_port_handle(j->port, &j->fd);
+		if (sr != SP_OK) {
+			fprintf(stderr, "E: failed to get handle for port '%s': %d\n", j->port_name, sr);
+			exit(EXIT_FAILURE);
 		}
+	}
 
-		debug_recv("pkt_decode\n");
+	if (live)
+		fprintf(stderr, "I: batch: %zu live transfers\n", b->job_ct);
+	else
+		fprintf(stderr, "I: batch: %zu transfers, %zu distinct images to send\n",
+				b->job_ct, b->image_ct);
+}
 
-		if (!pkt_is_ok(p, &pkt)) {
-			fprintf(stderr, "W: skipping packet\n");
-			continue;
+static void
+batch_finish(struct batch_job *j, bool port_failed)
+{
+	j->done = true;
+	j->ok = !port_failed && j->x.phase == DJ_PHASE_DONE;
+
+	if (j->action == 's') {
+		if (j->x.failed_ct) {
+			fprintf(stderr, "E: %s: ", j->port_name);
+			report_failed(&j->x);
+			j->ok = false;
 		}
+	} else if (live) {
+		if (live_save(j->live.p, j->file, &j->live))
+			j->ok = false;
+	} else {
+		size_t missing = image_file_missing(&j->img);
+		if (missing) {
+			fprintf(stderr, "W: %s: %zu blocks were not received:", j->port_name, missing);
+			image_file_print_missing(&j->img, stderr);
+			putc('\n', stderr);
+			j->ok = false;
+		}
+		image_file_close(&j->img);
+	}
+
+	fprintf(stderr, "%s: %s: %s '%s' %s\n", j->ok ? "I" : "E", j->port_name,
+			j->action == 's' ? "send of" : "receive into", j->file,
+			j->ok ? "done" : "failed");
+
+	dj_xfer_destroy(&j->x);
+	if (live)
+		dj_live_destroy(&j->live);
+	port_close(j->port);
+	if (cap)
+		wire_cap_flush(cap);
+	trace_save();
+}
+
+static size_t
+batch_bytes(const struct batch *b)
+{
+	size_t i, bytes = 0;
+	for (i = 0; i < b->job_ct; i++)
+		bytes += b->jobs[i].x.blocks * b->p->data_len;
+	return bytes;
+}
+
+static void
+batch_progress(struct batch *b, uint64_t start, uint64_t now)
+{
+	size_t i, running = 0;
+	for (i = 0; i < b->job_ct; i++) {
+		struct batch_job *j = &b->jobs[i];
+		if (j->done)
+			continue;
+		running++;
+		if (j->x.blocks == j->reported_blocks)
+			continue;
+		j->reported_blocks = j->x.blocks;
+		fprintf(stderr, "I: %s: %zu/%zu blocks\n", j->port_name,
+				j->x.blocks, j->total_blocks);
+	}
+
+	double secs = (now - start) / 1e9;
+	fprintf(stderr, "I: batch: %zu of %zu running, %.0f bytes/s aggregate\n",
+			running, b->job_ct, batch_bytes(b) / secs);
+}
+
+#define BATCH_REPORT_NS 2000000000
 
-		debug_recv("pkt_is_ok\n");
+/* Returns the number of transfers that failed */
+static size_t
+dj_batch(const struct dj_parms *p, const char *manifest, const struct send_opts *o,
+		bool do_config)
+{
+	struct batch b = { .p = p };
+	batch_parse(&b, manifest);
+	batch_start(&b, o, do_config);
+
+	struct pollfd *pfd = calloc(b.job_ct, sizeof(*pfd));
+	assert(pfd);
+
+	uint64_t start = now_ns(), next_report = start + BATCH_REPORT_NS;
+	size_t running = b.job_ct;
+	while (running) {
+		if (interrupted)
+			fprintf(stderr, "E: batch: interrupted, stopping %zu transfers\n", running);
+
+		uint64_t now = now_ns();
+		uint64_t deadline = next_report;
+		bool again = false;
+		size_t i, pfd_ct = 0;
+
+		for (i = 0; i < b.job_ct; i++) {
+			struct batch_job *j = &b.jobs[i];
+			if (j->done)
+				continue;
+
+			int r = interrupted ? -1 : xfer_step(&j->x, j->port, i, now);
+			if (r < 0 || dj_xfer_finished(&j->x)) {
+				batch_finish(j, r < 0);
+				running--;
+				continue;
+			}
 
-		if (pkt.offset >> 4 != i) {
-			if (pkt.offset >> 4 > i) {
-				fprintf(stderr, "W: jump from %#04zx to %#04" PRIxFAST16 ", continuing\n", i << 4, pkt.offset);
-			} else {
-				fprintf(stderr, "E: jump from %#04zx to %#04" PRIxFAST16 ", DATA WILL BE LOST\n", i << 4, pkt.offset);
+			if (r) {
+				again = true;
+				continue;
 			}
-			i = pkt.offset >> 4;
+
+			pfd[pfd_ct++] = xfer_pollfd(&j->x, j->fd);
+			if (j->x.deadline < deadline)
+				deadline = j->x.deadline;
 		}
 
-		/* do something with the data we have */
-		switch (pkt.action) {
-		case 'W':
-			debug_recv("writing to %#04"PRIxFAST16"\n", pkt.offset);
-			memcpy((char *)data + pkt.offset, pkt.data, sizeof(pkt.data));
-			debug_recv("wrote\n");
-			break;
+		if (now >= next_report) {
+			batch_progress(&b, start, now);
+			next_report = now + BATCH_REPORT_NS;
 		}
-	
-		debug_recv("write\n");
 
-		i++;
+		if (again || !running)
+			continue;
 
-		enum sp_return sr1 = sp_blocking_write_echocancel(port, p->ack, strlen(p->ack), 0, 100);
-		if (sr1 < 0) {
-			fprintf(stderr, "E: failed to write ack\n");
+		if (poll_until(pfd, pfd_ct, deadline, now) < 0)
 			exit(EXIT_FAILURE);
-		}
+	}
 
-		if ((i  << 4) >= p->mem_size)
-			break;
+	double secs = (now_ns() - start) / 1e9;
+	size_t i, failed = 0;
+	for (i = 0; i < b.job_ct; i++) {
+		failed += !b.jobs[i].ok;
+		free(b.jobs[i].port_name);
+		free(b.jobs[i].file);
 	}
+	size_t bytes = batch_bytes(&b);
+	fprintf(stderr, "I: batch: %zu of %zu transfers ok, %zu bytes in %.1f s, %.0f bytes/s aggregate\n",
+			b.job_ct - failed, b.job_ct, bytes, secs, bytes / secs);
 
-	return data;
+	for (i = 0; i < b.image_ct; i++) {
+		free(b.images[i].data);
+		free(b.images[i].pkts);
+	}
+	free(b.images);
+	free(b.jobs);
+	free(pfd);
+	return failed;
 }
 
-static const char *opts = "p:hnb:";
+static const char *opts = "p:hnb:d:Dr:PRT:w:F:fm:a:";
 
 #define STR_(x) #x
 #define STR(x) STR_(x)
@@ -504,9 +1033,38 @@ static void usage_(const char *prgm, int e)
 "%sUsage: %s -p <serial-port> -b <binary file> <action>\n"
 "Actions:\n"
 "  send\n"
-"  receive\n"
+"  receive    (writes <binary file> and a <binary file>.map coverage map,\n"
+"             failing if blocks are still missing, see -R)\n"
+"  batch      run every transfer listed in the manifest <binary file> at\n"
+"             once, one '<port> <send|receive> <image>' per line (no -p)\n"
 "Options: -%s\n"
 "  -n	don't configure serial port\n"
+"  -d <baseline>  send: only send blocks that differ from <baseline>, the\n"
+"                 image the radio currently holds\n"
+"  -D	send: like -d, but first receive the baseline from the radio\n"
+"  -r <retries>   send: re-send a block up to <retries> times if it is not\n"
+"                 acked or its echo is wrong, backing off between attempts\n"
+"                 (default: 3, at most 100)\n"
+"  -P	send: after the upload, re-send only the blocks that failed in a\n"
+"	second pass\n"
+"  -R	receive: resume into an existing <binary file>, taking only the\n"
+"	blocks its map lists as missing, over as many clone passes as it\n"
+"	takes\n"
+"  -T <file>      record the timing of every packet (of every port, in batch\n"
+"                 mode), print latency percentiles at the end and write the\n"
+"                 records to <file> after each transfer (Chrome trace format\n"
+"                 if it ends in .json, else JSON lines)\n"
+"  -F <index>     send, batch: refuse to send images that the fingerprint\n"
+"                 index (see img-id) doesn't identify as the model's\n"
+"  -f	with -F, only warn about such images\n"
+"  -m <model>     the radio's model (default: dj-c7)\n"
+"  -a <ranges>    live edit: only transfer the blocks covering <ranges>,\n"
+"                 comma separated '<first>-<last>' or '<first>+<len>' (say\n"
+"                 0xd50-0xd5f). receive merges them into <binary file>,\n"
+"                 send takes them from it (only those in its map, if it has\n"
+"                 one). The radio must take sparse writes\n"
+"  -w <file>      capture every byte read from and written to the port(s),\n"
+"                 with timestamps, into <file> (see wire-cap.h)\n"
 "\n"
 "radiop version " STR(CFG_GIT_VERSION) "\n"
 	, e?"\n":"", prgm, opts);
@@ -521,6 +1079,14 @@ int main(int argc, char *argv[])
 	const char *port_name = NULL;
 	bool do_config = true;
 	const char *file = NULL;
+	const char *base_file = NULL;
+	bool base_recv = false;
+	struct send_opts so = { .retries = 3 };
+	bool resume = false;
+	const char *cap_file = NULL;
+	const char *fp_file = NULL;
+	const struct dj_parms *p = &dj_c7;
+	const char *live_spec = NULL;
 	int opt;
 
 	while ((opt = getopt(argc, argv, opts)) != -1) {
@@ -537,6 +1103,49 @@ int main(int argc, char *argv[])
 		case 'b':
 			file = optarg;
 			break;
+		case 'd':
+			base_file = optarg;
+			break;
+		case 'D':
+			base_recv = true;
+			break;
+		case 'r': {
+			char *end;
+			unsigned long r = strtoul(optarg, &end, 0);
+			if (*optarg < '0' || *optarg > '9' || *end || r > DJ_XFER_MAX_RETRIES) {
+				e++;
+				fprintf(stderr, "E: -r wants a number of retries, 0 to %d\n",
+						DJ_XFER_MAX_RETRIES);
+			} else
+				so.retries = r;
+			break;
+		}
+		case 'P':
+			so.second_pass = true;
+			break;
+		case 'R':
+			resume = true;
+			break;
+		case 'T':
+			trace_file = optarg;
+			break;
+		case 'w':
+			cap_file = optarg;
+			break;
+		case 'F':
+			fp_file = optarg;
+			break;
+		case 'f':
+			fp_force = true;
+			break;
+		case 'm':
+			p = dj_model_find(optarg);
+			if (!p)
+				exit(EXIT_FAILURE);
+			break;
+		case 'a':
+			live_spec = optarg;
+			break;
 		default:
 			e++;
 			fprintf(stderr, "E: unknown option %c\n", opt);
@@ -544,81 +1153,87 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (!port_name) {
-		e++;
-		fprintf(stderr, "E: no port (-p) specified\n");
-	}
-
-	if (optind != (argc - 1)) {
-		e++;
-		fprintf(stderr, "E: require a single <action> after options\n");
-	}
-
-	if (e)
-		usage(EXIT_FAILURE);
-
-	struct sp_port *port;
-	enum sp_return sr = sp_get_port_by_name(port_name, &port);
-	if (sr != SP_OK) {
-		fprintf(stderr, "E: failed to get serial port '%s': %d\n", port_name, sr);
-		exit(EXIT_FAILURE);
-	}
-
-	struct sp_port_config *config = NULL;
-	if (do_config) {
-		sr = sp_new_config(&config);
-		if (sr != SP_OK) {
-			fprintf(stderr, "E: failed to create port config: %d\n", sr);
+	static struct wire_cap wc;
+	if (!e && cap_file) {
+		if (wire_cap_open(&wc, cap_file, CAP_BUF_SIZE, now_ns()))
 			exit(EXIT_FAILURE);
-		}
+		cap = &wc;
+		atexit(cap_finish);
+	}
+	catch_signals();
 
-		sr = sp_set_config_baudrate(config, 9600);
-		if (sr != SP_OK) {
-			fprintf(stderr, "E: failed to set config baud rate: %d\n", sr);
+	/* ranges depend on the model's memory size, so after all options */
+	if (!e && live_spec) {
+		if (dj_ranges_parse(live_spec, p->mem_size, &live, &live_ct))
 			exit(EXIT_FAILURE);
-		}
-
-		sr = sp_set_config_bits(config, 8);
-		if (sr != SP_OK) {
-			fprintf(stderr, "E: failed to set config bits: %d\n", sr);
+		if (base_file || base_recv || resume) {
+			fprintf(stderr, "E: -a can't be combined with -d, -D or -R\n");
 			exit(EXIT_FAILURE);
 		}
+	}
 
-		sr = sp_set_config_parity(config, SP_PARITY_NONE);
-		if (sr != SP_OK) {
-			fprintf(stderr, "E: failed to set config parity: %d\n", sr);
+	static struct fp_index fpi;
+	if (!e && fp_file) {
+		if (fp_load(&fpi, fp_file))
 			exit(EXIT_FAILURE);
-		}
+		fp = &fpi;
+	}
 
-		sr = sp_set_config_stopbits(config, 1);
-		if (sr != SP_OK) {
-			fprintf(stderr, "E: failed to set config stopbits: %d\n", sr);
-			exit(EXIT_FAILURE);
-		}
+	static struct dj_trace tr;
+	if (!e && trace_file) {
+		dj_trace_init(&tr, p->data_len);
+		trace = &tr;
+		atexit(trace_finish);
+	}
 
-		sr = sp_set_config_flowcontrol(config, SP_FLOWCONTROL_NONE);
-		if (sr != SP_OK) {
-			fprintf(stderr, "E: failed to set config flow control: %d\n", sr);
+	if (optind != (argc - 1)) {
+		e++;
+		fprintf(stderr, "E: require a single <action> after options\n");
+	} else if (!e && *argv[optind] == 'b') {
+		if (!file) {
+			fprintf(stderr, "E: a manifest (-b) is required\n");
 			exit(EXIT_FAILURE);
 		}
+		return dj_batch(p, file, &so, do_config) ? EXIT_FAILURE : EXIT_SUCCESS;
 	}
 
-	sr = sp_open(port, SP_MODE_WRITE | SP_MODE_READ);
-	if (sr != SP_OK) {
-		fprintf(stderr, "E: failed to open port '%s': %d\n", port_name, sr);
-		exit(EXIT_FAILURE);
+	if (!port_name) {
+		e++;
+		fprintf(stderr, "E: no port (-p) specified\n");
 	}
 
-	if (do_config) {
-		sr = sp_set_config(port, config);
-		if (sr != SP_OK) {
-			fprintf(stderr, "E: failed to apply configuration to port: %d\n", sr);
-			exit(EXIT_FAILURE);
+	if (e)
+		usage(EXIT_FAILURE);
+
+	/* reject the wrong image before touching the radio */
+	uint8_t *image = NULL;
+	size_t len = 0;
+	struct dj_live l;
+	struct dj_xfer live_x;
+	if (live && dj_live_init(&l, p, live, live_ct))
+		exit(EXIT_FAILURE);
+	if (*argv[optind] == 's' && file) {
+		if (live)
+			live_send_init(p, file, &l, &live_x);
+		else {
+			len = read_image(p, file, &image);
+			check_image(p, file, image, len);
 		}
 	}
 
+	struct sp_port *port = port_open(port_name, do_config);
+	if (!port)
+		exit(EXIT_FAILURE);
+
 	const char *action = argv[optind];
-	FILE *f = NULL;
+	int ret = 0;
+	if (cap) {
+		enum wire_dir dir = *action == 's' ? WIRE_DIR_SEND
+			: *action == 'r' ? WIRE_DIR_RECV : WIRE_DIR_UNKNOWN;
+		wire_cap_chan(cap, 0, dir, port_name, now_ns());
+		wire_cap_note(cap, 0, now_ns(), "%s %s %s", port_name, action, file ? file : "-");
+	}
+
 	switch (*action) {
 	case 's':
 		if (!file) {
@@ -626,35 +1241,90 @@ int main(int argc, char *argv[])
 			exit(EXIT_FAILURE);
 		}
 
-		f = fopen(file, "r");
-		if (!f) {
-			fprintf(stderr, "E: could not open file '%s'\n", file);
-			exit(EXIT_FAILURE);
-		}
+		if (live) {
+			fprintf(stderr, "I: live: sending %zu of %zu blocks\n",
+					l.plan_len, dj_blocks(p));
+			live_x.retries = so.retries;
+			send_finish(p, port, &so, l.buf, p->mem_size, &live_x);
+			dj_xfer_destroy(&live_x);
+		} else if (base_file || base_recv) {
+			uint8_t *base, *base_cov = NULL;
+			size_t base_len;
+			if (base_recv) {
+				fprintf(stderr, "I: receiving baseline, put the radio in clone send mode\n");
+				base = calloc(p->mem_size, 1);
+				base_cov = calloc((dj_blocks(p) + 7) / 8, 1);
+				assert(base && base_cov);
+				dj_recv(p, port, base, base_cov, false);
+				base_len = p->mem_size;
+				fprintf(stderr, "I: baseline received, put the radio in clone receive mode and press enter\n");
+				sigset_t old;
+				sigprocmask(SIG_SETMASK, &wait_mask, &old);
+				int c;
+				while (!interrupted && (c = getchar()) != '\n' && c != EOF)
+					;
+				sigprocmask(SIG_SETMASK, &old, NULL);
+			} else
+				base_len = read_image(p, base_file, &base);
+
+			dj_send_delta(p, port, &so, image, len, base, base_cov, base_len);
+			free(base);
+			free(base_cov);
+		} else
+			dj_send(p, port, &so, image, len);
 
-		dj_send(&dj_c7, port, f);
+		free(image);
 		break;
 	case 'r': {
-		if (file) {
-			f = fopen(file, "w");
-			if (!f) {
-				fprintf(stderr, "E: could not open file '%s'\n", file);
+		if (!file) {
+			fprintf(stderr, "E: a file is required\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if (live) {
+			fprintf(stderr, "I: live: receiving %zu of %zu blocks, put the radio in clone send mode\n",
+					l.plan_len, dj_blocks(p));
+			dj_live_init_recv(&l, &live_x, now_ns());
+			int r = xfer_run(&live_x, port);
+			int missing = live_save(p, file, &l);
+			if (missing < 0 || r < 0)
 				exit(EXIT_FAILURE);
-			}
+			if (missing)
+				ret = EXIT_FAILURE;
+			break;
+		}
+
+		/* blocks are written to the file as they arrive, and the
+		 * sidecar map records which ones we have */
+		struct image_file img;
+		if (image_file_open(&img, file, p->mem_size, p->data_len, resume))
+			exit(EXIT_FAILURE);
+		if (img.unmapped)
+			fprintf(stderr, "W: '%s' has no coverage map, treating it as empty\n", file);
+
+		if (resume && !image_file_missing(&img)) {
+			fprintf(stderr, "I: '%s' is already complete\n", file);
+		} else
+			dj_recv(p, port, img.data, img.coverage, resume);
+
+		size_t missing = image_file_missing(&img);
+		if (missing) {
+			fprintf(stderr, "W: %zu blocks were not received:", missing);
+			image_file_print_missing(&img, stderr);
+			putc('\n', stderr);
+			/* what was received is kept, for -R to finish */
+			ret = EXIT_FAILURE;
 		}
-		void *data = dj_recv(&dj_c7, port);
-		fwrite(data, dj_c7.mem_size, 1, f);
-		free(data);
+		image_file_close(&img);
 		break;
- 	}
+	}
 	default:
 		fprintf(stderr, "E: unknown action '%s'\n", action);
 		exit(EXIT_FAILURE);
 	}
 
-	if (f)
-		fclose(f);
-	sp_close(port);
-	sp_free_config(config);
-	return 0;
+	if (live)
+		dj_live_destroy(&l);
+	port_close(port);
+	return ret;
 }
@@ -0,0 +1,164 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dj-live.h"
+
+static bool
+parse_num(const char *s, char **end, size_t *v)
+{
+	if (*s == '-' || *s == '+')
+		return false;
+	unsigned long long n = strtoull(s, end, 0);
+	*v = n;
+	return *end != s && n == *v;
+}
+
+int dj_ranges_parse(const char *spec, size_t mem_size,
+		struct dj_range **ranges, size_t *ct)
+{
+	size_t cap = 1;
+	const char *c;
+	for (c = spec; *c; c++)
+		cap += *c == ',';
+
+	struct dj_range *r = malloc(cap * sizeof(*r));
+	if (!r) {
+		fprintf(stderr, "E: out of memory\n");
+		return -1;
+	}
+
+	size_t n = 0;
+	const char *s = spec;
+	for (;;) {
+		char *end;
+		size_t first, v;
+		if (!parse_num(s, &end, &first) || (*end != '-' && *end != '+'))
+			goto bad;
+
+		char sep = *end;
+		s = end + 1;
+		if (!parse_num(s, &end, &v) || (*end && *end != ','))
+			goto bad;
+
+		if (sep == '-') {
+			if (v < first)
+				goto bad;
+			v = v - first + 1;
+		}
+
+		if (!v || first >= mem_size || v > mem_size - first) {
+			fprintf(stderr, "E: range %#zx+%zu is empty or not within the %#zx bytes of memory\n",
+					first, v, mem_size);
+			free(r);
+			return -1;
+		}
+
+		r[n++] = (struct dj_range){ .off = first, .len = v };
+		if (!*end)
+			break;
+		s = end + 1;
+	}
+
+	*ranges = r;
+	*ct = n;
+	return 0;
+
+bad:
+	fprintf(stderr, "E: bad range in '%s' at '%s', expected <first>-<last> or <first>+<len>\n",
+			spec, s);
+	free(r);
+	return -1;
+}
+
+static bool
+have_block(const uint8_t *coverage, size_t block)
+{
+	return coverage[block / 8] & (1 << (block % 8));
+}
+
+int dj_live_init(struct dj_live *l, const struct dj_parms *p,
+		const struct dj_range *ranges, size_t ct)
+{
+	size_t blocks = dj_blocks(p), i, b;
+	*l = (struct dj_live){
+		.p = p,
+		.plan = malloc(blocks * sizeof(*l->plan) + 1),
+		.buf = calloc(p->mem_size + 1, 1),
+		.coverage = malloc(blocks / 8 + 1),
+	};
+	if (!l->plan || !l->buf || !l->coverage) {
+		fprintf(stderr, "E: out of memory\n");
+		dj_live_destroy(l);
+		return -1;
+	}
+
+	/* everything starts out "had", then the blocks to transfer are cleared */
+	memset(l->coverage, 0xff, blocks / 8 + 1);
+	for (i = 0; i < ct; i++) {
+		if (ranges[i].off + ranges[i].len > p->mem_size) {
+			fprintf(stderr, "E: range %#zx+%zu is beyond the %#zx bytes of memory\n",
+					ranges[i].off, ranges[i].len, p->mem_size);
+			dj_live_destroy(l);
+			return -1;
+		}
+
+		size_t last = (ranges[i].off + ranges[i].len - 1) / p->data_len;
+		for (b = ranges[i].off / p->data_len; b <= last; b++)
+			l->coverage[b / 8] &= ~(1 << (b % 8));
+	}
+
+	for (b = 0; b < blocks; b++)
+		if (!have_block(l->coverage, b))
+			l->plan[l->plan_len++] = b;
+
+	return 0;
+}
+
+void dj_live_destroy(struct dj_live *l)
+{
+	free(l->plan);
+	free(l->buf);
+	free(l->coverage);
+	l->plan = NULL;
+	l->buf = NULL;
+	l->coverage = NULL;
+}
+
+void dj_live_init_recv(struct dj_live *l, struct dj_xfer *x, uint64_t now)
+{
+	dj_xfer_init_recv_missing(x, l->p, l->buf, l->coverage, now);
+}
+
+int dj_live_merge(const struct dj_live *l, struct memory *m)
+{
+	size_t i;
+	int missing = 0;
+	for (i = 0; i < l->plan_len; i++) {
+		size_t off = l->plan[i] * l->p->data_len;
+		if (!have_block(l->coverage, l->plan[i]))
+			missing++;
+		else if (memory_insert(m, l->buf + off, l->p->data_len, off))
+			return -1;
+	}
+	return missing;
+}
+
+int dj_live_init_send(struct dj_live *l, struct dj_xfer *x,
+		const struct memory *m, uint64_t now)
+{
+	size_t i;
+	for (i = 0; i < l->plan_len; i++) {
+		size_t off = l->plan[i] * l->p->data_len;
+		if (memory_read(m, off, l->buf + off, l->p->data_len)) {
+			fprintf(stderr, "E: the block at %#04zx is not entirely known, "
+					"read it from the radio first\n", off);
+			return -1;
+		}
+	}
+
+	dj_xfer_init_send_blocks(x, l->p, l->buf, l->p->mem_size,
+			l->plan, l->plan_len, now);
+	return 0;
+}
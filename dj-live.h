@@ -0,0 +1,72 @@
+#pragma once
+
+/*
+ * Live (partial) transfers: instead of cloning the whole memory, move only
+ * the blocks covering a set of byte ranges, say just the settings at
+ * 0x0d50-0x0d5f. What is read is merged into a sparse image (struct memory)
+ * and what is written comes from one, so a read-modify-write of a few
+ * settings never needs the rest of the image.
+ *
+ * A write sends nothing but the covering blocks, which only works on radios
+ * that take sparse writes (dj-sim -o is one that doesn't). A read can't ask
+ * for particular blocks, the radio still clones from the start, so it only
+ * saves storing the other blocks and finishes as soon as the last wanted
+ * one arrives.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dj-proto.h"
+#include "dj-xfer.h"
+#include "memory.h"
+
+struct dj_range {
+	size_t off;
+	size_t len;
+};
+
+/*
+ * Parse comma separated ranges, each "<first>-<last>" (inclusive) or
+ * "<first>+<len>", numbers in C notation (so 0xd50-0xd5f). They must fit in
+ * @mem_size bytes. Returns 0 on success, -1 (after printing why) on failure.
+ */
+int dj_ranges_parse(const char *spec, size_t mem_size,
+		struct dj_range **ranges, size_t *ct);
+
+struct dj_live {
+	const struct dj_parms *p;
+
+	/* the blocks covering the ranges, ascending */
+	size_t *plan;
+	size_t plan_len;
+
+	/* p->mem_size bytes that the planned blocks are staged in */
+	uint8_t *buf;
+	/* recv: a bit per block as in struct dj_xfer, blocks that aren't
+	 * planned start out set so they are acked but not kept */
+	uint8_t *coverage;
+};
+
+/* returns 0 on success, -1 (after printing why) on failure */
+int dj_live_init(struct dj_live *l, const struct dj_parms *p,
+		const struct dj_range *ranges, size_t ct);
+void dj_live_destroy(struct dj_live *l);
+
+/* set up @x to receive the planned blocks, finishing once it has them all */
+void dj_live_init_recv(struct dj_live *l, struct dj_xfer *x, uint64_t now);
+/*
+ * Merge the planned blocks that were received into @m, whole blocks rather
+ * than just the ranges, so they can be written back. Returns how many
+ * planned blocks were not received, or -1 if @m could not grow.
+ */
+int dj_live_merge(const struct dj_live *l, struct memory *m);
+
+/*
+ * Set up @x to send the planned blocks from @m. Every byte of them must be in
+ * @m: a block is only partly covered by the ranges, so the rest of it has to
+ * come from somewhere (a full image, or a dj_live_merge() of a read). Returns
+ * 0 on success, -1 (after printing the first incomplete block) on failure.
+ */
+int dj_live_init_send(struct dj_live *l, struct dj_xfer *x,
+		const struct memory *m, uint64_t now);
@@ -0,0 +1,132 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dj-proto.h"
+#include "hex.h"
+#include "print.h"
+
+const struct dj_parms dj_c7 = {
+	.name = "dj-c7",
+	.ack = "\r\nOK\r\n",
+	.magic = "AL~F",
+	.magic_len = 4,
+	.addr_len = 2,
+	.action = 'W',
+	.end = '\r',
+	.data_len = 16,
+	.pkt_len = DJ_PKT_LEN(4, 2, 16),
+	.mem_size = 0xfff + 1,
+};
+
+const struct dj_parms *const dj_models[] = {
+	&dj_c7,
+	NULL,
+};
+
+const struct dj_parms *dj_model_find(const char *name)
+{
+	size_t i;
+	for (i = 0; dj_models[i]; i++)
+		if (!strcmp(dj_models[i]->name, name))
+			return dj_models[i];
+
+	fprintf(stderr, "E: unknown model '%s', known models:", name);
+	for (i = 0; dj_models[i]; i++)
+		fprintf(stderr, " %s", dj_models[i]->name);
+	putc('\n', stderr);
+	return NULL;
+}
+
+void pkt_encode(const struct dj_parms *p, uint_fast32_t offset, const unsigned char *buf, char *pkt)
+{
+	static const char digits[16] = "0123456789ABCDEF";
+
+	memcpy(pkt, p->magic, p->magic_len);
+	pkt += p->magic_len;
+
+	/* the address's digits straight from @offset, rather than through
+	 * hex_encode(), which is slow to set up for so few */
+	assert(p->addr_len == 4 || offset >> (p->addr_len * 8) == 0);
+	size_t i, n = p->addr_len * 2;
+	for (i = 0; i < n; i++)
+		pkt[i] = digits[offset >> ((n - 1 - i) * 4) & 0xf];
+
+	pkt += n;
+
+	*pkt = p->action;
+
+	pkt ++;
+
+	hex_encode(pkt, buf, p->data_len);
+	pkt += p->data_len * 2;
+
+	*pkt = p->end;
+}
+
+int
+pkt_decode(const struct dj_parms *p, struct dj_pkt *pkt, const char *buf)
+{
+	size_t err_pos;
+	memcpy(pkt->magic, buf, p->magic_len);
+	buf += p->magic_len;
+	uint8_t off[DJ_ADDR_MAX];
+	int ro = hex_decode(off, buf, p->addr_len, &err_pos);
+	pkt->offset = 0;
+	if (ro >= 0) {
+		size_t i;
+		for (i = 0; i < p->addr_len; i++)
+			pkt->offset = pkt->offset << 8 | off[i];
+	}
+	buf += p->addr_len * 2;
+	pkt->action = *buf;
+	buf ++;
+
+	if (ro < 0) {
+		fprintf(stderr, "E: offset decode failed at byte %zu\n", p->magic_len + err_pos);
+		return -1;
+	}
+
+	int r = hex_decode(pkt->data, buf, p->data_len, &err_pos);
+	if (r < 0) {
+		fprintf(stderr, "E: data decode failed at byte %zu\n",
+				p->magic_len + p->addr_len * 2 + 1 + err_pos);
+		memset(pkt->data, 0, p->data_len);
+		return -2;
+	}
+
+	return 0;
+}
+
+
+bool
+pkt_is_ok(const struct dj_parms *p, const struct dj_pkt *pkt)
+{
+	int e = 0;
+	if (memcmp(pkt->magic, p->magic, p->magic_len)) {
+		fprintf(stderr, "W: magic mis-match, have ");
+		print_bytes_as_cstring(pkt->magic, p->magic_len, stderr);
+		fprintf(stderr, "\n");
+		e++;
+	}
+
+	if (pkt->action != p->action) {
+		fprintf(stderr, "W: unknown action '%c' (%d)\n", pkt->action, pkt->action);
+		e++;
+	}
+
+	if (pkt->offset % p->data_len) {
+		fprintf(stderr, "E: offset not a multiple of %zu: %#04"PRIxFAST32"\n",
+				p->data_len, pkt->offset);
+		e++;
+	}
+
+	if (pkt->offset + p->data_len > p->mem_size) {
+		fprintf(stderr, "E: offset exceeds memory size: %#04"PRIxFAST32" > %#04zx\n",
+				pkt->offset, p->mem_size);
+		e++;
+	}
+
+	return !e;
+}
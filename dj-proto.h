@@ -0,0 +1,145 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * When "sending", radio sends 42 bytes at a time, each ending with a '\r'
+ * It expects a '\r\nOK\r\n' in reply acknowledging each piece of data. After a
+ * short timeout, it will display "Failed" if no ack is recieved.
+ *
+ * 0000000000111111111122222222223333333333444
+ * 0123456789012345678901234567890123456789012
+ * AL~F0XX0W012345678901234567890123456789012\r
+ *          |    data bytes in hex          |
+ *      ||-> address
+ *
+ * "AL~F" : 4 bytes: marker, meaning unknown
+ * "0AB0" : 4 bytes: address (2 bytes, lowest and highest always zero)
+ * "W"    : 1 bytes: action, only 'W' seen
+ *        : 32 bytes: data, hex encoded, 16 actual bytes
+ * "\r"   : 1 bytes: packet end
+ *
+ * 0D5D is 27 on unlocked-tx
+ * 0D5D is 23 on locked-tx
+ *
+ * 0D5C is 6c on mprotect on
+ * 0D5C is 2c on mprotect off
+ *
+ * 0D52 is 0A when volume is 10
+ * 0D52 is 09 when volume is 9
+ *
+ * 0D54 is 03 when squelch is 3
+ * 0D54 is 04 when squelch is 4
+ *
+ * 0D5D is 23 when hi-volume
+ * 0D5D is 33 when lo-volume
+ *
+ * 0D5C is 6c when SMA
+ * 0D5C is 7c when Ear
+ *
+ * 0D5D is 33 when rpt normal
+ * 0D5D is B3 when rpt star
+ *
+ * 0D5B is 00 when tone is 1750
+ * 0D5B is 01 when tone is 2100
+ * 0D5B is 02 when tone is 1000
+ * 0D5B is 03 when tone is 1450
+ *
+ * 0D58 is 00 when APO is off
+ * 0D58 is 01 when APO is 30min
+ * 0D58 is 02 when APO is 60min
+ * 0D58 is 03 when APO is 90min
+ *
+ * 0D5C is 5C when bs is off
+ * 0D5C is 7C when bs is on
+ *
+ * 0D5C is 5C when beep is on
+ * 0D5C is 54 when beep is off
+ *
+ * 0D5C is 54 when bell is off
+ * 0D5C is 55 when bell is on
+ *
+ * 0D5D is B3 when "busy"
+ * 0D5D is F3 when "timer"
+ *
+ * 0D5D is 23 when step "auto"
+ * 0D5D is 03 when step "5"
+ *
+ * - freq was 145.000
+ * 0DC6 is 01 when step 5
+ * 0DC6 is 02 when step 6.25
+ * 0DC6 is 03 when step 8.33
+ * 0DC6 is 04 when step 10
+ *
+ * When the first memory location is written, 0D60 has it's high bit set (00 vs 80)
+ *
+ */
+
+/*
+ * A clone protocol in the family above, as a table: every packet is
+ *
+ *   <magic> <address, hex> <action> <data, hex> <end>
+ *
+ * and is acked with <ack>. The address is the offset of the packet's data,
+ * big endian, addr_len bytes. The image is transferred in mem_size /
+ * data_len blocks, block n being the packet at offset n * data_len.
+ *
+ * Everything that moves images (dj-xfer, dj-c7, dj-sim, dj-replay) works
+ * from one of these, so a radio with a protocol like this only needs an
+ * entry in dj_models[].
+ */
+
+/* the largest of each in any protocol, for buffers */
+#define DJ_MAGIC_MAX 8
+#define DJ_ADDR_MAX 4
+#define DJ_DATA_MAX 64
+#define DJ_PKT_MAX (DJ_MAGIC_MAX + DJ_ADDR_MAX * 2 + 1 + DJ_DATA_MAX * 2 + 1)
+
+#define DJ_PKT_LEN(magic_len, addr_len, data_len) \
+	((magic_len) + (addr_len) * 2 + 1 + (data_len) * 2 + 1)
+
+struct dj_parms {
+	/* model, as in fingerprint labels */
+	const char *name;
+	const char *ack;
+	const char *magic;
+	size_t magic_len;
+	size_t addr_len;
+	/* the action of a write, the only one seen */
+	char action;
+	/* the last byte of a packet */
+	char end;
+	/* bytes of data per packet */
+	size_t data_len;
+	/* DJ_PKT_LEN() of the above */
+	size_t pkt_len;
+	size_t mem_size;
+};
+
+extern const struct dj_parms dj_c7;
+
+/* every model with a protocol, NULL terminated */
+extern const struct dj_parms *const dj_models[];
+
+/* the model called @name, NULL (after listing the known ones) if there isn't one */
+const struct dj_parms *dj_model_find(const char *name);
+
+static inline size_t dj_blocks(const struct dj_parms *p)
+{
+	return p->mem_size / p->data_len;
+}
+
+struct dj_pkt {
+	uint8_t magic[DJ_MAGIC_MAX];
+	uint_fast32_t offset;
+	char action;
+	uint8_t data[DJ_DATA_MAX];
+};
+
+/* write the p->pkt_len byte packet carrying p->data_len bytes of @buf to @offset */
+void pkt_encode(const struct dj_parms *p, uint_fast32_t offset, const unsigned char *buf, char *pkt);
+/* decode p->pkt_len bytes of @buf, checking nothing but the hex */
+int pkt_decode(const struct dj_parms *p, struct dj_pkt *pkt, const char *buf);
+bool pkt_is_ok(const struct dj_parms *p, const struct dj_pkt *pkt);
@@ -0,0 +1,568 @@
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dj-proto.h"
+#include "dj-xfer.h"
+#include "print.h"
+#include "util.h"
+#include "wire-cap.h"
+
+/*
+ * Replay the receiving end of a clone without a radio or a port: the bytes
+ * dj-c7 read from the port (from a dj-c7 -w capture), or a transcript made up
+ * from an image, are fed through the same dj_xfer state machine, decoder and
+ * image assembly that dj-c7 receive uses, as fast as they will go.
+ *
+ * Whatever the state machine writes is checked against what was written in
+ * the capture, so a replay that goes differently is noticed.
+ */
+
+/* the protocol being replayed, set by -m */
+static const struct dj_parms *parms = &dj_c7;
+
+/*
+ * one read from the port: @len bytes at @off in the rx stream, read after
+ * the first @tx_end bytes of the tx stream had been written
+ */
+struct chunk {
+	uint64_t time;
+	size_t off, len;
+	size_t tx_end;
+};
+
+struct input {
+	struct chunk *chunks;
+	size_t chunk_ct;
+	uint8_t *rx;
+	size_t rx_len;
+	/* what was written */
+	uint8_t *tx;
+	size_t tx_len;
+
+	/* rx without the echoes of tx, ie: only what the radio sent */
+	struct chunk *radio_chunks;
+	size_t radio_chunk_ct;
+	uint8_t *radio;
+	size_t radio_len;
+};
+
+struct result {
+	enum dj_xfer_phase phase;
+	size_t blocks, bad_pkts, covered;
+	/* rx bytes fed in */
+	size_t fed;
+	/* where our writes first differ from the capture's, SIZE_MAX if never */
+	size_t diverged;
+};
+
+static void *
+grow(void *p, size_t *cap, size_t need, size_t elem)
+{
+	if (need <= *cap)
+		return p;
+	while (*cap < need)
+		*cap = *cap ? *cap * 2 : 1024;
+	p = realloc(p, *cap * elem);
+	if (!p) {
+		fprintf(stderr, "E: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+static void
+input_add(struct input *in, size_t *chunk_cap, size_t *rx_cap, uint64_t time,
+		const void *data, size_t len)
+{
+	in->chunks = grow(in->chunks, chunk_cap, in->chunk_ct + 1, sizeof(*in->chunks));
+	in->rx = grow(in->rx, rx_cap, in->rx_len + len, 1);
+	in->chunks[in->chunk_ct++] = (struct chunk){ time, in->rx_len, len, in->tx_len };
+	memcpy(in->rx + in->rx_len, data, len);
+	in->rx_len += len;
+}
+
+/* with @dump, the channel's records are also printed as a transcript */
+static void
+input_from_capture(struct input *in, const char *path, unsigned chan, bool dump)
+{
+	struct wire_trace t;
+	if (wire_cap_load(&t, path))
+		exit(EXIT_FAILURE);
+
+	size_t chunk_cap = 0, rx_cap = 0, tx_cap = 0, i;
+	for (i = 0; i < t.ct; i++) {
+		const struct wire_rec *r = &t.recs[i];
+		if (r->chan != chan)
+			continue;
+
+		if (dump) {
+			static const char *kinds[] = { "rx", "tx", "note", "chan" };
+			printf("%12.3f ms %-4s ", (r->time - t.start) / 1e6, kinds[r->kind]);
+			print_bytes_as_cstring(r->data, r->len, stdout);
+			putchar('\n');
+		}
+
+		switch (r->kind) {
+		case WIRE_RX:
+			input_add(in, &chunk_cap, &rx_cap, r->time, r->data, r->len);
+			break;
+		case WIRE_TX:
+			in->tx = grow(in->tx, &tx_cap, in->tx_len + r->len, 1);
+			memcpy(in->tx + in->tx_len, r->data, r->len);
+			in->tx_len += r->len;
+			break;
+		case WIRE_NOTE:
+			fprintf(stderr, "I: capture note: %.*s\n", (int)r->len, r->data);
+			break;
+		case WIRE_CHAN:
+			if (wire_rec_dir(r) == WIRE_DIR_SEND) {
+				fprintf(stderr, "E: channel %u is a send, only receives can be replayed\n", chan);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		}
+	}
+
+	wire_cap_unload(&t);
+
+	if (!in->chunk_ct) {
+		fprintf(stderr, "E: '%s' has nothing read on channel %u\n", path, chan);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*
+ * What dj-c7 would read while receiving @image from a well behaved radio:
+ * each packet, then the echo of our ack.
+ */
+static void
+input_synth(struct input *in, const uint8_t *image)
+{
+	size_t chunk_cap = 0, rx_cap = 0, tx_cap = 0, i;
+	size_t ack_len = strlen(parms->ack);
+	uint64_t t = 0;
+	for (i = 0; i < dj_blocks(parms); i++) {
+		char pkt[DJ_PKT_MAX];
+		pkt_encode(parms, i * parms->data_len, image + i * parms->data_len, pkt);
+		input_add(in, &chunk_cap, &rx_cap, t += 1000, pkt, parms->pkt_len);
+
+		in->tx = grow(in->tx, &tx_cap, in->tx_len + ack_len, 1);
+		memcpy(in->tx + in->tx_len, parms->ack, ack_len);
+		in->tx_len += ack_len;
+
+		input_add(in, &chunk_cap, &rx_cap, t += 1000, parms->ack, ack_len);
+	}
+}
+
+/*
+ * Split the radio's bytes out from the echoes of what was written: as we're
+ * half-duplex, bytes read while something written has not been echoed yet
+ * are that echo, as long as they match.
+ */
+static void
+input_split_echo(struct input *in)
+{
+	in->radio = malloc(in->rx_len + 1);
+	in->radio_chunks = malloc(in->chunk_ct * sizeof(*in->radio_chunks) + 1);
+	if (!in->radio || !in->radio_chunks) {
+		fprintf(stderr, "E: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	size_t echo_pos = 0, i, j;
+	for (i = 0; i < in->chunk_ct; i++) {
+		const struct chunk *c = &in->chunks[i];
+		size_t start = in->radio_len;
+		for (j = 0; j < c->len; j++) {
+			uint8_t b = in->rx[c->off + j];
+			if (echo_pos < c->tx_end && b == in->tx[echo_pos])
+				echo_pos++;
+			else
+				in->radio[in->radio_len++] = b;
+		}
+
+		if (in->radio_len != start)
+			in->radio_chunks[in->radio_chunk_ct++] = (struct chunk){
+				c->time, start, in->radio_len - start, c->tx_end
+			};
+	}
+}
+
+static void
+drain(struct dj_xfer *x, const struct input *in, size_t *tx_pos, uint64_t now,
+		struct result *res)
+{
+	const char *out;
+	size_t n;
+	while ((n = dj_xfer_pending(x, &out))) {
+		if (in->tx && res->diverged == SIZE_MAX
+				&& (*tx_pos + n > in->tx_len || memcmp(in->tx + *tx_pos, out, n)))
+			res->diverged = *tx_pos;
+		*tx_pos += n;
+		dj_xfer_wrote(x, n, now);
+	}
+}
+
+/* gather the results of a receive that finished, or ran out of input */
+static void
+replay_finish(struct dj_xfer *x, uint8_t *coverage, struct result *res)
+{
+	size_t i, blocks = dj_blocks(parms);
+	res->phase = x->phase;
+	res->blocks = x->blocks;
+	res->bad_pkts = x->bad_pkts;
+	for (i = 0; i < blocks; i++)
+		res->covered += !!(coverage[i / 8] & (1 << (i % 8)));
+	dj_xfer_destroy(x);
+}
+
+static void
+replay_begin(const struct input *in, struct dj_xfer *x, uint8_t *data, uint8_t *coverage,
+		struct result *res)
+{
+	size_t blocks = dj_blocks(parms);
+	memset(data, 0, parms->mem_size);
+	memset(coverage, 0, (blocks + 7) / 8);
+	*res = (struct result){ .diverged = SIZE_MAX };
+	dj_xfer_init_recv_missing(x, parms, data, coverage, in->chunks[0].time);
+}
+
+/* Feed everything that was read through a receive, exactly as captured */
+static void
+replay(const struct input *in, uint8_t *data, uint8_t *coverage, struct result *res)
+{
+	struct dj_xfer x;
+	replay_begin(in, &x, data, coverage, res);
+
+	size_t tx_pos = 0, i;
+	for (i = 0; i < in->chunk_ct && !dj_xfer_finished(&x); i++) {
+		const struct chunk *c = &in->chunks[i];
+		while (!dj_xfer_finished(&x) && x.deadline <= c->time) {
+			dj_xfer_timeout(&x, x.deadline);
+			drain(&x, in, &tx_pos, c->time, res);
+		}
+
+		if (dj_xfer_finished(&x))
+			break;
+
+		dj_xfer_input(&x, (const char *)in->rx + c->off, c->len, c->time);
+		drain(&x, in, &tx_pos, c->time, res);
+		res->fed += c->len;
+	}
+
+	replay_finish(&x, coverage, res);
+}
+
+/*
+ * Feed only the bytes the radio sent, replacing each with probability
+ * @corrupt, and echo whatever the receive writes straight back to it. Unlike
+ * replay() this keeps going sensibly when the receive reacts differently to
+ * what was captured (eg: doesn't ack a corrupted packet).
+ */
+static void
+replay_loopback(const struct input *in, double corrupt, uint64_t *rng,
+		uint8_t *data, uint8_t *coverage, struct result *res)
+{
+	struct dj_xfer x;
+	replay_begin(in, &x, data, coverage, res);
+
+	size_t i, j;
+	for (i = 0; i < in->radio_chunk_ct && !dj_xfer_finished(&x); i++) {
+		const struct chunk *c = &in->radio_chunks[i];
+		for (j = 0; j < c->len && !dj_xfer_finished(&x); j++) {
+			while (!dj_xfer_finished(&x) && x.deadline <= c->time)
+				dj_xfer_timeout(&x, x.deadline);
+
+			char b = in->radio[c->off + j];
+			if (rng_chance(rng, corrupt))
+				b = rng_next(rng);
+			dj_xfer_input(&x, &b, 1, c->time);
+			res->fed++;
+
+			const char *out;
+			size_t n;
+			while ((n = dj_xfer_pending(&x, &out))) {
+				char echo[DJ_PKT_MAX];
+				memcpy(echo, out, n);
+				dj_xfer_wrote(&x, n, c->time);
+				dj_xfer_input(&x, echo, n, c->time);
+			}
+		}
+	}
+
+	replay_finish(&x, coverage, res);
+}
+
+/* finished with every block, as dj-c7 receive requires to succeed */
+static bool
+complete(const struct result *r)
+{
+	return r->phase == DJ_PHASE_DONE && r->covered == dj_blocks(parms);
+}
+
+static const char *
+outcome(const struct result *r)
+{
+	switch (r->phase) {
+	case DJ_PHASE_DONE:
+		return complete(r) ? "done" : "done with blocks missing";
+	case DJ_PHASE_FAILED:
+		return "failed";
+	default:
+		return "incomplete (capture ended)";
+	}
+}
+
+/* stderr off, for the state machine's chatter during repeated runs */
+static int
+quiet_begin(void)
+{
+	fflush(stderr);
+	int saved = dup(STDERR_FILENO);
+	int null = open("/dev/null", O_WRONLY);
+	if (saved < 0 || null < 0) {
+		fprintf(stderr, "E: could not silence stderr\n");
+		exit(EXIT_FAILURE);
+	}
+	dup2(null, STDERR_FILENO);
+	close(null);
+	return saved;
+}
+
+static void
+quiet_end(int saved)
+{
+	fflush(stderr);
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+}
+
+static const char *opts = "hc:i:o:n:f:S:m:vdx";
+
+static void usage_(const char *prgm, int e)
+{
+	FILE *f;
+	if (e)
+		f = stderr;
+	else
+		f = stdout;
+
+	fprintf(f,
+"%sUsage: %s [options] [<capture>]\n"
+"Replay a receive from a dj-c7 -w capture, or without one from a transcript\n"
+"of an ideal radio sending an image.\n"
+"Options: -%s\n"
+"  -c <channel>  channel of the capture to replay (default: 0)\n"
+"  -i <image>    image for the made up transcript (default: pseudo-random)\n"
+"  -o <file>     write the assembled image to <file>\n"
+"  -n <count>    replay this many times and report the throughput\n"
+"  -f <prob>     corrupt each byte the radio sent with this probability,\n"
+"                differently on each of the -n runs, and report how the\n"
+"                receive fared against an uncorrupted replay. What the\n"
+"                receive writes is echoed back to it, rather than the\n"
+"                echoes in the capture\n"
+"  -S <seed>     random seed (default: 1)\n"
+"  -m <model>    the radio's model, for its protocol (default: dj-c7)\n"
+"  -v            show the state machine's messages on every run, not just\n"
+"                the first\n"
+"  -d            print the capture's records for the channel\n"
+"  -x            hexdump the assembled image\n"
+	, e?"\n":"", prgm, opts);
+
+	exit(e);
+}
+#define usage(e) usage_(argc?argv[0]:"dj-replay", e)
+
+int main(int argc, char *argv[])
+{
+	unsigned chan = 0;
+	const char *image_file = NULL, *out_file = NULL;
+	size_t iter = 1;
+	double corrupt = 0;
+	uint64_t seed = 1;
+	bool verbose = false, dump = false, hexdump = false;
+	int opt, e = 0;
+
+	while ((opt = getopt(argc, argv, opts)) != -1) {
+		switch (opt) {
+		case 'h':
+			usage(EXIT_SUCCESS);
+			break;
+		case 'c':
+			chan = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			image_file = optarg;
+			break;
+		case 'o':
+			out_file = optarg;
+			break;
+		case 'n':
+			iter = strtoull(optarg, NULL, 0);
+			break;
+		case 'f':
+			corrupt = strtod(optarg, NULL);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'm':
+			parms = dj_model_find(optarg);
+			if (!parms)
+				exit(EXIT_FAILURE);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'd':
+			dump = true;
+			break;
+		case 'x':
+			hexdump = true;
+			break;
+		default:
+			e++;
+			break;
+		}
+	}
+
+	if (argc - optind > 1) {
+		fprintf(stderr, "E: at most one <capture> may be given\n");
+		e++;
+	}
+
+	if (!iter) {
+		fprintf(stderr, "E: -n must be at least 1\n");
+		e++;
+	}
+
+	if (e)
+		usage(EXIT_FAILURE);
+
+	uint64_t rng = seed;
+	struct input in = { 0 };
+	if (optind < argc) {
+		input_from_capture(&in, argv[optind], chan, dump);
+	} else {
+		uint8_t *image = calloc(parms->mem_size, 1);
+		if (!image) {
+			fprintf(stderr, "E: out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if (image_file) {
+			FILE *f = fopen(image_file, "rb");
+			if (!f) {
+				fprintf(stderr, "E: could not open image '%s'\n", image_file);
+				exit(EXIT_FAILURE);
+			}
+			size_t len = fread(image, 1, parms->mem_size, f);
+			fclose(f);
+			if (len != parms->mem_size)
+				fprintf(stderr, "W: '%s' is %zu bytes, padding with zeros\n", image_file, len);
+		} else {
+			size_t i;
+			for (i = 0; i < parms->mem_size; i++)
+				image[i] = rng_next(&rng);
+		}
+
+		input_synth(&in, image);
+		free(image);
+	}
+
+	size_t blocks = dj_blocks(parms);
+	uint8_t *ref = malloc(parms->mem_size), *ref_cov = malloc((blocks + 7) / 8);
+	uint8_t *data = malloc(parms->mem_size), *cov = malloc((blocks + 7) / 8);
+	if (!ref || !ref_cov || !data || !cov) {
+		fprintf(stderr, "E: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* the first run is as captured, and is what everything else is compared to */
+	struct result res;
+	replay(&in, ref, ref_cov, &res);
+	printf("replay: %zu bytes in %zu reads, %s, %zu blocks received (%zu of %zu covered), %zu bad packets\n",
+			res.fed, in.chunk_ct, outcome(&res), res.blocks, res.covered, blocks, res.bad_pkts);
+	if (res.diverged != SIZE_MAX)
+		printf("replay: what was written differs from the capture from byte %zu on\n", res.diverged);
+	bool ok = complete(&res) && res.diverged == SIZE_MAX;
+
+	if (hexdump)
+		print_hexdump(ref, parms->mem_size, 0, stdout);
+
+	if (out_file) {
+		FILE *f = fopen(out_file, "wb");
+		if (!f || fwrite(ref, parms->mem_size, 1, f) != 1 || fclose(f)) {
+			fprintf(stderr, "E: could not write '%s'\n", out_file);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	size_t i;
+	if (corrupt > 0) {
+		input_split_echo(&in);
+
+		size_t done = 0, missing = 0, failed = 0, bad_pkts = 0, covered = 0, wrong = 0;
+		for (i = 0; i < iter; i++) {
+			int saved = verbose ? -1 : quiet_begin();
+			replay_loopback(&in, corrupt, &rng, data, cov, &res);
+			if (!verbose)
+				quiet_end(saved);
+
+			done += complete(&res);
+			missing += res.phase == DJ_PHASE_DONE && !complete(&res);
+			failed += res.phase == DJ_PHASE_FAILED;
+			bad_pkts += res.bad_pkts;
+			covered += res.covered;
+
+			/* blocks accepted with different contents: corruption that
+			 * still decoded, the protocol has no checksum to catch it */
+			size_t b;
+			for (b = 0; b < blocks; b++)
+				if ((cov[b / 8] & (1 << (b % 8)))
+						&& memcmp(data + b * parms->data_len, ref + b * parms->data_len,
+							parms->data_len))
+					wrong++;
+		}
+
+		printf("fuzz: %zu runs at p=%g: %zu done, %zu done with blocks missing, %zu failed, %zu incomplete\n",
+				iter, corrupt, done, missing, failed, iter - done - missing - failed);
+		printf("fuzz: per run %.1f bad packets, %.1f blocks covered, %.2f blocks silently wrong\n",
+				(double)bad_pkts / iter, (double)covered / iter, (double)wrong / iter);
+	} else if (iter > 1) {
+		int saved = verbose ? -1 : quiet_begin();
+		uint64_t start = now_ns();
+		size_t fed = 0;
+		for (i = 0; i < iter; i++) {
+			replay(&in, data, cov, &res);
+			fed += res.fed;
+		}
+		uint64_t ns = now_ns() - start;
+		if (!verbose)
+			quiet_end(saved);
+
+		if (memcmp(data, ref, parms->mem_size)) {
+			fprintf(stderr, "E: replays did not assemble the same image\n");
+			exit(EXIT_FAILURE);
+		}
+
+		printf("bench: %zu runs, %zu bytes in %.3f s, %.1f MB/s, %.1f ns/packet\n",
+				iter, fed, ns / 1e9, fed * 1e3 / ns, (double)ns / (iter * res.blocks));
+	}
+
+	free(in.chunks);
+	free(in.rx);
+	free(in.tx);
+	free(in.radio);
+	free(in.radio_chunks);
+	free(ref);
+	free(ref_cov);
+	free(data);
+	free(cov);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
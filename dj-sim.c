@@ -0,0 +1,651 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dj-proto.h"
+#include "print.h"
+#include "util.h"
+
+/*
+ * Pretend to be a DJ-C7 on the far end of a programming cable, using a pty.
+ *
+ * The cable is half-duplex: everything the PC transmits is looped back to it,
+ * so every byte we read from the pty master is echoed. Bytes headed to the PC
+ * (echos, packets and acks) are paced at the configured baud rate, and
+ * responses from the "radio" can be delayed, jittered, dropped or corrupted,
+ * as can the echo.
+ *
+ * Actions are named after the dj-c7 action they serve:
+ *  send:    the radio receives an image, acking each packet
+ *  receive: the radio transmits an image, waiting for an ack after each packet
+ */
+
+enum sim_action {
+	SIM_SEND,
+	SIM_RECEIVE,
+};
+
+#define SEG_DATA_LEN 64
+#define SEG_CT 32
+
+/* a run of bytes on the wire towards the PC */
+struct seg {
+	uint8_t data[SEG_DATA_LEN];
+	size_t len, pos;
+	uint64_t not_before;
+	/* originated by the radio (rather than an echo), subject to corruption */
+	bool radio;
+};
+
+struct wire {
+	struct seg segs[SEG_CT];
+	size_t head, ct;
+	/* when the line finishes sending the last byte it was given */
+	uint64_t free_ns;
+};
+
+struct sim {
+	const struct dj_parms *p;
+	enum sim_action action;
+	int fd;
+
+	uint64_t byte_ns;
+	uint64_t latency_ns, jitter_ns;
+	uint64_t ack_timeout_ns;
+	double drop, corrupt, echo_corrupt;
+	uint64_t rng;
+	/* only accept writes in order, starting at 0 */
+	bool in_order;
+
+	struct wire wire;
+
+	uint8_t *image;
+	size_t block;
+	bool done;
+
+	char rx[DJ_PKT_MAX * 2];
+	size_t rx_len;
+	uint64_t deadline;
+
+	size_t pkts, bad_pkts, acks, dropped, corrupted, echoed;
+	uint64_t start_ns;
+};
+
+static struct seg *
+wire_tail(struct wire *w)
+{
+	return &w->segs[(w->head + w->ct - 1) % SEG_CT];
+}
+
+/* time at which everything currently queued will have been sent */
+static uint64_t
+wire_end(struct sim *s)
+{
+	struct wire *w = &s->wire;
+	uint64_t t = w->free_ns;
+	size_t i;
+	for (i = 0; i < w->ct; i++) {
+		struct seg *g = &w->segs[(w->head + i) % SEG_CT];
+		if (t < g->not_before)
+			t = g->not_before;
+		t += (g->len - g->pos) * s->byte_ns;
+	}
+	return t;
+}
+
+static void
+wire_push(struct sim *s, const void *data_, size_t len, uint64_t not_before, bool radio)
+{
+	struct wire *w = &s->wire;
+	const uint8_t *data = data_;
+
+	while (len) {
+		struct seg *g = w->ct ? wire_tail(w) : NULL;
+		if (!g || g->radio != radio || g->not_before != not_before || g->len == SEG_DATA_LEN) {
+			if (w->ct == SEG_CT) {
+				fprintf(stderr, "E: wire queue overflow\n");
+				exit(EXIT_FAILURE);
+			}
+			w->ct++;
+			g = wire_tail(w);
+			*g = (struct seg){ .not_before = not_before, .radio = radio };
+		}
+
+		size_t l = SEG_DATA_LEN - g->len;
+		if (l > len)
+			l = len;
+		memcpy(g->data + g->len, data, l);
+		g->len += l;
+		data += l;
+		len -= l;
+	}
+}
+
+/* when the next queued byte arrives at the PC */
+static uint64_t
+wire_due(struct sim *s)
+{
+	struct wire *w = &s->wire;
+	if (!w->ct)
+		return UINT64_MAX;
+
+	struct seg *g = &w->segs[w->head];
+	uint64_t t = w->free_ns;
+	if (t < g->not_before)
+		t = g->not_before;
+	return t + s->byte_ns;
+}
+
+static void
+wire_flush(struct sim *s, uint64_t now)
+{
+	struct wire *w = &s->wire;
+	uint8_t out[SEG_DATA_LEN];
+	uint64_t due;
+
+	while ((due = wire_due(s)) <= now) {
+		struct seg *g = &w->segs[w->head];
+		size_t n = 0;
+		do {
+			uint8_t b = g->data[g->pos++];
+			if (rng_chance(&s->rng, g->radio ? s->corrupt : s->echo_corrupt)) {
+				b ^= 1 << (rng_next(&s->rng) % 8);
+				s->corrupted++;
+			}
+			out[n++] = b;
+			w->free_ns = due;
+			due += s->byte_ns;
+		} while (g->pos < g->len && due <= now);
+
+		size_t off = 0;
+		while (off < n) {
+			ssize_t r = write(s->fd, out + off, n - off);
+			if (r < 0) {
+				if (errno == EINTR)
+					continue;
+				fprintf(stderr, "E: write to pty failed: %s\n", strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			off += r;
+		}
+
+		if (g->pos == g->len) {
+			w->head = (w->head + 1) % SEG_CT;
+			w->ct--;
+		}
+	}
+}
+
+static uint64_t
+sim_response_time(struct sim *s)
+{
+	uint64_t t = wire_end(s);
+	uint64_t now = now_ns();
+	if (t < now)
+		t = now;
+	t += s->latency_ns;
+	if (s->jitter_ns)
+		t += rng_next(&s->rng) % s->jitter_ns;
+	return t;
+}
+
+static void
+sim_send_block(struct sim *s)
+{
+	char pkt[DJ_PKT_MAX];
+	pkt_encode(s->p, s->block * s->p->data_len, s->image + s->block * s->p->data_len, pkt);
+	wire_push(s, pkt, s->p->pkt_len, sim_response_time(s), true);
+	s->deadline = wire_end(s) + s->ack_timeout_ns;
+	s->pkts++;
+}
+
+/* the PC is uploading, handle one complete line */
+static void
+sim_rx_pkt(struct sim *s, char *line, size_t len)
+{
+	struct dj_pkt pkt;
+	if (len != s->p->pkt_len || pkt_decode(s->p, &pkt, line) < 0 || !pkt_is_ok(s->p, &pkt)
+			|| pkt.offset + s->p->data_len > s->p->mem_size) {
+		fprintf(stderr, "W: radio got a bad packet: ");
+		print_bytes_as_cstring(line, len, stderr);
+		putc('\n', stderr);
+		s->bad_pkts++;
+		return;
+	}
+
+	if (s->in_order && pkt.offset != s->block * s->p->data_len) {
+		fprintf(stderr, "W: radio expected offset %#04zx, got %#04" PRIxFAST32 "\n",
+				s->block * s->p->data_len, pkt.offset);
+		s->bad_pkts++;
+		return;
+	}
+
+	memcpy(s->image + pkt.offset, pkt.data, s->p->data_len);
+	s->block = pkt.offset / s->p->data_len + 1;
+	s->pkts++;
+
+	if (rng_chance(&s->rng, s->drop)) {
+		s->dropped++;
+		return;
+	}
+
+	wire_push(s, s->p->ack, strlen(s->p->ack), sim_response_time(s), true);
+	s->acks++;
+}
+
+static void
+sim_rx(struct sim *s, const char *buf, size_t len)
+{
+	wire_push(s, buf, len, now_ns(), false);
+	s->echoed += len;
+
+	size_t i;
+	for (i = 0; i < len; i++) {
+		if (s->rx_len == sizeof(s->rx)) {
+			/* garbage, keep only the most recent half */
+			memmove(s->rx, s->rx + sizeof(s->rx) / 2, sizeof(s->rx) / 2);
+			s->rx_len = sizeof(s->rx) / 2;
+		}
+		s->rx[s->rx_len++] = buf[i];
+
+		switch (s->action) {
+		case SIM_SEND:
+			if (buf[i] == s->p->end) {
+				sim_rx_pkt(s, s->rx, s->rx_len);
+				s->rx_len = 0;
+			}
+			break;
+		case SIM_RECEIVE: {
+			size_t al = strlen(s->p->ack);
+			if (s->done || s->rx_len < al || memcmp(s->rx + s->rx_len - al, s->p->ack, al))
+				break;
+
+			s->rx_len = 0;
+			s->acks++;
+			s->block++;
+			if (s->block >= dj_blocks(s->p))
+				s->done = true;
+			else
+				sim_send_block(s);
+			break;
+		}
+		}
+	}
+}
+
+static volatile sig_atomic_t stop;
+
+static void
+on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+/* wait for something to open the slave side of the pty */
+static bool
+sim_wait_connect(int fd)
+{
+	while (!stop) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		if (poll(&pfd, 1, 0) < 0 && errno != EINTR) {
+			fprintf(stderr, "E: poll failed: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		if (!(pfd.revents & POLLHUP))
+			return true;
+
+		nanosleep(&(struct timespec){ .tv_nsec = 10000000 }, NULL);
+	}
+	return false;
+}
+
+/* returns false if the session failed */
+static bool
+sim_run(struct sim *s, uint64_t start_delay_ns)
+{
+	s->wire = (struct wire){ 0 };
+	s->block = 0;
+	s->done = false;
+	s->rx_len = 0;
+	s->deadline = UINT64_MAX;
+	s->start_ns = now_ns();
+
+	if (s->action == SIM_RECEIVE) {
+		s->wire.free_ns = s->start_ns + start_delay_ns;
+		sim_send_block(s);
+	}
+
+	for (;;) {
+		uint64_t now = now_ns();
+		wire_flush(s, now);
+
+		if (s->done && !s->wire.ct)
+			return true;
+
+		if (stop)
+			return false;
+
+		if (!s->done && now >= s->deadline) {
+			fprintf(stderr, "E: radio: no ack for block %#04zx, Failed\n", s->block * s->p->data_len);
+			return false;
+		}
+
+		uint64_t wake = wire_due(s);
+		if (!s->done && s->deadline < wake)
+			wake = s->deadline;
+
+		struct timespec ts, *tsp = NULL;
+		if (wake != UINT64_MAX) {
+			uint64_t d = wake > now ? wake - now : 0;
+			ts = (struct timespec){ .tv_sec = d / 1000000000, .tv_nsec = d % 1000000000 };
+			tsp = &ts;
+		}
+
+		struct pollfd pfd = { .fd = s->fd, .events = POLLIN };
+		int r = ppoll(&pfd, 1, tsp, NULL);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "E: poll failed: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		if (pfd.revents & POLLIN) {
+			char buf[SEG_DATA_LEN];
+			ssize_t l = read(s->fd, buf, sizeof(buf));
+			if (l > 0) {
+				sim_rx(s, buf, l);
+				continue;
+			}
+			if (l < 0 && errno != EIO && errno != EINTR && errno != EAGAIN) {
+				fprintf(stderr, "E: read from pty failed: %s\n", strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		if (pfd.revents & POLLHUP) {
+			/* PC closed the port, an upload is over once that happens */
+			return s->action == SIM_SEND;
+		}
+	}
+}
+
+static void
+sim_report(struct sim *s)
+{
+	double secs = (now_ns() - s->start_ns) / 1e9;
+	size_t bytes = s->pkts * s->p->data_len;
+	fprintf(stderr, "I: %zu packets (%zu bad), %zu acks, %zu dropped acks, %zu corrupted bytes, %zu echoed bytes\n",
+			s->pkts, s->bad_pkts, s->acks, s->dropped, s->corrupted, s->echoed);
+	fprintf(stderr, "I: %zu data bytes in %.3f s, %.1f bytes/s\n",
+			bytes, secs, secs > 0 ? bytes / secs : 0);
+}
+
+static int
+pty_open(const char *link_path)
+{
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) || unlockpt(fd)) {
+		fprintf(stderr, "E: could not create pty: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	const char *name = ptsname(fd);
+	if (!name) {
+		fprintf(stderr, "E: could not get pty name: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	/* raw mode, so the slave behaves like a serial port even when the
+	 * client does not configure it (dj-c7 -n). The settings stick around
+	 * as long as we hold the master. */
+	int sfd = open(name, O_RDWR | O_NOCTTY);
+	struct termios t;
+	if (sfd < 0 || tcgetattr(sfd, &t)) {
+		fprintf(stderr, "E: could not open pty slave '%s': %s\n", name, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	cfmakeraw(&t);
+	if (tcsetattr(sfd, TCSANOW, &t)) {
+		fprintf(stderr, "E: could not configure pty slave: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	close(sfd);
+
+	if (link_path) {
+		unlink(link_path);
+		if (symlink(name, link_path)) {
+			fprintf(stderr, "E: could not link '%s' to '%s': %s\n", link_path, name, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	printf("%s\n", name);
+	fflush(stdout);
+	return fd;
+}
+
+static const char *opts = "b:B:l:j:d:c:e:t:s:oL:S:m:kh";
+
+static void usage_(const char *prgm, int e)
+{
+	FILE *f;
+	if (e)
+		f = stderr;
+	else
+		f = stdout;
+
+	fprintf(f,
+"%sUsage: %s [options] <action>\n"
+"Simulate a DJ-C7 (or another -m model) on a pty, the pty's name is printed\n"
+"on stdout.\n"
+"Actions (named after the dj-c7 action being served):\n"
+"  send      radio receives an image\n"
+"  receive   radio transmits an image\n"
+"Options: -%s\n"
+"  -b <file>   image to transmit, or where to store a received image\n"
+"              (default: transmit a pseudo-random image)\n"
+"  -B <baud>   pace bytes as if on a 8N1 line at this rate, 0 for\n"
+"              no pacing (default: 9600)\n"
+"  -l <ms>     radio response latency (default: 0)\n"
+"  -j <ms>     extra random response latency, up to this much (default: 0)\n"
+"  -d <prob>   probability that a received packet is not acked (default: 0)\n"
+"  -c <prob>   probability that a byte sent by the radio is corrupted (default: 0)\n"
+"  -e <prob>   probability that an echoed byte is corrupted (default: 0)\n"
+"  -t <ms>     how long the radio waits for an ack (default: 1000)\n"
+"  -s <ms>     delay after the port is opened before transmitting (default: 100)\n"
+"  -o          only accept writes in order from offset 0 (no sparse writes)\n"
+"  -L <path>   create a symlink to the pty at <path>\n"
+"  -S <seed>   random seed (default: 1)\n"
+"  -m <model>  the radio to be, by its protocol (default: dj-c7)\n"
+"  -k          keep serving sessions until interrupted\n"
+	, e?"\n":"", prgm, opts);
+
+	exit(e);
+}
+#define usage(e) usage_(argc?argv[0]:"dj-sim", e)
+
+static uint64_t
+ms_to_ns(const char *s)
+{
+	return strtod(s, NULL) * 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+	int e = 0;
+	const char *file = NULL, *link_path = NULL;
+	long baud = 9600;
+	uint64_t start_delay_ns = 100000000;
+	bool keep = false;
+	int opt;
+
+	struct sim s = {
+		.p = &dj_c7,
+		.ack_timeout_ns = 1000000000,
+		.rng = 1,
+	};
+
+	while ((opt = getopt(argc, argv, opts)) != -1) {
+		switch (opt) {
+		case 'b':
+			file = optarg;
+			break;
+		case 'B':
+			baud = strtol(optarg, NULL, 0);
+			break;
+		case 'l':
+			s.latency_ns = ms_to_ns(optarg);
+			break;
+		case 'j':
+			s.jitter_ns = ms_to_ns(optarg);
+			break;
+		case 'd':
+			s.drop = strtod(optarg, NULL);
+			break;
+		case 'c':
+			s.corrupt = strtod(optarg, NULL);
+			break;
+		case 'e':
+			s.echo_corrupt = strtod(optarg, NULL);
+			break;
+		case 't':
+			s.ack_timeout_ns = ms_to_ns(optarg);
+			break;
+		case 's':
+			start_delay_ns = ms_to_ns(optarg);
+			break;
+		case 'o':
+			s.in_order = true;
+			break;
+		case 'L':
+			link_path = optarg;
+			break;
+		case 'S':
+			s.rng = strtoull(optarg, NULL, 0);
+			break;
+		case 'm':
+			s.p = dj_model_find(optarg);
+			if (!s.p)
+				exit(EXIT_FAILURE);
+			break;
+		case 'k':
+			keep = true;
+			break;
+		case 'h':
+			usage(EXIT_SUCCESS);
+			break;
+		default:
+			e++;
+			fprintf(stderr, "E: unknown option %c\n", opt);
+			break;
+		}
+	}
+
+	if (optind != (argc - 1)) {
+		e++;
+		fprintf(stderr, "E: require a single <action> after options\n");
+	}
+
+	if (baud < 0) {
+		e++;
+		fprintf(stderr, "E: baud rate must not be negative\n");
+	}
+
+	if (e)
+		usage(EXIT_FAILURE);
+
+	const char *action = argv[optind];
+	switch (*action) {
+	case 's':
+		s.action = SIM_SEND;
+		break;
+	case 'r':
+		s.action = SIM_RECEIVE;
+		break;
+	default:
+		fprintf(stderr, "E: unknown action '%s'\n", action);
+		exit(EXIT_FAILURE);
+	}
+
+	/* 8N1: 10 bits per byte */
+	s.byte_ns = baud ? 10 * UINT64_C(1000000000) / baud : 0;
+
+	s.image = calloc(s.p->mem_size, 1);
+	if (!s.image) {
+		fprintf(stderr, "E: could not allocate image\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (s.action == SIM_RECEIVE) {
+		if (file) {
+			FILE *f = fopen(file, "r");
+			if (!f) {
+				fprintf(stderr, "E: could not open file '%s'\n", file);
+				exit(EXIT_FAILURE);
+			}
+			if (fread(s.image, 1, s.p->mem_size, f) != s.p->mem_size)
+				fprintf(stderr, "W: '%s' is shorter than the radio's memory, padding with zeros\n", file);
+			fclose(f);
+		} else {
+			uint64_t img_rng = s.rng;
+			size_t i;
+			for (i = 0; i < s.p->mem_size; i++)
+				s.image[i] = rng_next(&img_rng);
+		}
+	}
+
+	struct sigaction sa = { .sa_handler = on_signal };
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	s.fd = pty_open(link_path);
+
+	bool ok = true;
+	do {
+		if (!sim_wait_connect(s.fd))
+			break;
+
+		s.pkts = s.bad_pkts = s.acks = s.dropped = s.corrupted = s.echoed = 0;
+		ok = sim_run(&s, start_delay_ns);
+		sim_report(&s);
+
+		if (s.action == SIM_SEND && file) {
+			FILE *f = fopen(file, "w");
+			if (!f || fwrite(s.image, s.p->mem_size, 1, f) != 1) {
+				fprintf(stderr, "E: could not write file '%s'\n", file);
+				exit(EXIT_FAILURE);
+			}
+			fclose(f);
+		}
+
+		/* let the client go away before looking for the next one (or
+		 * exiting), closing the master would discard anything it has not
+		 * read yet */
+		while (!stop) {
+			struct pollfd pfd = { .fd = s.fd, .events = POLLIN };
+			char buf[SEG_DATA_LEN];
+			if (poll(&pfd, 1, 10) > 0 && (pfd.revents & POLLHUP))
+				break;
+			if (pfd.revents & POLLIN)
+				(void)!read(s.fd, buf, sizeof(buf));
+		}
+	} while (keep && !stop);
+
+	if (link_path)
+		unlink(link_path);
+	close(s.fd);
+	free(s.image);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,184 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dj-trace.h"
+
+struct stage {
+	const char *name;
+	bool recv;
+	enum dj_trace_ev from, to;
+};
+
+static const struct stage stages[] = {
+	{ "write",  false, DJ_TRACE_START,    DJ_TRACE_WRITTEN },
+	{ "echo",   false, DJ_TRACE_WRITTEN,  DJ_TRACE_ECHOED },
+	{ "ack",    false, DJ_TRACE_ECHOED,   DJ_TRACE_ACKED },
+	{ "block",  false, DJ_TRACE_START,    DJ_TRACE_ACKED },
+	{ "packet", true,  DJ_TRACE_START,    DJ_TRACE_RECEIVED },
+	{ "reply",  true,  DJ_TRACE_RECEIVED, DJ_TRACE_WRITTEN },
+	{ "echo",   true,  DJ_TRACE_WRITTEN,  DJ_TRACE_ECHOED },
+	{ "block",  true,  DJ_TRACE_START,    DJ_TRACE_ECHOED },
+};
+
+static const char *ev_names[DJ_TRACE_EV_CT] = {
+	[DJ_TRACE_START] = "start",
+	[DJ_TRACE_RECEIVED] = "received",
+	[DJ_TRACE_WRITTEN] = "written",
+	[DJ_TRACE_ECHOED] = "echoed",
+	[DJ_TRACE_ACKED] = "acked",
+};
+
+void dj_trace_init(struct dj_trace *t, size_t data_len)
+{
+	*t = (struct dj_trace){ .data_len = data_len };
+}
+
+void dj_trace_destroy(struct dj_trace *t)
+{
+	free(t->recs);
+	*t = (struct dj_trace){ 0 };
+}
+
+struct dj_trace_rec *dj_trace_begin(struct dj_trace *t, unsigned chan, bool recv,
+		size_t block, unsigned attempt, uint64_t now)
+{
+	if (t->ct == t->cap) {
+		t->cap = t->cap ? t->cap * 2 : 512;
+		t->recs = realloc(t->recs, t->cap * sizeof(*t->recs));
+		if (!t->recs) {
+			fprintf(stderr, "E: could not allocate trace records\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	struct dj_trace_rec *r = &t->recs[t->ct++];
+	*r = (struct dj_trace_rec){
+		.block = block,
+		.chan = chan,
+		.attempt = attempt,
+		.recv = recv,
+	};
+	r->t[DJ_TRACE_START] = now;
+	return r;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static uint64_t
+trace_t0(const struct dj_trace *t)
+{
+	return t->ct ? t->recs[0].t[DJ_TRACE_START] : 0;
+}
+
+static uint64_t
+trace_end(const struct dj_trace *t)
+{
+	uint64_t end = 0;
+	size_t i, j;
+	for (i = 0; i < t->ct; i++)
+		for (j = 0; j < DJ_TRACE_EV_CT; j++)
+			if (t->recs[i].t[j] > end)
+				end = t->recs[i].t[j];
+	return end;
+}
+
+void dj_trace_report(const struct dj_trace *t, FILE *out)
+{
+	if (!t->ct)
+		return;
+
+	uint64_t *v = malloc(t->ct * sizeof(*v));
+	if (!v) {
+		fprintf(stderr, "E: could not allocate trace report\n");
+		return;
+	}
+
+	size_t i, ok = 0;
+	for (i = 0; i < t->ct; i++)
+		ok += t->recs[i].ok;
+
+	double secs = (trace_end(t) - trace_t0(t)) / 1e9;
+	fprintf(out, "I: trace: %zu packets, %zu ok, %zu data bytes in %.3f s, %.1f bytes/s\n",
+			t->ct, ok, ok * t->data_len, secs, ok * t->data_len / secs);
+	fprintf(out, "I: trace: %-14s %8s %10s %10s %10s\n", "step (ms)", "count", "p50", "p99", "max");
+
+	size_t s;
+	for (s = 0; s < sizeof(stages) / sizeof(stages[0]); s++) {
+		const struct stage *st = &stages[s];
+		size_t ct = 0;
+		for (i = 0; i < t->ct; i++) {
+			const struct dj_trace_rec *r = &t->recs[i];
+			if (r->recv == st->recv && r->t[st->from] && r->t[st->to])
+				v[ct++] = r->t[st->to] - r->t[st->from];
+		}
+
+		if (!ct)
+			continue;
+
+		qsort(v, ct, sizeof(*v), cmp_u64);
+		fprintf(out, "I: trace: %-4s %-9s %8zu %10.3f %10.3f %10.3f\n",
+				st->recv ? "recv" : "send", st->name, ct,
+				v[(ct - 1) / 2] / 1e6, v[(ct - 1) * 99 / 100] / 1e6, v[ct - 1] / 1e6);
+	}
+
+	free(v);
+}
+
+void dj_trace_write_jsonl(const struct dj_trace *t, FILE *out)
+{
+	uint64_t t0 = trace_t0(t);
+	size_t i, j;
+	for (i = 0; i < t->ct; i++) {
+		const struct dj_trace_rec *r = &t->recs[i];
+		fprintf(out, "{\"chan\":%u,\"dir\":\"%s\",\"block\":%" PRIu32 ",\"offset\":%" PRIu32
+				",\"attempt\":%u,\"ok\":%s",
+				r->chan, r->recv ? "recv" : "send", r->block, (uint32_t)(r->block * t->data_len),
+				r->attempt, r->ok ? "true" : "false");
+		for (j = 0; j < DJ_TRACE_EV_CT; j++) {
+			if (r->t[j])
+				fprintf(out, ",\"%s_ns\":%" PRIu64, ev_names[j], r->t[j] - t0);
+			else
+				fprintf(out, ",\"%s_ns\":null", ev_names[j]);
+		}
+		fputs("}\n", out);
+	}
+}
+
+static void
+chrome_event(FILE *out, const struct dj_trace *t, bool *first, const char *name,
+		const struct dj_trace_rec *r, int tid, uint64_t from, uint64_t to, uint64_t t0)
+{
+	/* a process per transfer */
+	fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%d,"
+			"\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"offset\":\"0x%04" PRIx32 "\",\"attempt\":%u}}",
+			*first ? "" : ",", name, r->chan + 1u, tid, (from - t0) / 1e3, (to - from) / 1e3,
+			(uint32_t)(r->block * t->data_len), r->attempt);
+	*first = false;
+}
+
+void dj_trace_write_chrome(const struct dj_trace *t, FILE *out)
+{
+	uint64_t t0 = trace_t0(t);
+	bool first = true;
+	size_t i, s;
+
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", out);
+	for (i = 0; i < t->ct; i++) {
+		const struct dj_trace_rec *r = &t->recs[i];
+		for (s = 0; s < sizeof(stages) / sizeof(stages[0]); s++) {
+			const struct stage *st = &stages[s];
+			if (r->recv != st->recv || !r->t[st->from] || !r->t[st->to])
+				continue;
+			/* whole blocks on one track, their steps on another */
+			int tid = strcmp(st->name, "block") ? 2 : 1;
+			chrome_event(out, t, &first, st->name, r, tid, r->t[st->from], r->t[st->to], t0);
+		}
+	}
+	fputs("\n]}\n", out);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+/*
+ * Per-packet timing of clone transfers
+ *
+ * When a struct dj_xfer has a trace attached, each packet it exchanges gets
+ * a record holding the time each step of the exchange completed. At the end
+ * these can be summarized (dj_trace_report()) or dumped for other tools.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum dj_trace_ev {
+	/* send: first byte of the packet written; recv: first byte arrived */
+	DJ_TRACE_START,
+	/* recv: the whole packet has arrived */
+	DJ_TRACE_RECEIVED,
+	/* the packet (send) or ack (recv) has been completely written */
+	DJ_TRACE_WRITTEN,
+	/* and its echo has been read back */
+	DJ_TRACE_ECHOED,
+	/* send: the radio's ack has arrived */
+	DJ_TRACE_ACKED,
+	DJ_TRACE_EV_CT
+};
+
+struct dj_trace_rec {
+	/* CLOCK_MONOTONIC ns, 0 if it never happened */
+	uint64_t t[DJ_TRACE_EV_CT];
+	uint32_t block;
+	/* which transfer it belongs to, when several share a trace */
+	uint16_t chan;
+	uint8_t attempt;
+	bool recv;
+	/* acked (send) or accepted and acked (recv) */
+	bool ok;
+};
+
+struct dj_trace {
+	struct dj_trace_rec *recs;
+	size_t ct, cap;
+	/* bytes per block, to turn blocks into offsets and byte counts */
+	size_t data_len;
+};
+
+void dj_trace_init(struct dj_trace *t, size_t data_len);
+void dj_trace_destroy(struct dj_trace *t);
+
+/* start a new record, which stays valid until the next call */
+struct dj_trace_rec *dj_trace_begin(struct dj_trace *t, unsigned chan, bool recv,
+		size_t block, unsigned attempt, uint64_t now);
+
+/* latency percentiles for each step and the effective data rate */
+void dj_trace_report(const struct dj_trace *t, FILE *out);
+
+/* one JSON object per record, times in ns from the first record */
+void dj_trace_write_jsonl(const struct dj_trace *t, FILE *out);
+/* Chrome's trace event format (chrome://tracing, Perfetto) */
+void dj_trace_write_chrome(const struct dj_trace *t, FILE *out);
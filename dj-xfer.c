@@ -0,0 +1,548 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dj-xfer.h"
+#include "print.h"
+
+#define MS(x) ((uint64_t)(x) * 1000000)
+
+static void
+__attribute__((format(printf, 1, 2)))
+check_printf(const char *fmt, ...)
+{
+	(void)fmt;
+}
+
+#ifdef DEBUG_SEND
+#define debug_send(...) fprintf(stderr, "SEND: " __VA_ARGS__)
+#else
+#define debug_send(...) check_printf(__VA_ARGS__)
+#endif
+
+#ifdef DEBUG_RECV
+#define debug_recv(...) fprintf(stderr, "RECV: " __VA_ARGS__)
+#else
+#define debug_recv(...) check_printf(__VA_ARGS__)
+#endif
+
+static void
+xfer_init(struct dj_xfer *x, const struct dj_parms *p, enum dj_xfer_dir dir)
+{
+	*x = (struct dj_xfer){
+		.p = p,
+		.dir = dir,
+		.deadline = UINT64_MAX,
+		.echo_timeout_ns = MS(200),
+		.ack_timeout_ns = MS(100),
+		.pkt_timeout_ns = MS(100),
+		.retry_backoff_ns = MS(50),
+	};
+}
+
+static bool
+have_block(const struct dj_xfer *x, size_t block)
+{
+	return x->coverage && (x->coverage[block / 8] & (1 << (block % 8)));
+}
+
+static void
+trace_begin(struct dj_xfer *x, uint64_t now)
+{
+	if (!x->trace)
+		return;
+	dj_trace_begin(x->trace, x->trace_chan, x->dir == DJ_XFER_RECV, x->block,
+			x->attempt, now);
+	x->trace_cur = x->trace->ct;
+}
+
+static struct dj_trace_rec *
+trace_rec(struct dj_xfer *x)
+{
+	return x->trace_cur ? &x->trace->recs[x->trace_cur - 1] : NULL;
+}
+
+static void
+trace_mark(struct dj_xfer *x, enum dj_trace_ev ev, uint64_t now)
+{
+	struct dj_trace_rec *r = trace_rec(x);
+	if (r)
+		r->t[ev] = now;
+}
+
+static void
+xfer_fail(struct dj_xfer *x)
+{
+	x->phase = DJ_PHASE_FAILED;
+	x->deadline = UINT64_MAX;
+}
+
+static void
+xfer_tx(struct dj_xfer *x, const char *buf, size_t len)
+{
+	x->tx = buf;
+	x->tx_len = len;
+	x->tx_pos = 0;
+	x->echo_pos = 0;
+	x->echo_bad = false;
+	x->phase = DJ_PHASE_TX;
+	/* the echo deadline starts once everything has been written */
+	x->deadline = UINT64_MAX;
+}
+
+static void
+encode_block(const struct dj_parms *p, const uint8_t *image, size_t block, char *pkt)
+{
+	pkt_encode(p, block * p->data_len, image + block * p->data_len, pkt);
+
+	struct dj_pkt p_dec;
+	if (pkt_decode(p, &p_dec, pkt) < 0) {
+		fprintf(stderr, "E: could not decode a packet I generated: ");
+		print_bytes_as_cstring(pkt, p->pkt_len, stderr);
+		putc('\n', stderr);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!pkt_is_ok(p, &p_dec)) {
+		fprintf(stderr, "E: a packet I generated was bad\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void dj_xfer_encode(const struct dj_parms *p, const uint8_t *image, size_t image_len,
+		char *pkts)
+{
+	size_t i;
+	for (i = 0; i < image_len / p->data_len; i++)
+		encode_block(p, image, i, pkts + i * p->pkt_len);
+}
+
+static void
+send_block(struct dj_xfer *x)
+{
+	if (x->plan_pos == x->plan_len) {
+		fprintf(stderr, "I: done\n");
+		x->phase = DJ_PHASE_DONE;
+		x->deadline = UINT64_MAX;
+		return;
+	}
+
+	x->block = x->plan ? x->plan[x->plan_pos] : x->plan_pos;
+	xfer_tx(x, x->pkts + x->block * x->p->pkt_len, x->p->pkt_len);
+}
+
+static void
+send_next(struct dj_xfer *x)
+{
+	x->plan_pos++;
+	x->attempt = 0;
+	send_block(x);
+}
+
+static void
+send_init(struct dj_xfer *x, const struct dj_parms *p,
+		const uint8_t *image, size_t image_len, const char *pkts,
+		const size_t *plan, size_t plan_len)
+{
+	xfer_init(x, p, DJ_XFER_SEND);
+	x->image = image;
+	x->image_len = image_len;
+	x->pkts = pkts;
+	x->plan = plan;
+	x->plan_len = plan_len;
+	x->failed = malloc(plan_len * sizeof(*x->failed) + 1);
+	if (!x->failed) {
+		fprintf(stderr, "E: could not allocate failed block list\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!pkts) {
+		/* only the blocks in the plan are needed */
+		x->own_pkts = malloc(image_len / p->data_len * p->pkt_len + 1);
+		if (!x->own_pkts) {
+			fprintf(stderr, "E: could not allocate packets\n");
+			exit(EXIT_FAILURE);
+		}
+
+		size_t i;
+		for (i = 0; i < plan_len; i++) {
+			size_t b = plan ? plan[i] : i;
+			encode_block(p, image, b, x->own_pkts + b * p->pkt_len);
+		}
+		x->pkts = x->own_pkts;
+	}
+
+	send_block(x);
+}
+
+void dj_xfer_init_send_blocks(struct dj_xfer *x, const struct dj_parms *p,
+		const uint8_t *image, size_t image_len,
+		const size_t *plan, size_t plan_len, uint64_t now)
+{
+	(void)now;
+	send_init(x, p, image, image_len, NULL, plan, plan_len);
+}
+
+void dj_xfer_init_send_pkts(struct dj_xfer *x, const struct dj_parms *p,
+		const uint8_t *image, size_t image_len, const char *pkts,
+		uint64_t now)
+{
+	(void)now;
+	send_init(x, p, image, image_len, pkts, NULL, image_len / p->data_len);
+}
+
+void dj_xfer_init_send(struct dj_xfer *x, const struct dj_parms *p,
+		const uint8_t *image, size_t image_len, uint64_t now)
+{
+	dj_xfer_init_send_blocks(x, p, image, image_len, NULL, image_len / p->data_len, now);
+}
+
+void dj_xfer_init_recv(struct dj_xfer *x, const struct dj_parms *p,
+		uint8_t *data, uint64_t now)
+{
+	(void)now;
+	xfer_init(x, p, DJ_XFER_RECV);
+	x->data = data;
+	x->phase = DJ_PHASE_IDLE;
+}
+
+void dj_xfer_init_recv_missing(struct dj_xfer *x, const struct dj_parms *p,
+		uint8_t *data, uint8_t *coverage, uint64_t now)
+{
+	dj_xfer_init_recv(x, p, data, now);
+	x->coverage = coverage;
+
+	size_t i, blocks = dj_blocks(p);
+	for (i = 0; i < blocks; i++)
+		x->missing += !have_block(x, i);
+}
+
+void dj_xfer_destroy(struct dj_xfer *x)
+{
+	free(x->failed);
+	x->failed = NULL;
+	free(x->own_pkts);
+	x->own_pkts = NULL;
+}
+
+size_t dj_xfer_pending(const struct dj_xfer *x, const char **out)
+{
+	if (x->phase != DJ_PHASE_TX)
+		return 0;
+
+	*out = x->tx + x->tx_pos;
+	return x->tx_len - x->tx_pos;
+}
+
+void dj_xfer_wrote(struct dj_xfer *x, size_t len, uint64_t now)
+{
+	/* a received packet's record starts when its first byte arrives */
+	if (!x->tx_pos && x->dir == DJ_XFER_SEND)
+		trace_begin(x, now);
+
+	x->tx_pos += len;
+	if (x->tx_pos == x->tx_len) {
+		debug_send("I: sent %zu bytes\n", x->tx_len);
+		trace_mark(x, DJ_TRACE_WRITTEN, now);
+		x->deadline = now + x->echo_timeout_ns;
+	}
+}
+
+/* everything we wrote has been echoed back */
+static void
+tx_done(struct dj_xfer *x, uint64_t now)
+{
+	trace_mark(x, DJ_TRACE_ECHOED, now);
+
+	switch (x->dir) {
+	case DJ_XFER_SEND:
+		x->phase = DJ_PHASE_ACK;
+		x->rx_len = 0;
+		x->ack_bad = false;
+		x->deadline = now + x->ack_timeout_ns;
+		break;
+	case DJ_XFER_RECV:
+		if (x->coverage && !have_block(x, x->block)) {
+			x->coverage[x->block / 8] |= 1 << (x->block % 8);
+			x->missing--;
+		}
+		x->block++;
+		x->blocks++;
+		x->rx_len = 0;
+		x->phase = DJ_PHASE_IDLE;
+		x->deadline = UINT64_MAX;
+
+		if (x->coverage && !x->missing) {
+			fprintf(stderr, "I: all blocks received\n");
+			x->phase = DJ_PHASE_DONE;
+		} else if (x->block >= dj_blocks(x->p)) {
+			if (x->coverage && x->multi_pass) {
+				fprintf(stderr, "W: clone pass ended with %zu blocks missing, "
+						"waiting for the radio to send again\n", x->missing);
+				x->block = 0;
+			} else
+				x->phase = DJ_PHASE_DONE;
+		}
+		break;
+	}
+}
+
+/* retry_backoff_ns doubled for each attempt so far, without overflowing */
+static uint64_t
+backoff(const struct dj_xfer *x)
+{
+	uint64_t b = x->retry_backoff_ns;
+	unsigned i;
+	for (i = 0; i < x->attempt && b < DJ_XFER_MAX_BACKOFF_NS; i++)
+		b *= 2;
+	return b < DJ_XFER_MAX_BACKOFF_NS ? b : DJ_XFER_MAX_BACKOFF_NS;
+}
+
+/* the current block didn't get through: back off and re-send it, or give up
+ * on it */
+static void
+retry_block(struct dj_xfer *x, uint64_t now)
+{
+	if (x->attempt < x->retries) {
+		x->phase = DJ_PHASE_BACKOFF;
+		x->deadline = now + backoff(x);
+		x->attempt++;
+		x->retried++;
+		return;
+	}
+
+	x->failed[x->failed_ct++] = x->block;
+	if (x->stop_on_unacked) {
+		xfer_fail(x);
+		return;
+	}
+
+	send_next(x);
+}
+
+static void
+ack_missing(struct dj_xfer *x, uint64_t now)
+{
+	fprintf(stderr, "W: offset %#04zx was not acked (attempt %u of %u), got: ",
+			x->block * x->p->data_len, x->attempt + 1, x->retries + 1);
+	print_bytes_as_cstring(x->rx, x->rx_len, stderr);
+	fprintf(stderr, "\nW: packet was: ");
+	print_bytes_as_cstring(x->tx, x->tx_len, stderr);
+	putc('\n', stderr);
+	x->unacked++;
+	retry_block(x, now);
+}
+
+/* send: the echo of a packet was wrong or short, so the radio may not have
+ * got it either */
+static void
+echo_bad(struct dj_xfer *x, uint64_t now)
+{
+	fprintf(stderr, "W: offset %#04zx echo-cancel data %s (attempt %u of %u)\n",
+			x->block * x->p->data_len,
+			x->echo_bad ? "is not equal to sent data" : "is short",
+			x->attempt + 1, x->retries + 1);
+	x->bad_echoes++;
+	retry_block(x, now);
+}
+
+/* a complete line (ending in '\r') has arrived while receiving */
+static void
+recv_pkt(struct dj_xfer *x, uint64_t now)
+{
+	trace_mark(x, DJ_TRACE_RECEIVED, now);
+
+	size_t len = x->rx_len;
+	x->rx_len = 0;
+	x->phase = DJ_PHASE_IDLE;
+	x->deadline = UINT64_MAX;
+
+	if (len != x->p->pkt_len) {
+		fprintf(stderr, "E: short read of %zu\n", len);
+		x->bad_pkts++;
+		return;
+	}
+
+	debug_recv("read_pkt\n");
+
+	struct dj_pkt pkt;
+	if (pkt_decode(x->p, &pkt, x->rx) < 0) {
+		fprintf(stderr, "E: decode failed, skipping packet\n");
+		x->bad_pkts++;
+		return;
+	}
+
+	debug_recv("pkt_decode\n");
+
+	if (!pkt_is_ok(x->p, &pkt)) {
+		fprintf(stderr, "W: skipping packet\n");
+		x->bad_pkts++;
+		return;
+	}
+
+	debug_recv("pkt_is_ok\n");
+
+	size_t i = x->block, off = i * x->p->data_len;
+	if (pkt.offset / x->p->data_len != i) {
+		if (pkt.offset > off) {
+			fprintf(stderr, "W: jump from %#04zx to %#04" PRIxFAST32 ", continuing\n", off, pkt.offset);
+		} else if (x->coverage) {
+			/* anything we already have is tracked, so nothing is lost */
+			fprintf(stderr, "W: jump back from %#04zx to %#04" PRIxFAST32 ", continuing\n", off, pkt.offset);
+		} else {
+			fprintf(stderr, "E: jump from %#04zx to %#04" PRIxFAST32 ", DATA WILL BE LOST\n", off, pkt.offset);
+		}
+		x->block = pkt.offset / x->p->data_len;
+	}
+
+	/* do something with the data we have, pkt_is_ok() only passes writes */
+	if (have_block(x, x->block)) {
+		debug_recv("already have %#04"PRIxFAST32"\n", pkt.offset);
+		x->skipped++;
+	} else {
+		debug_recv("writing to %#04"PRIxFAST32"\n", pkt.offset);
+		memcpy(x->data + pkt.offset, pkt.data, x->p->data_len);
+		debug_recv("wrote\n");
+	}
+
+	struct dj_trace_rec *r = trace_rec(x);
+	if (r) {
+		r->block = x->block;
+		r->ok = true;
+	}
+
+	xfer_tx(x, x->p->ack, strlen(x->p->ack));
+}
+
+void dj_xfer_input(struct dj_xfer *x, const char *buf, size_t len, uint64_t now)
+{
+	size_t ack_len = strlen(x->p->ack);
+	size_t i;
+	for (i = 0; i < len; i++) {
+		char c = buf[i];
+		switch (x->phase) {
+		case DJ_PHASE_IDLE:
+		case DJ_PHASE_PKT:
+			if (x->dir != DJ_XFER_RECV)
+				goto unexpected;
+
+			if (x->rx_len == x->p->pkt_len) {
+				fprintf(stderr, "E: no packet end in %zu bytes: ", x->rx_len);
+				print_bytes_as_cstring(x->rx, x->rx_len, stderr);
+				fprintf(stderr, ", flushing\n");
+				x->rx_len = 0;
+				x->bad_pkts++;
+			}
+
+			if (!x->rx_len)
+				trace_begin(x, now);
+
+			x->rx[x->rx_len++] = c;
+			if (c == x->p->end) {
+				recv_pkt(x, now);
+			} else {
+				x->phase = DJ_PHASE_PKT;
+				x->deadline = now + x->pkt_timeout_ns;
+			}
+			break;
+
+		case DJ_PHASE_TX:
+			/* a send whose echo went wrong soaks up everything (a late
+			 * ack from an earlier attempt, say) until the echo deadline,
+			 * then retries the block */
+			if (x->echo_bad)
+				break;
+
+			/* We're half-duplex, so do echo cancelation */
+			if (x->echo_pos == x->tx_pos || c != x->tx[x->echo_pos]) {
+				if (x->dir == DJ_XFER_SEND) {
+					x->echo_bad = true;
+					break;
+				}
+				fprintf(stderr, "E: echo-cancel data is not equal to sent data\n");
+				xfer_fail(x);
+				return;
+			}
+
+			x->echo_pos++;
+			if (x->echo_pos == x->tx_len)
+				tx_done(x, now);
+			break;
+
+		case DJ_PHASE_ACK:
+			if (x->rx_len == sizeof(x->rx)) {
+				x->ack_bad = true;
+				break;
+			}
+
+			x->rx[x->rx_len] = c;
+			x->rx_len++;
+			if (x->rx_len > ack_len || c != x->p->ack[x->rx_len - 1])
+				x->ack_bad = true;
+
+			/* a bad ack is left to soak up whatever else shows up until
+			 * the deadline, so it doesn't end up in the next echo */
+			if (!x->ack_bad && x->rx_len == ack_len) {
+				struct dj_trace_rec *r = trace_rec(x);
+				if (r) {
+					r->t[DJ_TRACE_ACKED] = now;
+					r->ok = true;
+				}
+				x->blocks++;
+				send_next(x);
+			}
+			break;
+
+		case DJ_PHASE_BACKOFF:
+			/* stray bytes from whatever went wrong, drop them */
+			break;
+
+		case DJ_PHASE_DONE:
+		case DJ_PHASE_FAILED:
+		unexpected:
+			fprintf(stderr, "W: unexpected data: ");
+			print_bytes_as_cstring(buf + i, len - i, stderr);
+			putc('\n', stderr);
+			return;
+		}
+	}
+}
+
+void dj_xfer_timeout(struct dj_xfer *x, uint64_t now)
+{
+	switch (x->phase) {
+	case DJ_PHASE_PKT:
+		fprintf(stderr, "W: timed out with data: ");
+		print_bytes_as_cstring(x->rx, x->rx_len, stderr);
+		fprintf(stderr, ", flushing\n");
+		x->rx_len = 0;
+		x->phase = DJ_PHASE_IDLE;
+		x->deadline = UINT64_MAX;
+		break;
+
+	case DJ_PHASE_TX:
+		if (x->dir == DJ_XFER_SEND) {
+			echo_bad(x, now);
+			break;
+		}
+		fprintf(stderr, "E: did not read enough echo-cancel data, got %zu out of %zu bytes\n",
+				x->echo_pos, x->tx_len);
+		xfer_fail(x);
+		break;
+
+	case DJ_PHASE_ACK:
+		ack_missing(x, now);
+		break;
+
+	case DJ_PHASE_BACKOFF:
+		send_block(x);
+		break;
+
+	case DJ_PHASE_IDLE:
+	case DJ_PHASE_DONE:
+	case DJ_PHASE_FAILED:
+		x->deadline = UINT64_MAX;
+		break;
+	}
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+/*
+ * Clone transfer state machine
+ *
+ * This does no I/O itself: the caller feeds it bytes read from the port
+ * (dj_xfer_input()), writes whatever it has pending (dj_xfer_pending() &
+ * dj_xfer_wrote()) and calls dj_xfer_timeout() once the current deadline
+ * passes. All times are CLOCK_MONOTONIC nanoseconds.
+ *
+ * Each phase advances as soon as the bytes it is waiting for arrive, the
+ * per-phase timeouts only come into play when the radio is slow or silent.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dj-proto.h"
+#include "dj-trace.h"
+
+enum dj_xfer_dir {
+	/* upload an image to the radio */
+	DJ_XFER_SEND,
+	/* download an image from the radio */
+	DJ_XFER_RECV,
+};
+
+enum dj_xfer_phase {
+	/* recv: waiting for a packet to start */
+	DJ_PHASE_IDLE,
+	/* recv: part of a packet has arrived */
+	DJ_PHASE_PKT,
+	/* writing a packet (send) or an ack (recv), and reading its echo */
+	DJ_PHASE_TX,
+	/* send: waiting for the radio to ack a packet */
+	DJ_PHASE_ACK,
+	/* send: waiting before re-sending a block that was not acked */
+	DJ_PHASE_BACKOFF,
+	DJ_PHASE_DONE,
+	DJ_PHASE_FAILED,
+};
+
+#define DJ_XFER_MAX_RETRIES 100
+#define DJ_XFER_MAX_BACKOFF_NS (5 * 1000000000ull)
+
+struct dj_xfer {
+	const struct dj_parms *p;
+	enum dj_xfer_dir dir;
+	enum dj_xfer_phase phase;
+
+	/* when dj_xfer_timeout() should be called, UINT64_MAX for never */
+	uint64_t deadline;
+
+	uint64_t echo_timeout_ns;
+	uint64_t ack_timeout_ns;
+	uint64_t pkt_timeout_ns;
+
+	/* send: the image being uploaded */
+	const uint8_t *image;
+	size_t image_len;
+
+	/* send: packets for every block of image (p->pkt_len bytes each),
+	 * from dj_xfer_encode(), may be shared between transfers */
+	const char *pkts;
+	/* send: pkts, if it was encoded by init rather than given to it */
+	char *own_pkts;
+
+	/* send: blocks to upload, in order. NULL to upload every block */
+	const size_t *plan;
+	size_t plan_len, plan_pos;
+
+	/* send: fail as soon as a block is not acked */
+	bool stop_on_unacked;
+
+	/* send: how many times (at most DJ_XFER_MAX_RETRIES) to re-send a block
+	 * that is not acked or whose echo is wrong or short, waiting retry_backoff_ns before the first retry and
+	 * doubling it each time, up to DJ_XFER_MAX_BACKOFF_NS */
+	unsigned retries;
+	uint64_t retry_backoff_ns;
+	unsigned attempt;
+
+	/* send: blocks that did not get through after all retries */
+	size_t *failed;
+	size_t failed_ct;
+
+	/* recv: where received data is placed, p->mem_size bytes */
+	uint8_t *data;
+
+	/* recv: optional bitmap, the bit for a block is set once it has been
+	 * received and acked (block n is bit n % 8 of byte n / 8). Blocks
+	 * that are already set are acked but not stored again */
+	uint8_t *coverage;
+	/* recv: blocks not yet set in coverage */
+	size_t missing;
+
+	/* recv: if a clone pass ends with blocks still missing, wait for the
+	 * radio to start another one rather than finishing */
+	bool multi_pass;
+
+	/* the block (offset / p->data_len) currently being transferred */
+	size_t block;
+
+	/* the packet or ack being written, which is also what the echo must be */
+	const char *tx;
+	size_t tx_len, tx_pos, echo_pos;
+	/* send: the echo didn't match, the block is retried once it times out */
+	bool echo_bad;
+
+	char rx[DJ_PKT_MAX];
+	size_t rx_len;
+	bool ack_bad;
+
+	/* optional, gets a record for each packet exchanged, tagged trace_chan */
+	struct dj_trace *trace;
+	unsigned trace_chan;
+	/* index + 1 of the current packet's record, 0 for none */
+	size_t trace_cur;
+
+	/* stats */
+	size_t blocks;
+	size_t unacked;
+	size_t bad_echoes;
+	size_t retried;
+	size_t bad_pkts;
+	size_t skipped;
+};
+
+/*
+ * Packets are encoded before the transfer starts (unless they are given, by
+ * dj_xfer_init_send_pkts()), so all the transfer does per packet is write it
+ * and compare the echo against it.
+ */
+void dj_xfer_init_send(struct dj_xfer *x, const struct dj_parms *p,
+		const uint8_t *image, size_t image_len, uint64_t now);
+/* upload only the @plan_len blocks listed in @plan */
+void dj_xfer_init_send_blocks(struct dj_xfer *x, const struct dj_parms *p,
+		const uint8_t *image, size_t image_len,
+		const size_t *plan, size_t plan_len, uint64_t now);
+/* upload every block using packets already made by dj_xfer_encode() */
+void dj_xfer_init_send_pkts(struct dj_xfer *x, const struct dj_parms *p,
+		const uint8_t *image, size_t image_len, const char *pkts,
+		uint64_t now);
+void dj_xfer_init_recv(struct dj_xfer *x, const struct dj_parms *p,
+		uint8_t *data, uint64_t now);
+/* receive only the blocks not yet set in @coverage, finishing once all are */
+void dj_xfer_init_recv_missing(struct dj_xfer *x, const struct dj_parms *p,
+		uint8_t *data, uint8_t *coverage, uint64_t now);
+void dj_xfer_destroy(struct dj_xfer *x);
+
+/* encode the packet for each of the @image_len / p->data_len blocks of @image */
+void dj_xfer_encode(const struct dj_parms *p, const uint8_t *image, size_t image_len,
+		char *pkts);
+
+/* bytes waiting to be written to the port, returns how many */
+size_t dj_xfer_pending(const struct dj_xfer *x, const char **out);
+/* @len of the pending bytes were written */
+void dj_xfer_wrote(struct dj_xfer *x, size_t len, uint64_t now);
+/* @len bytes were read from the port */
+void dj_xfer_input(struct dj_xfer *x, const char *buf, size_t len, uint64_t now);
+/* x->deadline has passed */
+void dj_xfer_timeout(struct dj_xfer *x, uint64_t now);
+
+static inline bool dj_xfer_finished(const struct dj_xfer *x)
+{
+	return x->phase == DJ_PHASE_DONE || x->phase == DJ_PHASE_FAILED;
+}
@@ -0,0 +1,655 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "fallback.h"
+
+enum {
+	/* conditions, each narrows the channels a rule applies to */
+	OP_NUMBER,
+	OP_RX,
+	OP_MOD,
+	OP_UNFIT,
+
+	/* actions */
+	OP_ROUND,
+	OP_SIMPLEX,
+	OP_SET_MOD,
+	OP_SET_RX_TONE,
+	OP_SET_TX_TONE,
+	OP_SET_POWER,
+	OP_TRUNCATE,
+	OP_DROP,
+};
+
+#define FB_ANY (FB_RX | FB_TX | FB_MOD | FB_TONE | FB_POWER | FB_NAME | FB_NUMBER)
+
+static const struct {
+	const char *name;
+	uint8_t what;
+} unfit_names[] = {
+	{ "rx", FB_RX },
+	{ "tx", FB_TX },
+	{ "mod", FB_MOD },
+	{ "tone", FB_TONE },
+	{ "power", FB_POWER },
+	{ "name", FB_NAME },
+	{ "number", FB_NUMBER },
+};
+
+/* decimal, so memory 010 is 10 rather than 8 */
+static bool
+parse_u64(const char *s, uint64_t *v)
+{
+	char *end;
+	if (*s < '0' || *s > '9')
+		return false;
+	errno = 0;
+	*v = strtoull(s, &end, 10);
+	return !*end && !errno;
+}
+
+/* "<digits>[.<digits>][k|M|G]", exactly a whole number of Hz */
+static bool
+parse_hz(const char *s, uint64_t *v)
+{
+	uint64_t whole = 0, frac = 0, frac_div = 1, mult = 1;
+	const char *c = s;
+	if (*c < '0' || *c > '9')
+		return false;
+	for (; *c >= '0' && *c <= '9'; c++) {
+		if (whole > (UINT64_MAX - 9) / 10)
+			return false;
+		whole = whole * 10 + (*c - '0');
+	}
+	if (*c == '.') {
+		for (c++; *c >= '0' && *c <= '9'; c++) {
+			if (frac_div > UINT64_MAX / 100)
+				return false;
+			frac = frac * 10 + (*c - '0');
+			frac_div *= 10;
+		}
+	}
+	switch (*c) {
+	case 'k':
+		mult = 1000;
+		c++;
+		break;
+	case 'M':
+		mult = 1000000;
+		c++;
+		break;
+	case 'G':
+		mult = 1000000000;
+		c++;
+		break;
+	}
+	if (*c || whole > UINT64_MAX / mult || frac * mult % frac_div)
+		return false;
+	*v = whole * mult + frac * mult / frac_div;
+	return true;
+}
+
+/* "<lo>-<hi>", or just "<n>" if @single */
+static bool
+parse_range(const char *s, bool hz, bool single, uint64_t *lo, uint64_t *hi)
+{
+	char buf[64];
+	const char *dash = strchr(s, '-');
+	if (!dash) {
+		if (!single)
+			return false;
+		dash = s + strlen(s);
+	}
+	if ((size_t)(dash - s) >= sizeof(buf))
+		return false;
+	memcpy(buf, s, dash - s);
+	buf[dash - s] = '\0';
+
+	if (!(hz ? parse_hz(buf, lo) : parse_u64(buf, lo)))
+		return false;
+	if (!*dash) {
+		*hi = *lo;
+		return true;
+	}
+	return (hz ? parse_hz(dash + 1, hi) : parse_u64(dash + 1, hi)) && *lo <= *hi;
+}
+
+static bool
+parse_name(const char *s, const char *const *names, size_t ct, uint64_t *v)
+{
+	size_t i;
+	/* 0 is "unknown", which can't be asked for */
+	for (i = 1; i < ct; i++) {
+		if (!strcasecmp(s, names[i])) {
+			*v = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static int
+push_op(struct fb_prog *p, size_t *cap, uint8_t op, uint8_t what, uint64_t a, uint64_t b)
+{
+	if (p->op_ct == *cap) {
+		*cap = *cap ? *cap * 2 : 64;
+		struct fb_op *n = realloc(p->ops, *cap * sizeof(*n));
+		if (!n)
+			return -1;
+		p->ops = n;
+	}
+	p->ops[p->op_ct++] = (struct fb_op){ .op = op, .what = what, .a = a, .b = b };
+	return 0;
+}
+
+/* the condition @tok, returns -1 if it isn't one */
+static int
+compile_cond(struct fb_prog *p, size_t *cap, struct fb_rule *r, char *tok)
+{
+	char *val = strchr(tok, '=');
+	if (val)
+		*val++ = '\0';
+
+	uint64_t a, b;
+	if (!strcmp(tok, "unfit")) {
+		if (!val)
+			return push_op(p, cap, OP_UNFIT, FB_ANY, 0, 0);
+		size_t i;
+		for (i = 0; i < sizeof(unfit_names) / sizeof(unfit_names[0]); i++)
+			if (!strcmp(val, unfit_names[i].name))
+				return push_op(p, cap, OP_UNFIT, unfit_names[i].what, 0, 0);
+		return -1;
+	}
+
+	if (!val)
+		return -1;
+	if (!strcmp(tok, "model")) {
+		if (r->model || !*val)
+			return -1;
+		r->model = strdup(val);
+		return r->model ? 0 : -1;
+	}
+	if (!strcmp(tok, "number") && parse_range(val, false, true, &a, &b))
+		return push_op(p, cap, OP_NUMBER, 0, a, b);
+	if (!strcmp(tok, "rx") && parse_range(val, true, false, &a, &b))
+		return push_op(p, cap, OP_RX, 0, a, b);
+	if (!strcmp(tok, "mod") && parse_name(val, chan_mod_names, chan_mod_ct, &a))
+		return push_op(p, cap, OP_MOD, 0, a, 0);
+	return -1;
+}
+
+/* the action starting at @tok, returns -1 if it isn't one */
+static int
+compile_action(struct fb_prog *p, size_t *cap, char *tok, char **save)
+{
+	static const struct {
+		const char *name;
+		uint8_t op;
+	} plain[] = {
+		{ "round", OP_ROUND },
+		{ "simplex", OP_SIMPLEX },
+		{ "truncate", OP_TRUNCATE },
+		{ "drop", OP_DROP },
+	};
+
+	size_t i;
+	for (i = 0; i < sizeof(plain) / sizeof(plain[0]); i++)
+		if (!strcmp(tok, plain[i].name))
+			return push_op(p, cap, plain[i].op, 0, 0, 0);
+
+	if (strcmp(tok, "set"))
+		return -1;
+
+	char *arg = strtok_r(NULL, " \t\r\n", save);
+	char *val = arg ? strchr(arg, '=') : NULL;
+	if (!val)
+		return -1;
+	*val++ = '\0';
+
+	uint64_t v;
+	if (!strcmp(arg, "mod") && parse_name(val, chan_mod_names, chan_mod_ct, &v))
+		return push_op(p, cap, OP_SET_MOD, 0, v, 0);
+	if (!strcmp(arg, "rx_tone") && parse_name(val, chan_tone_names, chan_tone_ct, &v))
+		return push_op(p, cap, OP_SET_RX_TONE, 0, v, 0);
+	if (!strcmp(arg, "tx_tone") && parse_name(val, chan_tone_names, chan_tone_ct, &v))
+		return push_op(p, cap, OP_SET_TX_TONE, 0, v, 0);
+	if (!strcmp(arg, "power") && parse_u64(val, &v) && v && v <= UINT8_MAX)
+		return push_op(p, cap, OP_SET_POWER, 0, v, 0);
+	return -1;
+}
+
+int fb_compile(struct fb_prog *p, const char *text, const char *name)
+{
+	*p = (struct fb_prog){ 0 };
+	char *copy = strdup(text);
+	if (!copy) {
+		fprintf(stderr, "E: out of memory\n");
+		return -1;
+	}
+
+	size_t op_cap = 0, rule_cap = 0, line_nr = 0;
+	int e = 0;
+	char *line, *line_save;
+	for (line = copy; line; line = line_save) {
+		line_save = strchr(line, '\n');
+		if (line_save)
+			*line_save++ = '\0';
+		line_nr++;
+
+		char *hash = strchr(line, '#');
+		if (hash)
+			*hash = '\0';
+
+		char *save, *tok = strtok_r(line, " \t\r", &save);
+		if (!tok)
+			continue;
+
+		if (p->rule_ct == rule_cap) {
+			rule_cap = rule_cap ? rule_cap * 2 : 16;
+			struct fb_rule *n = realloc(p->rules, rule_cap * sizeof(*n));
+			if (!n) {
+				fprintf(stderr, "E: out of memory\n");
+				e++;
+				break;
+			}
+			p->rules = n;
+		}
+
+		struct fb_rule *r = &p->rules[p->rule_ct++];
+		*r = (struct fb_rule){ .line = line_nr, .first = p->op_ct };
+
+		/* conditions until the action, which must end the line */
+		const char *why = NULL;
+		for (; tok; tok = strtok_r(NULL, " \t\r", &save)) {
+			size_t before = p->op_ct;
+			if (!compile_action(p, &op_cap, tok, &save)) {
+				if (strtok_r(NULL, " \t\r", &save))
+					why = "nothing may follow the action";
+				break;
+			}
+			p->op_ct = before;
+			if (compile_cond(p, &op_cap, r, tok)) {
+				why = "unknown condition or action";
+				break;
+			}
+		}
+		if (!tok && !why)
+			why = "no action";
+
+		if (why) {
+			fprintf(stderr, "E: %s:%zu: %s\n", name, line_nr, why);
+			e++;
+		}
+		r->op_ct = p->op_ct - r->first;
+	}
+
+	free(copy);
+	if (e) {
+		fb_destroy(p);
+		return -1;
+	}
+	return 0;
+}
+
+int fb_load(struct fb_prog *p, const char *path)
+{
+	FILE *in = fopen(path, "r");
+	if (!in) {
+		fprintf(stderr, "E: could not open rules '%s'\n", path);
+		return -1;
+	}
+
+	char *text = NULL;
+	size_t cap = 0;
+	ssize_t len = getdelim(&text, &cap, '\0', in);
+	bool bad = ferror(in);
+	fclose(in);
+	if (bad) {
+		fprintf(stderr, "E: error reading rules '%s'\n", path);
+		free(text);
+		return -1;
+	}
+
+	int r = fb_compile(p, len > 0 ? text : "", path);
+	free(text);
+	return r;
+}
+
+void fb_destroy(struct fb_prog *p)
+{
+	size_t i;
+	for (i = 0; i < p->rule_ct; i++)
+		free(p->rules[i].model);
+	free(p->rules);
+	free(p->ops);
+	*p = (struct fb_prog){ 0 };
+}
+
+void fb_report_init(struct fb_report *r)
+{
+	*r = (struct fb_report){ 0 };
+}
+
+void fb_report_destroy(struct fb_report *r)
+{
+	free(r->loss);
+	free(r->mask);
+	*r = (struct fb_report){ 0 };
+}
+
+static int
+lose(struct fb_report *r, size_t chan, uint32_t line, uint8_t what, uint64_t from, uint64_t to)
+{
+	if (r->ct == r->cap) {
+		size_t cap = r->cap ? r->cap * 2 : 256;
+		struct fb_loss *n = realloc(r->loss, cap * sizeof(*n));
+		if (!n)
+			return -1;
+		r->loss = n;
+		r->cap = cap;
+	}
+	r->loss[r->ct++] = (struct fb_loss){
+		.chan = chan, .line = line, .what = what, .from = from, .to = to,
+	};
+	return 0;
+}
+
+/* the bits of @what that channel @i of @t doesn't fit */
+static uint8_t
+unfit(const struct chan_caps *c, const struct chan_table *t, size_t i, uint8_t what)
+{
+	uint8_t u = 0;
+	if (what & FB_RX && !chan_freq_fits(&c->rx, t->rx_hz[i]))
+		u |= FB_RX;
+	if (what & FB_TX && !chan_freq_fits(&c->tx, t->tx_hz[i]))
+		u |= FB_TX;
+	if (what & FB_MOD && (!chan_enum_fits(c->mods, t->rx_mod[i])
+				|| !chan_enum_fits(c->mods, t->tx_mod[i])))
+		u |= FB_MOD;
+	if (what & FB_TONE && (!chan_enum_fits(c->rx_tones, t->rx_tone[i])
+				|| !chan_enum_fits(c->tx_tones, t->tx_tone[i])))
+		u |= FB_TONE;
+	if (what & FB_POWER && t->power[i] > c->power_levels)
+		u |= FB_POWER;
+	if (what & FB_NAME && t->name_len[i] > c->name_len)
+		u |= FB_NAME;
+	if (what & FB_NUMBER && (t->number[i] < c->first || t->number[i] - c->first >= c->count))
+		u |= FB_NUMBER;
+	return u;
+}
+
+/* the frequency @c has that is closest to @hz */
+static uint64_t
+nearest(const struct chan_freq_caps *c, uint64_t hz)
+{
+	uint64_t lo = c->min / c->step * c->step, hi = c->max / c->step * c->step;
+	if (lo < c->min)
+		lo += c->step;
+
+	uint64_t down = hz - hz % c->step;
+	uint64_t v = hz - down >= c->step - (hz - down) && down <= UINT64_MAX - c->step
+		? down + c->step : down;
+	return v < lo ? lo : v > hi ? hi : v;
+}
+
+/* run the condition @o over the channels still set in @mask */
+static void
+run_cond(const struct fb_op *o, const struct chan_caps *c, const struct chan_table *t,
+		uint8_t *mask)
+{
+	size_t i, n = t->ct;
+	switch (o->op) {
+	case OP_NUMBER:
+		for (i = 0; i < n; i++)
+			mask[i] &= t->number[i] >= o->a && t->number[i] <= o->b;
+		break;
+	case OP_RX:
+		for (i = 0; i < n; i++)
+			mask[i] &= t->rx_hz[i] >= o->a && t->rx_hz[i] <= o->b;
+		break;
+	case OP_MOD:
+		for (i = 0; i < n; i++)
+			mask[i] &= t->rx_mod[i] == o->a;
+		break;
+	case OP_UNFIT:
+		for (i = 0; i < n; i++)
+			if (mask[i])
+				mask[i] = unfit(c, t, i, o->what) != 0;
+		break;
+	}
+}
+
+/* set a uint8_t column's value for the channels in @mask, recording changes */
+static int
+set_col(uint8_t *col, uint8_t v, uint8_t what, uint32_t line, const uint8_t *mask,
+		size_t n, struct fb_report *r)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		if (!mask[i] || col[i] == v)
+			continue;
+		if (lose(r, i, line, what, col[i], v))
+			return -1;
+		col[i] = v;
+	}
+	return 0;
+}
+
+static int
+run_action(const struct fb_op *o, uint32_t line, const struct chan_caps *c,
+		struct chan_table *t, const uint8_t *mask, uint8_t *dropped, struct fb_report *r)
+{
+	size_t i, n = t->ct;
+	switch (o->op) {
+	case OP_ROUND:
+		for (i = 0; i < n; i++) {
+			if (!mask[i])
+				continue;
+			uint64_t rx = t->rx_hz[i] ? nearest(&c->rx, t->rx_hz[i]) : 0;
+			uint64_t tx = t->tx_hz[i] ? nearest(&c->tx, t->tx_hz[i]) : 0;
+			if (rx != t->rx_hz[i] && lose(r, i, line, FB_RX, t->rx_hz[i], rx))
+				return -1;
+			if (tx != t->tx_hz[i] && lose(r, i, line, FB_TX, t->tx_hz[i], tx))
+				return -1;
+			t->rx_hz[i] = rx;
+			t->tx_hz[i] = tx;
+		}
+		return 0;
+	case OP_SIMPLEX:
+		for (i = 0; i < n; i++) {
+			if (!mask[i] || t->tx_hz[i] == t->rx_hz[i])
+				continue;
+			if (lose(r, i, line, FB_TX, t->tx_hz[i], t->rx_hz[i]))
+				return -1;
+			t->tx_hz[i] = t->rx_hz[i];
+		}
+		return 0;
+	case OP_SET_MOD:
+		/* one loss for both, rx and tx almost always agree */
+		for (i = 0; i < n; i++) {
+			if (!mask[i] || (t->rx_mod[i] == o->a && t->tx_mod[i] == o->a))
+				continue;
+			uint8_t from = t->rx_mod[i] != o->a ? t->rx_mod[i] : t->tx_mod[i];
+			if (lose(r, i, line, FB_MOD, from, o->a))
+				return -1;
+			t->rx_mod[i] = o->a;
+			t->tx_mod[i] = o->a;
+		}
+		return 0;
+	case OP_SET_RX_TONE:
+		return set_col(t->rx_tone, o->a, FB_TONE, line, mask, n, r);
+	case OP_SET_TX_TONE:
+		return set_col(t->tx_tone, o->a, FB_TONE, line, mask, n, r);
+	case OP_SET_POWER:
+		return set_col(t->power, o->a, FB_POWER, line, mask, n, r);
+	case OP_TRUNCATE:
+		for (i = 0; i < n; i++) {
+			if (!mask[i] || t->name_len[i] <= c->name_len)
+				continue;
+			if (lose(r, i, line, FB_NAME, t->name_len[i], c->name_len))
+				return -1;
+			/* the table's names are its own after chan_table_copy() */
+			t->name_len[i] = c->name_len;
+			t->names[t->name_off[i] + c->name_len] = 0;
+		}
+		return 0;
+	case OP_DROP:
+		for (i = 0; i < n; i++) {
+			if (!mask[i])
+				continue;
+			if (lose(r, i, line, FB_DROPPED, 0, 0))
+				return -1;
+			dropped[i] = 1;
+			r->dropped++;
+		}
+		return 0;
+	}
+	return 0;
+}
+
+static bool
+model_is(const char *model, const char *want)
+{
+	size_t len = strlen(want);
+	return !strncmp(model, want, len) && (!model[len] || model[len] == '/');
+}
+
+int fb_apply(const struct fb_prog *p, const struct chan_caps *c,
+		const struct chan_table *in, struct chan_table *out, struct fb_report *r)
+{
+	r->ct = 0;
+	r->dropped = 0;
+	r->unfit = 0;
+	if (chan_table_copy(out, in))
+		return -1;
+
+	size_t n = in->ct;
+	/* never memset() a NULL mask, even for an empty table */
+	if (!r->mask || r->mask_cap < n * 2) {
+		free(r->mask);
+		r->mask = malloc(n * 2 + 1);
+		if (!r->mask) {
+			r->mask_cap = 0;
+			return -1;
+		}
+		r->mask_cap = n * 2;
+	}
+	uint8_t *mask = r->mask, *dropped = r->mask + n;
+	memset(dropped, 0, n);
+
+	size_t ri, i;
+	for (ri = 0; ri < p->rule_ct; ri++) {
+		const struct fb_rule *rule = &p->rules[ri];
+		if (rule->model && !model_is(c->model, rule->model))
+			continue;
+
+		for (i = 0; i < n; i++)
+			mask[i] = !dropped[i];
+
+		const struct fb_op *o = &p->ops[rule->first];
+		size_t k;
+		for (k = 0; k + 1 < rule->op_ct; k++)
+			run_cond(&o[k], c, out, mask);
+		if (run_action(&o[k], rule->line, c, out, mask, dropped, r))
+			return -1;
+	}
+
+	/* whatever the rules didn't fix won't be stored as it is */
+	for (i = 0; i < n; i++) {
+		if (dropped[i])
+			continue;
+		uint8_t u = unfit(c, out, i, FB_ANY);
+		if (!u)
+			continue;
+		r->unfit++;
+
+		uint8_t bit;
+		for (bit = 1; bit < FB_DROPPED; bit <<= 1) {
+			if (!(u & bit))
+				continue;
+			uint64_t v = bit == FB_RX ? out->rx_hz[i]
+				: bit == FB_TX ? out->tx_hz[i]
+				: bit == FB_MOD ? (chan_enum_fits(c->mods, out->rx_mod[i])
+						? out->tx_mod[i] : out->rx_mod[i])
+				: bit == FB_TONE ? (chan_enum_fits(c->rx_tones, out->rx_tone[i])
+						? out->tx_tone[i] : out->rx_tone[i])
+				: bit == FB_POWER ? out->power[i]
+				: bit == FB_NAME ? out->name_len[i]
+				: out->number[i];
+			if (lose(r, i, 0, bit, v, v))
+				return -1;
+		}
+	}
+
+	for (i = 0; i < n; i++)
+		mask[i] = !dropped[i];
+	chan_table_keep(out, mask);
+	return 0;
+}
+
+static void
+print_value(FILE *out, uint8_t what, uint64_t v)
+{
+	switch (what) {
+	case FB_RX:
+	case FB_TX:
+		fprintf(out, "%" PRIu64 " Hz", v);
+		break;
+	case FB_MOD:
+		fprintf(out, "%s", v < chan_mod_ct ? chan_mod_names[v] : "?");
+		break;
+	case FB_TONE:
+		fprintf(out, "%s", v < chan_tone_ct ? chan_tone_names[v] : "?");
+		break;
+	default:
+		fprintf(out, "%" PRIu64, v);
+		break;
+	}
+}
+
+static const char *
+what_name(uint8_t what)
+{
+	size_t i;
+	for (i = 0; i < sizeof(unfit_names) / sizeof(unfit_names[0]); i++)
+		if (unfit_names[i].what == what)
+			return unfit_names[i].name;
+	return "?";
+}
+
+void fb_report_print(const struct fb_report *r, const struct chan_caps *c,
+		const struct chan_table *in, FILE *out)
+{
+	size_t i;
+	for (i = 0; i < r->ct; i++) {
+		const struct fb_loss *l = &r->loss[i];
+		fprintf(out, "%s: %s memory %" PRIu32 ": ", l->line ? "W" : "E",
+				c->model, in->number[l->chan]);
+
+		if (l->what == FB_DROPPED) {
+			fprintf(out, "dropped (line %" PRIu32 ")\n", l->line);
+			continue;
+		}
+
+		if (l->what == FB_NAME)
+			fprintf(out, "name '%s' length ", chan_name(in, l->chan));
+		else
+			fprintf(out, "%s ", what_name(l->what));
+
+		if (!l->line) {
+			fprintf(out, "can't be held as ");
+			print_value(out, l->what, l->from);
+			fprintf(out, ", no rule fixed it\n");
+			continue;
+		}
+
+		print_value(out, l->what, l->from);
+		fprintf(out, " -> ");
+		print_value(out, l->what, l->to);
+		fprintf(out, " (line %" PRIu32 ")\n", l->line);
+	}
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+/*
+ * Fallback rules: what to do when a radio can't hold a channel as it is (see
+ * "Shared parts" in DESIGN). Rules are text, one per line:
+ *
+ *   [<condition>...] <action>
+ *
+ * and every rule whose conditions all hold is applied, in order, so later
+ * rules see what earlier ones did. A user's own file, model= and number=
+ * give the per-user, per-model and per-entry rules DESIGN asks for.
+ *
+ * Conditions:
+ *   model=<model>        the target is <model> (or a variant of it)
+ *   number=<n>[-<m>]     the channel's memory number
+ *   rx=<lo>-<hi>         its rx frequency, in Hz with optional k/M/G suffix
+ *                        (rx=144M-148M)
+ *   mod=<mod>            its rx modulation (FM, NFM, AM, ...)
+ *   unfit[=<what>]       the target can't hold its <what>: rx, tx, mod,
+ *                        tone, power, name or number (any of them, without
+ *                        <what>)
+ *
+ * Actions:
+ *   round                move rx and tx to the closest frequency the target
+ *                        has
+ *   simplex              transmit on the rx frequency
+ *   set mod=<mod>        set rx and tx modulation
+ *   set rx_tone=<kind>   set the unsquelch kind (none, ctcss, dcs, dcs-inv)
+ *   set tx_tone=<kind>
+ *   set power=<n>
+ *   truncate             cut the name to what the target holds
+ *   drop                 leave the channel out
+ *
+ * '#' starts a comment.
+ *
+ * Rules are compiled once into a short program of ops per rule. Applying it
+ * to a target first skips the rules whose model= doesn't match, then runs
+ * each remaining op over a whole column at a time (narrowing a mask of the
+ * channels the rule applies to), rather than interpreting rules per channel.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chan.h"
+
+struct fb_op {
+	uint8_t op;
+	uint8_t what;
+	uint64_t a, b;
+};
+
+struct fb_rule {
+	/* of the rule's text, for reports */
+	uint32_t line;
+	/* NULL for any */
+	char *model;
+	/* ops[first] .. ops[first + op_ct - 1], the last being the action */
+	size_t first, op_ct;
+};
+
+struct fb_prog {
+	struct fb_rule *rules;
+	size_t rule_ct;
+	struct fb_op *ops;
+	size_t op_ct;
+};
+
+/*
+ * Compile the rules in @text (@name, for errors). Returns 0 on success, -1
+ * (after printing each bad line) on failure.
+ */
+int fb_compile(struct fb_prog *p, const char *text, const char *name);
+/* fb_compile() the contents of @path */
+int fb_load(struct fb_prog *p, const char *path);
+void fb_destroy(struct fb_prog *p);
+
+/* what a loss was to, as bits of fb_loss.what */
+#define FB_RX (1 << 0)
+#define FB_TX (1 << 1)
+#define FB_MOD (1 << 2)
+#define FB_TONE (1 << 3)
+#define FB_POWER (1 << 4)
+#define FB_NAME (1 << 5)
+#define FB_NUMBER (1 << 6)
+/* the channel was dropped */
+#define FB_DROPPED (1 << 7)
+
+struct fb_loss {
+	/* the channel's index in the input table */
+	uint32_t chan;
+	/* the rule that made the change, 0 if no rule fixed what the target
+	 * can't hold (so chan_encode() will refuse it) */
+	uint32_t line;
+	uint8_t what;
+	/* the value before and after, name lengths for FB_NAME */
+	uint64_t from, to;
+};
+
+struct fb_report {
+	struct fb_loss *loss;
+	size_t ct, cap;
+
+	/* channels dropped, and channels left with something that won't fit */
+	size_t dropped;
+	size_t unfit;
+
+	/* per channel scratch for fb_apply() */
+	uint8_t *mask;
+	size_t mask_cap;
+};
+
+void fb_report_init(struct fb_report *r);
+void fb_report_destroy(struct fb_report *r);
+
+/*
+ * Convert @in's channels for the radio described by @c, into @out. Every
+ * change a rule makes and everything left that @c can't hold is recorded in
+ * @r (which is reset first, and can be reused across calls).
+ *
+ * Returns 0 on success, -1 if memory ran out.
+ */
+int fb_apply(const struct fb_prog *p, const struct chan_caps *c,
+		const struct chan_table *in, struct chan_table *out, struct fb_report *r);
+
+/* print each loss in @r as a W: (changed by a rule) or E: (not fixed) line */
+void fb_report_print(const struct fb_report *r, const struct chan_caps *c,
+		const struct chan_table *in, FILE *out);
@@ -0,0 +1,766 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fingerprint.h"
+
+/* windows with fewer distinct byte values (mostly blank fill) are too common to learn */
+#define MIN_DISTINCT 3
+#define HASH_MUL 0x9e3779b97f4a7c15
+
+static void
+put_le32(uint8_t *p, uint32_t v)
+{
+	size_t i;
+	for (i = 0; i < 4; i++)
+		p[i] = v >> (i * 8);
+}
+
+static uint32_t
+get_le32(const uint8_t *p)
+{
+	uint32_t v = 0;
+	size_t i;
+	for (i = 0; i < 4; i++)
+		v |= (uint32_t)p[i] << (i * 8);
+	return v;
+}
+
+static void
+put_le64(uint8_t *p, uint64_t v)
+{
+	size_t i;
+	for (i = 0; i < 8; i++)
+		p[i] = v >> (i * 8);
+}
+
+static uint64_t
+get_le64(const uint8_t *p)
+{
+	uint64_t v = 0;
+	size_t i;
+	for (i = 0; i < 8; i++)
+		v |= (uint64_t)p[i] << (i * 8);
+	return v;
+}
+
+/* bounds checked reading of the serialized index */
+struct cursor {
+	const uint8_t *p, *end;
+	bool bad;
+};
+
+static const uint8_t *
+take(struct cursor *c, uint64_t len)
+{
+	if (c->bad || len > (size_t)(c->end - c->p)) {
+		c->bad = true;
+		return NULL;
+	}
+	const uint8_t *p = c->p;
+	c->p += len;
+	return p;
+}
+
+static uint32_t
+take_le32(struct cursor *c)
+{
+	const uint8_t *p = take(c, 4);
+	return p ? get_le32(p) : 0;
+}
+
+static uint64_t
+take_le64(struct cursor *c)
+{
+	const uint8_t *p = take(c, 8);
+	return p ? get_le64(p) : 0;
+}
+
+static const char *
+take_string(struct cursor *c)
+{
+	uint32_t len = take_le32(c);
+	const uint8_t *s = take(c, (uint64_t)len + 1);
+	if (!s || s[len]) {
+		c->bad = true;
+		return NULL;
+	}
+	return (const char *)s;
+}
+
+/*
+ * Polynomial hash of a window, h = sum(p[i] * HASH_MUL^(FP_WINDOW - 1 - i)),
+ * so it can also be rolled along an image a byte at a time.
+ */
+static uint64_t
+window_hash(const uint8_t *p)
+{
+	uint64_t h = 0;
+	size_t i;
+	for (i = 0; i < FP_WINDOW; i++)
+		h = h * HASH_MUL + p[i];
+	return h;
+}
+
+static size_t
+slot_of(const struct fp_index *ix, uint64_t h)
+{
+	/* the low bits of h only depend on the last few bytes */
+	return ((h ^ (h >> 29)) * 0xbf58476d1ce4e5b9) >> 32 & ix->slot_mask;
+}
+
+static int
+u32_cmp(const void *a_, const void *b_)
+{
+	uint32_t a = *(const uint32_t *)a_, b = *(const uint32_t *)b_;
+	return (a > b) - (a < b);
+}
+
+/* fill in everything else from ix->buf */
+static int
+parse(struct fp_index *ix, const char *what)
+{
+	struct cursor c = { .p = ix->buf, .end = ix->buf + ix->buf_len };
+	const uint8_t *magic = take(&c, 8);
+	if (!magic || memcmp(magic, FP_MAGIC, 8)) {
+		fprintf(stderr, "E: '%s' is not a fingerprint index\n", what);
+		return -1;
+	}
+
+	uint32_t window = take_le32(&c);
+	uint32_t class_ct = take_le32(&c);
+	if (!c.bad && window != FP_WINDOW) {
+		fprintf(stderr, "E: '%s' has %" PRIu32 " byte windows, expected %d\n",
+				what, window, FP_WINDOW);
+		return -1;
+	}
+
+	/* each class takes at least 17 bytes and each anchor 4 + FP_WINDOW */
+	size_t left = c.end - c.p;
+	if (!c.bad && class_ct > left / 17)
+		c.bad = true;
+	else {
+		ix->classes = calloc(class_ct ? class_ct : 1, sizeof(*ix->classes));
+		ix->anchors = calloc(left / (4 + FP_WINDOW) + 1, sizeof(*ix->anchors));
+		if (!ix->classes || !ix->anchors) {
+			fprintf(stderr, "E: out of memory\n");
+			return -1;
+		}
+	}
+
+	size_t i, j;
+	for (i = 0; !c.bad && i < class_ct; i++) {
+		struct fp_class *cl = &ix->classes[ix->class_ct++];
+		cl->label = take_string(&c);
+		cl->len = take_le64(&c);
+		cl->first = ix->anchor_ct;
+		cl->anchor_ct = take_le32(&c);
+		for (j = 0; !c.bad && j < cl->anchor_ct; j++) {
+			struct fp_anchor *a = &ix->anchors[ix->anchor_ct++];
+			a->offset = take_le32(&c);
+			a->class = i;
+			a->bytes = take(&c, FP_WINDOW);
+			if (!a->bytes || a->offset > cl->len || cl->len - a->offset < FP_WINDOW)
+				c.bad = true;
+			else
+				a->hash = window_hash(a->bytes);
+		}
+	}
+
+	if (c.bad || c.p != c.end) {
+		fprintf(stderr, "E: fingerprint index '%s' is truncated or corrupt\n", what);
+		return -1;
+	}
+
+	size_t slots = 16;
+	while (slots < ix->anchor_ct * 2)
+		slots *= 2;
+	ix->slot_mask = slots - 1;
+	ix->slots = calloc(slots, sizeof(*ix->slots));
+	ix->offsets = calloc(ix->anchor_ct + 1, sizeof(*ix->offsets));
+	ix->hits = calloc(ix->class_ct + 1, sizeof(*ix->hits));
+	ix->found = calloc(ix->anchor_ct / 64 + 1, sizeof(*ix->found));
+	if (!ix->slots || !ix->offsets || !ix->hits || !ix->found) {
+		fprintf(stderr, "E: out of memory\n");
+		return -1;
+	}
+
+	for (i = 0; i < ix->anchor_ct; i++) {
+		size_t s = slot_of(ix, ix->anchors[i].hash);
+		while (ix->slots[s])
+			s = (s + 1) & ix->slot_mask;
+		ix->slots[s] = i + 1;
+		ix->offsets[i] = ix->anchors[i].offset;
+	}
+
+	qsort(ix->offsets, ix->anchor_ct, sizeof(*ix->offsets), u32_cmp);
+	for (i = 0; i < ix->anchor_ct; i++)
+		if (!ix->offset_ct || ix->offsets[ix->offset_ct - 1] != ix->offsets[i])
+			ix->offsets[ix->offset_ct++] = ix->offsets[i];
+
+	return 0;
+}
+
+int fp_load(struct fp_index *ix, const char *path)
+{
+	memset(ix, 0, sizeof(*ix));
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "E: could not open fingerprint index '%s': %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		fprintf(stderr, "E: could not stat fingerprint index '%s': %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	ix->buf_len = st.st_size;
+	if (ix->buf_len) {
+		ix->map = mmap(NULL, ix->buf_len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (ix->map == MAP_FAILED) {
+			fprintf(stderr, "E: could not map fingerprint index '%s': %s\n", path, strerror(errno));
+			ix->map = NULL;
+			close(fd);
+			return -1;
+		}
+		ix->buf = ix->map;
+	}
+	close(fd);
+
+	if (parse(ix, path)) {
+		fp_destroy(ix);
+		return -1;
+	}
+	return 0;
+}
+
+int fp_save(const struct fp_index *ix, const char *path)
+{
+	char *tmp_path;
+	if (asprintf(&tmp_path, "%s.tmp", path) < 0) {
+		fprintf(stderr, "E: out of memory\n");
+		return -1;
+	}
+
+	int r = 0;
+	FILE *f = fopen(tmp_path, "wb");
+	if (!f) {
+		fprintf(stderr, "E: could not create '%s': %s\n", tmp_path, strerror(errno));
+		r = -1;
+	} else if ((fwrite(ix->buf, 1, ix->buf_len, f) != ix->buf_len) | fclose(f)) {
+		fprintf(stderr, "E: could not write '%s'\n", tmp_path);
+		unlink(tmp_path);
+		r = -1;
+	} else if (rename(tmp_path, path)) {
+		fprintf(stderr, "E: could not replace '%s': %s\n", path, strerror(errno));
+		unlink(tmp_path);
+		r = -1;
+	}
+
+	free(tmp_path);
+	return r;
+}
+
+void fp_destroy(struct fp_index *ix)
+{
+	free(ix->classes);
+	free(ix->anchors);
+	free(ix->offsets);
+	free(ix->slots);
+	free(ix->hits);
+	free(ix->found);
+	if (ix->map)
+		munmap(ix->map, ix->buf_len);
+	else
+		free(ix->buf);
+	memset(ix, 0, sizeof(*ix));
+}
+
+/*
+ * The best kind by the fraction of its anchors in ix->hits, only considering
+ * kinds of @len bytes unless @len is 0.
+ */
+/* the model part (before any '/') of @a's and @b's labels is the same */
+static bool
+same_model(const struct fp_class *a, const struct fp_class *b)
+{
+	size_t n = strcspn(a->label, "/");
+	return n == strcspn(b->label, "/") && !strncmp(a->label, b->label, n);
+}
+
+static void
+best_class(const struct fp_index *ix, size_t len, struct fp_result *r)
+{
+	size_t i;
+	for (i = 0; i < ix->class_ct; i++) {
+		const struct fp_class *cl = &ix->classes[i];
+		uint32_t h = ix->hits[i];
+		if (!h || (len && cl->len != len))
+			continue;
+
+		if (r->best) {
+			/* compare h / cl->anchor_ct with r->hits / r->best->anchor_ct */
+			uint64_t a = (uint64_t)h * r->best->anchor_ct;
+			uint64_t b = (uint64_t)r->hits * cl->anchor_ct;
+			if (a < b)
+				continue;
+			if (a == b) {
+				if (!r->tie || same_model(r->tie, r->best))
+					r->tie = cl;
+				continue;
+			}
+		}
+
+		r->best = cl;
+		r->tie = NULL;
+		r->hits = h;
+	}
+}
+
+void fp_classify(struct fp_index *ix, const uint8_t *data, size_t len,
+		struct fp_result *r)
+{
+	memset(r, 0, sizeof(*r));
+	memset(ix->hits, 0, ix->class_ct * sizeof(*ix->hits));
+
+	/* hash the image where anchors are, and count the anchors that are there */
+	size_t i, s;
+	for (i = 0; i < ix->offset_ct && ix->offsets[i] + FP_WINDOW <= len; i++) {
+		uint32_t off = ix->offsets[i];
+		const uint8_t *w = data + off;
+		uint64_t h = window_hash(w);
+		for (s = slot_of(ix, h); ix->slots[s]; s = (s + 1) & ix->slot_mask) {
+			const struct fp_anchor *a = &ix->anchors[ix->slots[s] - 1];
+			if (a->hash == h && a->offset == off && !memcmp(a->bytes, w, FP_WINDOW))
+				ix->hits[a->class]++;
+		}
+	}
+
+	best_class(ix, len, r);
+	if (r->best && r->hits * 2 > r->best->anchor_ct
+			&& (!r->tie || same_model(r->tie, r->best))) {
+		r->identified = true;
+		r->model_only = r->tie != NULL;
+		return;
+	}
+
+	/* no luck in place, so look for the anchors anywhere */
+	if (len < FP_WINDOW)
+		return;
+
+	memset(ix->found, 0, (ix->anchor_ct / 64 + 1) * sizeof(*ix->found));
+	uint64_t top = 1;
+	for (i = 1; i < FP_WINDOW; i++)
+		top *= HASH_MUL;
+
+	uint64_t h = window_hash(data);
+	for (i = 0;; i++) {
+		for (s = slot_of(ix, h); ix->slots[s]; s = (s + 1) & ix->slot_mask) {
+			size_t k = ix->slots[s] - 1;
+			const struct fp_anchor *a = &ix->anchors[k];
+			if (a->hash == h && !memcmp(a->bytes, data + i, FP_WINDOW))
+				ix->found[k / 64] |= (uint64_t)1 << (k % 64);
+		}
+		if (i + FP_WINDOW == len)
+			break;
+		h = (h - data[i] * top) * HASH_MUL + data[i + FP_WINDOW];
+	}
+
+	/* a kind only counts if every one of its anchors turned up */
+	for (i = 0; i < ix->class_ct; i++) {
+		const struct fp_class *cl = &ix->classes[i];
+		size_t k, n = 0;
+		for (k = cl->first; k < cl->first + cl->anchor_ct; k++)
+			n += ix->found[k / 64] >> (k % 64) & 1;
+		ix->hits[i] = n == cl->anchor_ct ? n : 0;
+	}
+
+	struct fp_result moved = { 0 };
+	best_class(ix, 0, &moved);
+	if (moved.best && !moved.tie) {
+		*r = moved;
+		r->shifted = true;
+	}
+}
+
+bool fp_label_is(const char *label, const char *model)
+{
+	size_t n = strlen(model);
+	return !strncmp(label, model, n) && (label[n] == '\0' || label[n] == '/');
+}
+
+/* learning */
+
+struct buf {
+	uint8_t *p;
+	size_t len, cap;
+	bool oom;
+};
+
+static void
+put(struct buf *b, const void *data, size_t len)
+{
+	if (b->oom)
+		return;
+	if (b->cap - b->len < len) {
+		size_t cap = b->cap ? b->cap : 4096;
+		while (cap - b->len < len)
+			cap *= 2;
+		uint8_t *p = realloc(b->p, cap);
+		if (!p) {
+			b->oom = true;
+			return;
+		}
+		b->p = p;
+		b->cap = cap;
+	}
+	memcpy(b->p + b->len, data, len);
+	b->len += len;
+}
+
+static void
+put32(struct buf *b, uint32_t v)
+{
+	uint8_t d[4];
+	put_le32(d, v);
+	put(b, d, sizeof(d));
+}
+
+static void
+put64(struct buf *b, uint64_t v)
+{
+	uint8_t d[8];
+	put_le64(d, v);
+	put(b, d, sizeof(d));
+}
+
+struct learn_class {
+	const char *label;
+	size_t len;
+	/* the class's samples are order[first] .. order[first + ct - 1] */
+	size_t first, ct;
+	/* windows picked as anchors, by index */
+	uint32_t *picked;
+	size_t picked_ct;
+};
+
+struct entry {
+	uint64_t hash;
+	uint32_t class;
+};
+
+/* a window that could be one of a class's anchors */
+struct cand {
+	uint32_t k;
+	/* the entries in row k with the same hash: the classes that have it */
+	const struct entry *run;
+	size_t run_len;
+	bool used;
+};
+
+static int
+sample_cmp(const void *a_, const void *b_)
+{
+	const struct fp_sample *a = *(const struct fp_sample **)a_;
+	const struct fp_sample *b = *(const struct fp_sample **)b_;
+	int r = strcmp(a->label, b->label);
+	if (r)
+		return r;
+	return (a->len > b->len) - (a->len < b->len);
+}
+
+static int
+class_cmp(const void *a_, const void *b_)
+{
+	const struct learn_class *a = a_, *b = b_;
+	if (a->len != b->len)
+		return (a->len > b->len) - (a->len < b->len);
+	return strcmp(a->label, b->label);
+}
+
+static int
+entry_cmp(const void *a_, const void *b_)
+{
+	const struct entry *a = a_, *b = b_;
+	if (a->hash != b->hash)
+		return (a->hash > b->hash) - (a->hash < b->hash);
+	return (a->class > b->class) - (a->class < b->class);
+}
+
+static size_t
+distinct_bytes(const uint8_t *p)
+{
+	uint8_t seen[256 / 8] = { 0 };
+	size_t i, n = 0;
+	for (i = 0; i < FP_WINDOW; i++) {
+		n += !(seen[p[i] / 8] >> (p[i] % 8) & 1);
+		seen[p[i] / 8] |= 1 << (p[i] % 8);
+	}
+	return n;
+}
+
+/* how much telling apart a class that @cover picks already do is worth */
+static uint32_t
+weight(uint32_t cover, bool more)
+{
+	return more ? !cover : FP_ANCHORS - cover;
+}
+
+/*
+ * Pick the anchors of class @a of @cl[0 .. @ct-1], which all have the same
+ * image length. @rows holds every image's window hashes, sorted by row.
+ *
+ * This is a greedy set cover: each pick is the window that the most of the
+ * other classes' images don't have, weighting the classes told apart by the
+ * fewest picks so far most. Among equally good windows, the one furthest
+ * from the picks so far is taken, so once every class is told apart the rest
+ * are spread over the image. Past FP_ANCHORS picks, only windows that tell
+ * apart a class that no pick has yet are taken.
+ */
+static int
+pick_anchors(struct learn_class *cl, size_t ct, size_t a,
+		const struct fp_sample **order, const struct entry *rows,
+		const size_t *row_len, size_t m, size_t nwin,
+		struct cand *cands, uint32_t *cover)
+{
+	struct learn_class *c = &cl[a];
+	const uint8_t *rep = order[c->first]->data;
+	size_t i, j, k, cand_ct = 0;
+
+	for (k = 0; k < nwin; k++) {
+		const uint8_t *w = rep + k * FP_WINDOW;
+		for (j = 1; j < c->ct; j++)
+			if (memcmp(order[c->first + j]->data + k * FP_WINDOW, w, FP_WINDOW))
+				break;
+		if (j < c->ct || distinct_bytes(w) < MIN_DISTINCT)
+			continue;
+
+		/* this class is in the row, so the run is never empty */
+		const struct entry *row = rows + k * m;
+		uint64_t h = window_hash(w);
+		size_t lo = 0, hi = row_len[k];
+		while (lo < hi) {
+			size_t mid = (lo + hi) / 2;
+			if (row[mid].hash < h)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (hi = lo; hi < row_len[k] && row[hi].hash == h; hi++)
+			;
+
+		cands[cand_ct++] = (struct cand){ .k = k, .run = row + lo, .run_len = hi - lo };
+	}
+
+	if (!cand_ct) {
+		fprintf(stderr, "W: '%s' has no windows that are the same in all its images,"
+				" it can't be identified\n", c->label);
+		return 0;
+	}
+
+	c->picked = calloc(cand_ct, sizeof(*c->picked));
+	if (!c->picked) {
+		fprintf(stderr, "E: out of memory\n");
+		return -1;
+	}
+
+	memset(cover, 0, ct * sizeof(*cover));
+	while (c->picked_ct < cand_ct) {
+		bool more = c->picked_ct >= FP_ANCHORS;
+		uint64_t total = 0;
+		for (i = 0; i < ct; i++)
+			if (i != a)
+				total += weight(cover[i], more);
+
+		struct cand *best = NULL;
+		uint64_t best_gain = 0;
+		size_t best_spread = 0;
+		for (i = 0; i < cand_ct; i++) {
+			struct cand *cd = &cands[i];
+			if (cd->used)
+				continue;
+
+			/* every class has it, which tells none of them apart */
+			uint64_t gain = 0;
+			if (cd->run_len < ct) {
+				gain = total;
+				for (j = 0; j < cd->run_len; j++)
+					if (cd->run[j].class != a)
+						gain -= weight(cover[cd->run[j].class], more);
+			}
+
+			size_t spread = SIZE_MAX;
+			for (j = 0; j < c->picked_ct; j++) {
+				size_t d = cd->k > c->picked[j] ? cd->k - c->picked[j] : c->picked[j] - cd->k;
+				if (d < spread)
+					spread = d;
+			}
+
+			if (!best || gain > best_gain || (gain == best_gain && spread > best_spread)) {
+				best = cd;
+				best_gain = gain;
+				best_spread = spread;
+			}
+		}
+
+		if (!best || (more && !best_gain))
+			break;
+
+		best->used = true;
+		c->picked[c->picked_ct++] = best->k;
+		for (i = 0; i < ct; i++)
+			cover[i]++;
+		for (j = 0; j < best->run_len; j++)
+			cover[best->run[j].class]--;
+	}
+
+	for (i = 0; i < ct; i++)
+		if (i != a && !cover[i])
+			fprintf(stderr, "W: '%s' images can pass as '%s'\n", cl[i].label, c->label);
+	return 0;
+}
+
+/* learn the anchors of the @ct classes @cl, which all have the same image length */
+static int
+learn_group(struct learn_class *cl, size_t ct, const struct fp_sample **order)
+{
+	size_t nwin = cl[0].len / FP_WINDOW;
+	if (!nwin) {
+		fprintf(stderr, "W: %zu byte images are too short to identify\n", cl[0].len);
+		return 0;
+	}
+
+	size_t i, j, k, m = 0;
+	for (i = 0; i < ct; i++)
+		m += cl[i].ct;
+
+	/* row k is the hash of window k of every image, with the image's class */
+	struct entry *rows = calloc(nwin * m, sizeof(*rows));
+	size_t *row_len = calloc(nwin, sizeof(*row_len));
+	struct cand *cands = calloc(nwin, sizeof(*cands));
+	uint32_t *cover = calloc(ct, sizeof(*cover));
+	if (!rows || !row_len || !cands || !cover) {
+		fprintf(stderr, "E: out of memory\n");
+		free(rows);
+		free(row_len);
+		free(cands);
+		free(cover);
+		return -1;
+	}
+
+	for (k = 0; k < nwin; k++) {
+		struct entry *row = rows + k * m;
+		size_t n = 0;
+		for (i = 0; i < ct; i++)
+			for (j = 0; j < cl[i].ct; j++)
+				row[n++] = (struct entry){
+					.hash = window_hash(order[cl[i].first + j]->data + k * FP_WINDOW),
+					.class = i,
+				};
+
+		qsort(row, m, sizeof(*row), entry_cmp);
+		for (i = 0; i < m; i++)
+			if (!row_len[k] || entry_cmp(&row[row_len[k] - 1], &row[i]))
+				row[row_len[k]++] = row[i];
+	}
+
+	int r = 0;
+	for (i = 0; !r && i < ct; i++) {
+		r = pick_anchors(cl, ct, i, order, rows, row_len, m, nwin, cands, cover);
+		if (cl[i].picked_ct)
+			qsort(cl[i].picked, cl[i].picked_ct, sizeof(cl[i].picked[0]), u32_cmp);
+	}
+
+	free(rows);
+	free(row_len);
+	free(cands);
+	free(cover);
+	return r;
+}
+
+int fp_learn(struct fp_index *ix, const struct fp_sample *s, size_t n)
+{
+	memset(ix, 0, sizeof(*ix));
+	int r = -1;
+	size_t i, j, class_ct = 0;
+	const struct fp_sample **order = calloc(n ? n : 1, sizeof(*order));
+	struct learn_class *cl = calloc(n ? n : 1, sizeof(*cl));
+	struct buf b = { 0 };
+	if (!order || !cl) {
+		fprintf(stderr, "E: out of memory\n");
+		goto out;
+	}
+
+	for (i = 0; i < n; i++)
+		order[i] = &s[i];
+	qsort(order, n, sizeof(*order), sample_cmp);
+
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && !strcmp(order[i]->label, order[j]->label); j++)
+			if (order[j]->len != order[i]->len) {
+				fprintf(stderr, "E: '%s' has images of %zu and %zu bytes\n",
+						order[i]->label, order[i]->len, order[j]->len);
+				goto out;
+			}
+
+		cl[class_ct++] = (struct learn_class){
+			.label = order[i]->label,
+			.len = order[i]->len,
+			.first = i,
+			.ct = j - i,
+		};
+	}
+
+	/* classes of different lengths are told apart by that alone */
+	qsort(cl, class_ct, sizeof(*cl), class_cmp);
+	for (i = 0; i < class_ct; i = j) {
+		for (j = i + 1; j < class_ct && cl[j].len == cl[i].len; j++)
+			;
+		if (learn_group(cl + i, j - i, order))
+			goto out;
+	}
+
+	put(&b, FP_MAGIC, 8);
+	put32(&b, FP_WINDOW);
+	put32(&b, class_ct);
+	for (i = 0; i < class_ct; i++) {
+		const struct learn_class *c = &cl[i];
+		size_t len = strlen(c->label);
+		put32(&b, len);
+		put(&b, c->label, len + 1);
+		put64(&b, c->len);
+		put32(&b, c->picked_ct);
+		for (j = 0; j < c->picked_ct; j++) {
+			put32(&b, c->picked[j] * FP_WINDOW);
+			put(&b, order[c->first]->data + c->picked[j] * FP_WINDOW, FP_WINDOW);
+		}
+	}
+
+	if (b.oom) {
+		fprintf(stderr, "E: out of memory\n");
+		free(b.p);
+		goto out;
+	}
+
+	ix->buf = b.p;
+	ix->buf_len = b.len;
+	r = parse(ix, "learned index");
+	if (r)
+		fp_destroy(ix);
+
+out:
+	for (i = 0; cl && i < class_ct; i++)
+		free(cl[i].picked);
+	free(order);
+	free(cl);
+	return r;
+}
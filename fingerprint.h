@@ -0,0 +1,117 @@
+#pragma once
+
+/*
+ * Image fingerprints: for each known kind of image (a radio model, or a
+ * firmware variant of one) a few FP_WINDOW byte windows ("anchors") that
+ * every image of that kind has at the same offset. They are learned from a
+ * corpus of labeled images and chosen so that each kind's anchors tell it
+ * apart from every other kind of the same image length.
+ *
+ * Labels are "<model>" or "<model>/<variant>", so a check for the model
+ * accepts any of its variants.
+ *
+ * Classifying hashes the image at each offset that has an anchor and looks
+ * the hash up in a table of every anchor, so it costs about the same for
+ * hundreds of kinds as for one. If no kind matches in place, a rolling hash
+ * over the whole image looks for a kind whose anchors are all there but have
+ * moved.
+ *
+ * File format (little endian):
+ *
+ *   8 bytes   "RPFPRNT1"
+ *   4 bytes   le32, window length (FP_WINDOW)
+ *   4 bytes   le32, number of kinds
+ *
+ *   kinds:
+ *     4 bytes   le32, label length
+ *     label, then a 0 byte
+ *     8 bytes   le64, image length
+ *     4 bytes   le32, number of anchors
+ *     anchors   le32 offset, then the window's bytes
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FP_MAGIC "RPFPRNT1"
+#define FP_WINDOW 16
+/* anchors learned for each kind, more if it takes more to tell it apart */
+#define FP_ANCHORS 8
+
+struct fp_anchor {
+	uint32_t offset;
+	uint32_t class;
+	uint64_t hash;
+	const uint8_t *bytes;
+};
+
+struct fp_class {
+	const char *label;
+	size_t len;
+	/* anchors[first] .. anchors[first + anchor_ct - 1] */
+	size_t first, anchor_ct;
+};
+
+struct fp_index {
+	struct fp_class *classes;
+	size_t class_ct;
+	struct fp_anchor *anchors;
+	size_t anchor_ct;
+
+	/* distinct anchor offsets, ascending */
+	uint32_t *offsets;
+	size_t offset_ct;
+	/* anchor index + 1 for each used slot, 0 for empty, keyed on the hash */
+	uint32_t *slots;
+	size_t slot_mask;
+
+	/* classify's scratch: per kind hit counts, found anchors (a bit each) */
+	uint32_t *hits;
+	uint64_t *found;
+
+	/* the serialized index, which labels and anchor bytes point into */
+	uint8_t *buf;
+	void *map;
+	size_t buf_len;
+};
+
+struct fp_sample {
+	const char *label;
+	const uint8_t *data;
+	size_t len;
+};
+
+/*
+ * Learn an index from @n labeled images. Kinds that can't be told apart are
+ * warned about. Returns 0 on success, -1 (after printing why) on failure.
+ */
+int fp_learn(struct fp_index *ix, const struct fp_sample *s, size_t n);
+/* returns 0 on success, -1 (after printing why) on failure */
+int fp_load(struct fp_index *ix, const char *path);
+int fp_save(const struct fp_index *ix, const char *path);
+void fp_destroy(struct fp_index *ix);
+
+struct fp_result {
+	/* the closest kind, NULL if nothing matched at all */
+	const struct fp_class *best;
+	/* another kind that matched as well as best, one of another model if
+	 * there is one */
+	const struct fp_class *tie;
+	/* best's anchors that matched */
+	size_t hits;
+	/* best matched (most of its anchors, better than any other kind) */
+	bool identified;
+	/* identified, but only as best's model: every kind that matched as well
+	 * is a variant of it */
+	bool model_only;
+	/* best's anchors were all found, but not where they belong */
+	bool shifted;
+};
+
+/* classify @len bytes of @data. Uses scratch space in @ix, so one at a time */
+void fp_classify(struct fp_index *ix, const uint8_t *data, size_t len,
+		struct fp_result *r);
+
+/* @label is of @model, or a variant of it */
+bool fp_label_is(const char *label, const char *model);
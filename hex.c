@@ -0,0 +1,241 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hex.h"
+
+#if defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+# define HEX_SSE2 1
+# include <emmintrin.h>
+#else
+# define HEX_SSE2 0
+#endif
+
+#if HEX_SSE2 && defined(__GNUC__)
+# define HEX_AVX2 1
+# include <immintrin.h>
+#else
+# define HEX_AVX2 0
+#endif
+
+static const char hex_digits[16] = "0123456789ABCDEF";
+
+/* 0x10 | value for hex digits, 0 for everything else */
+#define D(c, v) [c] = 0x10 | (v)
+static const uint8_t hex_value[256] = {
+	D('0', 0), D('1', 1), D('2', 2), D('3', 3), D('4', 4),
+	D('5', 5), D('6', 6), D('7', 7), D('8', 8), D('9', 9),
+	D('A', 10), D('B', 11), D('C', 12), D('D', 13), D('E', 14), D('F', 15),
+};
+#undef D
+
+static void
+hex_encode_scalar(char *out, const uint8_t *in, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; i++) {
+		out[i * 2] = hex_digits[in[i] >> 4];
+		out[i * 2 + 1] = hex_digits[in[i] & 0xf];
+	}
+}
+
+static size_t
+hex_find_error(const char *in, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len * 2; i++)
+		if (!hex_value[(uint8_t)in[i]])
+			return i;
+	return len * 2;
+}
+
+/* returns false if any character was bad */
+static bool
+hex_decode_scalar(uint8_t *out, const char *in, size_t len)
+{
+	uint8_t ok = 0x10;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		uint8_t hi = hex_value[(uint8_t)in[i * 2]];
+		uint8_t lo = hex_value[(uint8_t)in[i * 2 + 1]];
+		ok &= hi & lo;
+		out[i] = (uint8_t)(hi << 4 | (lo & 0xf));
+	}
+	return ok;
+}
+
+#if HEX_SSE2
+/* 16 bytes -> 32 characters */
+static void
+hex_encode_sse2(char *out, const uint8_t *in)
+{
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	__m128i v = _mm_loadu_si128((const __m128i *)in);
+	__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+	__m128i lo = _mm_and_si128(v, mask);
+
+	/* nibble n -> '0' + n, plus 7 more for 'A'..'F' */
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i zero = _mm_set1_epi8('0');
+	const __m128i alpha = _mm_set1_epi8('A' - '0' - 10);
+	__m128i a = _mm_unpacklo_epi8(hi, lo);
+	__m128i b = _mm_unpackhi_epi8(hi, lo);
+	a = _mm_add_epi8(_mm_add_epi8(a, zero), _mm_and_si128(_mm_cmpgt_epi8(a, nine), alpha));
+	b = _mm_add_epi8(_mm_add_epi8(b, zero), _mm_and_si128(_mm_cmpgt_epi8(b, nine), alpha));
+
+	_mm_storeu_si128((__m128i *)out, a);
+	_mm_storeu_si128((__m128i *)(out + 16), b);
+}
+
+/*
+ * Convert 16 characters to nibbles, stored one per byte. Sets *@bad to a
+ * non-zero mask if any of them are not hex digits.
+ */
+static __m128i
+hex_nibbles_sse2(__m128i c, int *bad)
+{
+	/* signed compares are fine, anything >= 0x80 lands outside both
+	 * windows */
+	const __m128i m1 = _mm_set1_epi8(-1);
+	__m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+	__m128i is_d = _mm_and_si128(_mm_cmpgt_epi8(d, m1), _mm_cmplt_epi8(d, _mm_set1_epi8(10)));
+	__m128i l = _mm_sub_epi8(c, _mm_set1_epi8('A'));
+	__m128i is_l = _mm_and_si128(_mm_cmpgt_epi8(l, m1), _mm_cmplt_epi8(l, _mm_set1_epi8(6)));
+
+	*bad |= _mm_movemask_epi8(_mm_or_si128(is_d, is_l)) ^ 0xffff;
+	return _mm_or_si128(_mm_and_si128(is_d, d),
+			_mm_and_si128(is_l, _mm_add_epi8(l, _mm_set1_epi8(10))));
+}
+
+/* 32 characters -> 16 bytes */
+static bool
+hex_decode_sse2(uint8_t *out, const char *in)
+{
+	int bad = 0;
+	__m128i a = hex_nibbles_sse2(_mm_loadu_si128((const __m128i *)in), &bad);
+	__m128i b = hex_nibbles_sse2(_mm_loadu_si128((const __m128i *)(in + 16)), &bad);
+
+	/* each 16 bit lane holds (lo << 8 | hi) */
+	const __m128i lo_byte = _mm_set1_epi16(0x00ff);
+	a = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, lo_byte), 4), _mm_srli_epi16(a, 8));
+	b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, lo_byte), 4), _mm_srli_epi16(b, 8));
+	_mm_storeu_si128((__m128i *)out, _mm_packus_epi16(a, b));
+	return !bad;
+}
+#endif
+
+#if HEX_AVX2
+/* 32 bytes -> 64 characters */
+__attribute__((target("avx2")))
+static void
+hex_encode_avx2(char *out, const uint8_t *in)
+{
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	const __m256i digits = _mm256_setr_epi8(
+			'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F',
+			'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F');
+	__m256i v = _mm256_loadu_si256((const __m256i *)in);
+	__m256i hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+	__m256i lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(v, mask));
+
+	/* unpack works within 128 bit lanes, so reassemble them in order */
+	__m256i a = _mm256_unpacklo_epi8(hi, lo);
+	__m256i b = _mm256_unpackhi_epi8(hi, lo);
+	_mm256_storeu_si256((__m256i *)out, _mm256_permute2x128_si256(a, b, 0x20));
+	_mm256_storeu_si256((__m256i *)(out + 32), _mm256_permute2x128_si256(a, b, 0x31));
+}
+
+__attribute__((target("avx2")))
+static __m256i
+hex_nibbles_avx2(__m256i c, unsigned *bad)
+{
+	const __m256i m1 = _mm256_set1_epi8(-1);
+	__m256i d = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+	__m256i is_d = _mm256_and_si256(_mm256_cmpgt_epi8(d, m1),
+			_mm256_cmpgt_epi8(_mm256_set1_epi8(10), d));
+	__m256i l = _mm256_sub_epi8(c, _mm256_set1_epi8('A'));
+	__m256i is_l = _mm256_and_si256(_mm256_cmpgt_epi8(l, m1),
+			_mm256_cmpgt_epi8(_mm256_set1_epi8(6), l));
+
+	*bad |= ~(unsigned)_mm256_movemask_epi8(_mm256_or_si256(is_d, is_l));
+	return _mm256_or_si256(_mm256_and_si256(is_d, d),
+			_mm256_and_si256(is_l, _mm256_add_epi8(l, _mm256_set1_epi8(10))));
+}
+
+/* 64 characters -> 32 bytes */
+__attribute__((target("avx2")))
+static bool
+hex_decode_avx2(uint8_t *out, const char *in)
+{
+	unsigned bad = 0;
+	__m256i a = hex_nibbles_avx2(_mm256_loadu_si256((const __m256i *)in), &bad);
+	__m256i b = hex_nibbles_avx2(_mm256_loadu_si256((const __m256i *)(in + 32)), &bad);
+
+	/* hi * 16 + lo for each pair of nibbles */
+	const __m256i mul = _mm256_set1_epi16(0x0110);
+	a = _mm256_maddubs_epi16(a, mul);
+	b = _mm256_maddubs_epi16(b, mul);
+	__m256i r = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+	_mm256_storeu_si256((__m256i *)out, r);
+	return !bad;
+}
+
+static bool
+hex_have_avx2(void)
+{
+	static int have = -1;
+	if (have < 0) {
+		__builtin_cpu_init();
+		have = !!__builtin_cpu_supports("avx2");
+	}
+	return have;
+}
+#endif
+
+void hex_encode(char *out, const void *in_, size_t len)
+{
+	const uint8_t *in = in_;
+
+#if HEX_AVX2
+	if (len >= 32 && hex_have_avx2()) {
+		for (; len >= 32; len -= 32, in += 32, out += 64)
+			hex_encode_avx2(out, in);
+	}
+#endif
+
+#if HEX_SSE2
+	for (; len >= 16; len -= 16, in += 16, out += 32)
+		hex_encode_sse2(out, in);
+#endif
+
+	hex_encode_scalar(out, in, len);
+}
+
+int hex_decode(void *out_, const char *in, size_t len, size_t *err_pos)
+{
+	const char *start = in;
+	uint8_t *out = out_;
+	size_t left = len;
+	bool ok = true;
+
+#if HEX_AVX2
+	if (left >= 32 && hex_have_avx2()) {
+		for (; left >= 32; left -= 32, in += 64, out += 32)
+			ok &= hex_decode_avx2(out, in);
+	}
+#endif
+
+#if HEX_SSE2
+	for (; left >= 16; left -= 16, in += 32, out += 16)
+		ok &= hex_decode_sse2(out, in);
+#endif
+
+	ok &= hex_decode_scalar(out, in, left);
+	if (ok)
+		return 0;
+
+	/* only pay for locating the error when there is one */
+	if (err_pos)
+		*err_pos = hex_find_error(start, len);
+	return -1;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+/*
+ * Hex encoding & decoding of byte buffers
+ *
+ * Uses lookup tables, and SSE2/AVX2 when the target supports them (AVX2 is
+ * selected at runtime).
+ */
+
+#include <stddef.h>
+
+/* Encode @len bytes from @in as 2 * @len upper case hex digits. No '\0' is
+ * appended. */
+void hex_encode(char *out, const void *in, size_t len);
+
+/*
+ * Decode 2 * @len upper case hex digits from @in into @len bytes at @out.
+ * Lower case is rejected, the wire format is upper case only.
+ *
+ * Returns 0 on success. On failure returns -1 and, if @err_pos is non-NULL,
+ * stores the index into @in of the first character that is not a hex digit.
+ * The contents of @out are unspecified on failure.
+ */
+int hex_decode(void *out, const char *in, size_t len, size_t *err_pos);
@@ -0,0 +1,155 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "image-file.h"
+
+#define MAP_MAGIC "RPCOVER1"
+#define MAP_HDR_LEN 16
+
+static void
+put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t
+get_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/*
+ * Map @path with exactly @size bytes. If @keep, an existing file must already
+ * be that size (or empty, which is treated as new). Sets *@fresh if the file
+ * was (re-)initialized.
+ */
+static void *
+map_file(const char *path, size_t size, bool keep, bool *fresh)
+{
+	int fd = open(path, O_RDWR | O_CREAT | (keep ? 0 : O_TRUNC), 0644);
+	if (fd < 0) {
+		fprintf(stderr, "E: could not open '%s': %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st)) {
+		fprintf(stderr, "E: could not stat '%s': %s\n", path, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	*fresh = st.st_size == 0;
+	if (!*fresh && (size_t)st.st_size != size) {
+		fprintf(stderr, "E: '%s' is %jd bytes, expected %zu\n", path, (intmax_t)st.st_size, size);
+		close(fd);
+		return NULL;
+	}
+
+	if (ftruncate(fd, size)) {
+		fprintf(stderr, "E: could not resize '%s': %s\n", path, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	void *m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) {
+		fprintf(stderr, "E: could not map '%s': %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	return m;
+}
+
+int image_file_open(struct image_file *f, const char *path, size_t size, size_t block_len, bool keep)
+{
+	*f = (struct image_file){
+		.size = size,
+		.block_len = block_len,
+		.blocks = (size + block_len - 1) / block_len,
+	};
+
+	size_t path_len = strlen(path);
+	char *map_path = malloc(path_len + sizeof(".map"));
+	if (!map_path) {
+		fprintf(stderr, "E: out of memory\n");
+		return -1;
+	}
+	memcpy(map_path, path, path_len);
+	memcpy(map_path + path_len, ".map", sizeof(".map"));
+
+	bool data_fresh, map_fresh;
+	f->data = map_file(path, size, keep, &data_fresh);
+	if (!f->data)
+		goto err;
+
+	f->map_size = MAP_HDR_LEN + (f->blocks + 7) / 8;
+	uint8_t *m = f->map = map_file(map_path, f->map_size, keep, &map_fresh);
+	if (!m)
+		goto err;
+
+	if (map_fresh || !keep) {
+		f->unmapped = !data_fresh && keep;
+		memset(m, 0, f->map_size);
+		memcpy(m, MAP_MAGIC, 8);
+		put_le32(m + 8, block_len);
+		put_le32(m + 12, f->blocks);
+	} else if (memcmp(m, MAP_MAGIC, 8) || get_le32(m + 8) != block_len
+			|| get_le32(m + 12) != f->blocks) {
+		fprintf(stderr, "E: '%s' is not a coverage map for %zu blocks of %zu bytes\n",
+				map_path, f->blocks, block_len);
+		goto err;
+	}
+
+	f->coverage = m + MAP_HDR_LEN;
+	free(map_path);
+	return 0;
+
+err:
+	free(map_path);
+	image_file_close(f);
+	return -1;
+}
+
+void image_file_close(struct image_file *f)
+{
+	if (f->data) {
+		msync(f->data, f->size, MS_SYNC);
+		munmap(f->data, f->size);
+	}
+
+	if (f->map) {
+		msync(f->map, f->map_size, MS_SYNC);
+		munmap(f->map, f->map_size);
+	}
+
+	f->data = NULL;
+	f->map = NULL;
+	f->coverage = NULL;
+}
+
+size_t image_file_missing(const struct image_file *f)
+{
+	size_t i, ct = 0;
+	for (i = 0; i < f->blocks; i++)
+		ct += !image_file_has(f, i);
+	return ct;
+}
+
+void image_file_print_missing(const struct image_file *f, FILE *out)
+{
+	size_t i;
+	for (i = 0; i < f->blocks; i++)
+		if (!image_file_has(f, i))
+			fprintf(out, " %#04zx", i * f->block_len);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+/*
+ * A memory image backed by a memory-mapped file, with a sidecar coverage
+ * map ("<file>.map") recording which blocks have been filled in.
+ *
+ * Both are written through shared mappings, so whatever has been received
+ * survives the process being interrupted or crashing.
+ *
+ * Sidecar format (little endian):
+ *   8 bytes   "RPCOVER1"
+ *   4 bytes   block length
+ *   4 bytes   number of blocks
+ *   bitmap    1 bit per block, block n is bit (n % 8) of byte (n / 8)
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct image_file {
+	uint8_t *data;
+	size_t size;
+
+	/* bitmap of blocks that are present, points into the sidecar */
+	uint8_t *coverage;
+	size_t block_len;
+	size_t blocks;
+
+	void *map;
+	size_t map_size;
+
+	/* kept an image that had no sidecar, so its coverage starts empty */
+	bool unmapped;
+};
+
+/*
+ * Open (creating if needed) @path as an image of @size bytes made of blocks of
+ * @block_len bytes, plus its sidecar.
+ *
+ * If @keep is false both are reset: the image to zeros and the coverage to
+ * empty. Otherwise the existing contents are kept, and the sidecar must agree
+ * with @size and @block_len. An existing image without a sidecar gets an
+ * empty one and sets @f->unmapped, leaving it to the caller to say what is
+ * known about it.
+ *
+ * Returns 0 on success, -1 (after printing why) on failure.
+ */
+int image_file_open(struct image_file *f, const char *path, size_t size, size_t block_len, bool keep);
+void image_file_close(struct image_file *f);
+
+static inline bool image_file_has(const struct image_file *f, size_t block)
+{
+	return f->coverage[block / 8] & (1 << (block % 8));
+}
+
+static inline void image_file_mark(struct image_file *f, size_t block)
+{
+	f->coverage[block / 8] |= 1 << (block % 8);
+}
+
+/* number of blocks not yet present */
+size_t image_file_missing(const struct image_file *f);
+
+/* print the offsets of the blocks that are not present */
+void image_file_print_missing(const struct image_file *f, FILE *out);
@@ -0,0 +1,513 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bindiff.h"
+#include "util.h"
+
+/*
+ * Compare a set of memory images (typically clones of the same radio taken
+ * before & after changing one setting at a time) and report:
+ *
+ *  - for each compared pair, the byte ranges that changed
+ *  - every range that varies anywhere in the set, with the bits that vary
+ *  - groups of offsets that always change together (in exactly the same
+ *    pairs), which usually belong to the same setting
+ *
+ * By default each image is compared with the one before it. Images are
+ * compared up to the length of the shortest one.
+ */
+
+struct image {
+	const char *path;
+	const uint8_t *data;
+	size_t len;
+};
+
+struct pair {
+	size_t a, b;
+};
+
+static bool decimal;
+
+static void *
+xcalloc(size_t n, size_t sz)
+{
+	void *p = calloc(n ? n : 1, sz);
+	if (!p) {
+		fprintf(stderr, "E: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+static int
+image_load(struct image *img, const char *path)
+{
+	img->path = path;
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "E: could not open '%s': %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		fprintf(stderr, "E: could not stat '%s': %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	img->len = st.st_size;
+	img->data = NULL;
+	if (img->len) {
+		void *m = mmap(NULL, img->len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (m == MAP_FAILED) {
+			fprintf(stderr, "E: could not map '%s': %s\n", path, strerror(errno));
+			close(fd);
+			return -1;
+		}
+		img->data = m;
+	}
+
+	close(fd);
+	return 0;
+}
+
+static void
+print_offset(size_t off)
+{
+	if (decimal)
+		printf("%zu", off);
+	else
+		printf("0x%04zx", off);
+}
+
+/*
+ * Find the next run of set bits in the byte mask @m (@words long) at or after
+ * bit *@end. Adjacent changed bytes are one range, [*@start, *@end).
+ */
+static bool
+next_range(const uint64_t *m, size_t words, size_t *start, size_t *end)
+{
+	size_t i = *end / 64;
+	if (i >= words)
+		return false;
+
+	uint64_t v = m[i] & (~(uint64_t)0 << (*end % 64));
+	while (!v) {
+		if (++i >= words)
+			return false;
+		v = m[i];
+	}
+	*start = i * 64 + __builtin_ctzll(v);
+
+	v = ~m[i] & (~(uint64_t)0 << (*start % 64));
+	while (!v) {
+		if (++i >= words) {
+			*end = words * 64;
+			return true;
+		}
+		v = ~m[i];
+	}
+	*end = i * 64 + __builtin_ctzll(v);
+	return true;
+}
+
+#define for_each_range(m, words, start, end) \
+	for (size_t start = 0, end = 0; next_range(m, words, &start, &end);)
+
+static void
+print_bytes(const uint8_t *d, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; i++)
+		printf("%02x", d[i]);
+}
+
+static void
+print_range(size_t start, size_t end)
+{
+	print_offset(start);
+	if (end - start > 1) {
+		putchar('-');
+		print_offset(end - 1);
+	}
+}
+
+static void
+print_pair(const struct image *imgs, const struct pair *pr, const uint64_t *changed,
+		size_t words, size_t bytes, uint64_t bits, bool verbose)
+{
+	const struct image *a = &imgs[pr->a], *b = &imgs[pr->b];
+	printf("%s -> %s: %zu bytes (%" PRIu64 " bits) changed", a->path, b->path, bytes, bits);
+	if (!bytes) {
+		putchar('\n');
+		return;
+	}
+
+	if (!verbose) {
+		putchar(':');
+		for_each_range(changed, words, start, end) {
+			putchar(' ');
+			print_range(start, end);
+		}
+		putchar('\n');
+		return;
+	}
+
+	putchar('\n');
+	for_each_range(changed, words, start, end) {
+		printf("  ");
+		print_range(start, end);
+		printf(": ");
+		print_bytes(a->data + start, end - start);
+		printf(" -> ");
+		print_bytes(b->data + start, end - start);
+		putchar('\n');
+	}
+}
+
+/* co-change signatures: which pairs each varying offset changed in */
+struct sigs {
+	size_t words;
+	uint64_t *bits;
+	uint64_t *hash;
+	size_t *offset;
+	size_t ct;
+};
+
+static const struct sigs *sort_sigs;
+
+static int
+sig_cmp(const void *a_, const void *b_)
+{
+	size_t a = *(const size_t *)a_, b = *(const size_t *)b_;
+	const struct sigs *s = sort_sigs;
+	if (s->hash[a] != s->hash[b])
+		return s->hash[a] < s->hash[b] ? -1 : 1;
+	int r = memcmp(s->bits + a * s->words, s->bits + b * s->words,
+			s->words * sizeof(uint64_t));
+	if (r)
+		return r;
+	/* keep each group in offset order */
+	return a < b ? -1 : a > b;
+}
+
+static bool
+sig_eq(const struct sigs *s, size_t a, size_t b)
+{
+	return s->hash[a] == s->hash[b] && !memcmp(s->bits + a * s->words,
+			s->bits + b * s->words, s->words * sizeof(uint64_t));
+}
+
+static size_t
+sig_pop(const struct sigs *s, size_t v)
+{
+	size_t i, n = 0;
+	for (i = 0; i < s->words; i++)
+		n += __builtin_popcountll(s->bits[v * s->words + i]);
+	return n;
+}
+
+struct group {
+	/* index of the first member in the sorted order */
+	size_t first;
+	size_t ct;
+};
+
+static int
+group_cmp(const void *a_, const void *b_)
+{
+	const struct group *a = a_, *b = b_;
+	/* biggest first, then by where they start (order is offset order) */
+	if (a->ct != b->ct)
+		return a->ct > b->ct ? -1 : 1;
+	return a->first < b->first ? -1 : a->first > b->first;
+}
+
+static void
+print_groups(const struct sigs *s, size_t pair_ct, const struct pair *pairs,
+		const struct image *imgs, size_t len)
+{
+	size_t *order = xcalloc(s->ct, sizeof(*order));
+	size_t i, j;
+	for (i = 0; i < s->ct; i++)
+		order[i] = i;
+	sort_sigs = s;
+	qsort(order, s->ct, sizeof(*order), sig_cmp);
+
+	struct group *groups = xcalloc(s->ct, sizeof(*groups));
+	size_t group_ct = 0;
+	for (i = 0; i < s->ct; i = j) {
+		for (j = i + 1; j < s->ct && sig_eq(s, order[i], order[j]); j++)
+			;
+		if (j - i > 1)
+			groups[group_ct++] = (struct group){ .first = i, .ct = j - i };
+	}
+	qsort(groups, group_ct, sizeof(*groups), group_cmp);
+
+	printf("\nchanged together: %zu groups\n", group_ct);
+
+	uint64_t *mask = xcalloc(bindiff_words(len), sizeof(*mask));
+	for (i = 0; i < group_ct; i++) {
+		const struct group *g = &groups[i];
+		size_t v0 = order[g->first];
+		memset(mask, 0, bindiff_words(len) * sizeof(*mask));
+		for (j = 0; j < g->ct; j++) {
+			size_t off = s->offset[order[g->first + j]];
+			mask[off / 64] |= (uint64_t)1 << (off % 64);
+		}
+
+		printf("  %zu bytes:", g->ct);
+		for_each_range(mask, bindiff_words(len), start, end) {
+			putchar(' ');
+			print_range(start, end);
+		}
+
+		size_t in = sig_pop(s, v0);
+		printf("\n    in %zu of %zu pairs:", in, pair_ct);
+		const uint64_t *sig = s->bits + v0 * s->words;
+		size_t shown = 0;
+		for (j = 0; j < pair_ct && shown < 8; j++) {
+			if (!(sig[j / 64] & ((uint64_t)1 << (j % 64))))
+				continue;
+			printf(" %s->%s", imgs[pairs[j].a].path, imgs[pairs[j].b].path);
+			shown++;
+		}
+		if (in > shown)
+			printf(" ...");
+		putchar('\n');
+	}
+
+	free(mask);
+	free(groups);
+	free(order);
+}
+
+static const char *opts = "hvar:dgt";
+
+static void usage_(const char *prgm, int e)
+{
+	FILE *f;
+	if (e)
+		f = stderr;
+	else
+		f = stdout;
+
+	fprintf(f,
+"%sUsage: %s [options] <image> <image>...\n"
+"Show which bytes (and bits) differ between memory images\n"
+"Options: -%s\n"
+"  -a         compare every pair of images, not just each with the one before\n"
+"  -r <n>     compare every image with image <n> (counting from 0)\n"
+"  -v         show the old and new values of each changed range\n"
+"  -d         show offsets in decimal\n"
+"  -g         don't look for offsets that change together\n"
+"  -t         report how long the comparison took on stderr\n"
+	, e?"\n":"", prgm, opts);
+
+	exit(e);
+}
+#define usage(e) usage_(argc?argv[0]:"img-diff", e)
+
+int main(int argc, char *argv[])
+{
+	bool verbose = false, all_pairs = false, groups = true, timing = false;
+	long ref = -1;
+	int opt, e = 0;
+
+	while ((opt = getopt(argc, argv, opts)) != -1) {
+		switch (opt) {
+		case 'h':
+			usage(EXIT_SUCCESS);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'a':
+			all_pairs = true;
+			break;
+		case 'r':
+			ref = strtol(optarg, NULL, 0);
+			break;
+		case 'd':
+			decimal = true;
+			break;
+		case 'g':
+			groups = false;
+			break;
+		case 't':
+			timing = true;
+			break;
+		default:
+			e++;
+			break;
+		}
+	}
+
+	size_t img_ct = argc - optind;
+	if (img_ct < 2) {
+		fprintf(stderr, "E: need at least 2 images\n");
+		e++;
+	}
+
+	if (ref >= 0 && all_pairs) {
+		fprintf(stderr, "E: -a and -r can't be used together\n");
+		e++;
+	}
+
+	if (ref >= 0 && (size_t)ref >= img_ct) {
+		fprintf(stderr, "E: -r %ld, but there are only %zu images\n", ref, img_ct);
+		e++;
+	}
+
+	if (e)
+		usage(EXIT_FAILURE);
+
+	struct image *imgs = xcalloc(img_ct, sizeof(*imgs));
+	size_t i, j, len = SIZE_MAX;
+	for (i = 0; i < img_ct; i++) {
+		if (image_load(&imgs[i], argv[optind + i]))
+			exit(EXIT_FAILURE);
+		if (imgs[i].len < len)
+			len = imgs[i].len;
+	}
+
+	for (i = 0; i < img_ct; i++)
+		if (imgs[i].len != len)
+			fprintf(stderr, "W: '%s' is %zu bytes, only comparing the first %zu\n",
+					imgs[i].path, imgs[i].len, len);
+
+	size_t pair_ct;
+	if (all_pairs)
+		pair_ct = img_ct * (img_ct - 1) / 2;
+	else
+		pair_ct = img_ct - 1;
+	struct pair *pairs = xcalloc(pair_ct, sizeof(*pairs));
+	size_t n = 0;
+	if (all_pairs) {
+		for (i = 0; i < img_ct; i++)
+			for (j = i + 1; j < img_ct; j++)
+				pairs[n++] = (struct pair){ i, j };
+	} else if (ref >= 0) {
+		for (i = 0; i < img_ct; i++)
+			if (i != (size_t)ref)
+				pairs[n++] = (struct pair){ ref, i };
+	} else {
+		for (i = 1; i < img_ct; i++)
+			pairs[n++] = (struct pair){ i - 1, i };
+	}
+
+	uint64_t start_ns = now_ns();
+	size_t words = bindiff_words(len);
+
+	/*
+	 * Everything that changes in any pair differs from image 0 in at least
+	 * one image, so find the varying offsets (and bits) first: that bounds
+	 * the signature table before the pairs are compared.
+	 */
+	uint64_t *changed = xcalloc(words, sizeof(*changed));
+	uint64_t *varying = xcalloc(words, sizeof(*varying));
+	uint8_t *bits = xcalloc(len, 1);
+	for (i = 1; i < img_ct; i++) {
+		bindiff_pair(imgs[0].data, imgs[i].data, len, changed, bits);
+		for (j = 0; j < words; j++)
+			varying[j] |= changed[j];
+	}
+
+	struct sigs s = { .words = bindiff_words(pair_ct) };
+	for (j = 0; j < words; j++)
+		s.ct += __builtin_popcountll(varying[j]);
+
+	/* index of each varying offset in the signature table */
+	uint32_t *var_idx = groups ? xcalloc(len, sizeof(*var_idx)) : NULL;
+	if (groups) {
+		s.bits = xcalloc(s.ct * s.words, sizeof(*s.bits));
+		s.hash = xcalloc(s.ct, sizeof(*s.hash));
+		s.offset = xcalloc(s.ct, sizeof(*s.offset));
+		n = 0;
+		for_each_range(varying, words, rs, re) {
+			for (j = rs; j < re; j++) {
+				var_idx[j] = n;
+				s.offset[n++] = j;
+			}
+		}
+	}
+
+	uint64_t total_bits = 0;
+	for (i = 0; i < pair_ct; i++) {
+		const struct pair *pr = &pairs[i];
+		uint64_t pop = bindiff_pair(imgs[pr->a].data, imgs[pr->b].data, len,
+				changed, NULL);
+		size_t bytes = 0;
+		for (j = 0; j < words; j++) {
+			uint64_t m = changed[j];
+			bytes += __builtin_popcountll(m);
+			if (!groups)
+				continue;
+			while (m) {
+				size_t v = var_idx[j * 64 + __builtin_ctzll(m)];
+				s.bits[v * s.words + i / 64] |= (uint64_t)1 << (i % 64);
+				m &= m - 1;
+			}
+		}
+		total_bits += pop;
+		print_pair(imgs, pr, changed, words, bytes, pop, verbose);
+	}
+
+	if (groups) {
+		/* FNV-1a over the signature words, only needs to spread the sort */
+		for (i = 0; i < s.ct; i++) {
+			uint64_t h = 0xcbf29ce484222325;
+			for (j = 0; j < s.words; j++)
+				h = (h ^ s.bits[i * s.words + j]) * 0x100000001b3;
+			s.hash[i] = h;
+		}
+	}
+
+	size_t range_ct = 0, var_bits = 0;
+	for_each_range(varying, words, rs, re) {
+		range_ct++;
+		for (j = rs; j < re; j++)
+			var_bits += __builtin_popcount(bits[j]);
+	}
+
+	printf("\nvarying: %zu bytes (%zu bits) in %zu ranges\n", s.ct, var_bits, range_ct);
+	for_each_range(varying, words, rs, re) {
+		printf("  ");
+		print_range(rs, re);
+		printf(" bits ");
+		print_bytes(bits + rs, re - rs);
+		putchar('\n');
+	}
+
+	if (groups)
+		print_groups(&s, pair_ct, pairs, imgs, len);
+
+	if (timing)
+		fprintf(stderr, "I: %zu images, %zu pairs of %zu bytes (%" PRIu64 " bits changed) in %.3f ms\n",
+				img_ct, pair_ct, len, total_bits,
+				(now_ns() - start_ns) / 1e6);
+
+	free(s.bits);
+	free(s.hash);
+	free(s.offset);
+	free(var_idx);
+	free(bits);
+	free(varying);
+	free(changed);
+	free(pairs);
+	for (i = 0; i < img_ct; i++)
+		if (imgs[i].data)
+			munmap((void *)imgs[i].data, imgs[i].len);
+	free(imgs);
+	return 0;
+}
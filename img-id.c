@@ -0,0 +1,294 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fingerprint.h"
+#include "util.h"
+
+/*
+ * Identify unlabeled memory images: which radio (and firmware variant) they
+ * came from, using a fingerprint index learned from images that are labeled.
+ * See fingerprint.h for how.
+ */
+
+struct image {
+	const char *path;
+	const uint8_t *data;
+	size_t len;
+};
+
+static int
+image_load(struct image *img, const char *path)
+{
+	img->path = path;
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "E: could not open '%s': %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		fprintf(stderr, "E: could not stat '%s': %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	img->len = st.st_size;
+	img->data = NULL;
+	if (img->len) {
+		void *m = mmap(NULL, img->len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (m == MAP_FAILED) {
+			fprintf(stderr, "E: could not map '%s': %s\n", path, strerror(errno));
+			close(fd);
+			return -1;
+		}
+		img->data = m;
+	}
+
+	close(fd);
+	return 0;
+}
+
+/* the '<label> <image>' lines of @manifest, as samples which own their strings */
+static struct fp_sample *
+manifest_parse(const char *manifest, size_t *ct)
+{
+	FILE *in = fopen(manifest, "r");
+	if (!in) {
+		fprintf(stderr, "E: could not open manifest '%s'\n", manifest);
+		exit(EXIT_FAILURE);
+	}
+
+	struct fp_sample *s = NULL;
+	char *line = NULL;
+	size_t line_cap = 0, line_nr = 0, cap = 0;
+	*ct = 0;
+	while (getline(&line, &line_cap, in) >= 0) {
+		line_nr++;
+
+		char *save, *f[3];
+		size_t i;
+		for (i = 0; i < 3; i++) {
+			f[i] = strtok_r(i ? NULL : line, " \t\r\n", &save);
+			if (!f[i])
+				break;
+		}
+
+		if (!i || f[0][0] == '#')
+			continue;
+
+		if (i != 2) {
+			fprintf(stderr, "E: %s:%zu: expected '<label> <image>'\n", manifest, line_nr);
+			exit(EXIT_FAILURE);
+		}
+
+		if (*ct == cap) {
+			cap = cap ? cap * 2 : 64;
+			s = realloc(s, cap * sizeof(*s));
+			if (!s) {
+				fprintf(stderr, "E: out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		struct image img;
+		if (image_load(&img, f[1]))
+			exit(EXIT_FAILURE);
+
+		s[(*ct)++] = (struct fp_sample){
+			.label = strdup(f[0]),
+			.data = img.data,
+			.len = img.len,
+		};
+	}
+
+	free(line);
+	fclose(in);
+
+	if (!*ct) {
+		fprintf(stderr, "E: manifest '%s' has no entries\n", manifest);
+		exit(EXIT_FAILURE);
+	}
+	return s;
+}
+
+static int
+learn(const char *index_file, const char *manifest, bool timing)
+{
+	size_t n, i;
+	struct fp_sample *s = manifest_parse(manifest, &n);
+
+	uint64_t start = now_ns();
+	struct fp_index ix;
+	if (fp_learn(&ix, s, n))
+		return -1;
+	if (timing)
+		fprintf(stderr, "I: learned %zu kinds from %zu images in %.1f ms\n",
+				ix.class_ct, n, (now_ns() - start) / 1e6);
+
+	int r = fp_save(&ix, index_file);
+	fp_destroy(&ix);
+	for (i = 0; i < n; i++) {
+		free((char *)s[i].label);
+		if (s[i].len)
+			munmap((void *)s[i].data, s[i].len);
+	}
+	free(s);
+	return r;
+}
+
+static void
+show(const struct fp_index *ix)
+{
+	size_t i, j, k;
+	for (i = 0; i < ix->class_ct; i++) {
+		const struct fp_class *cl = &ix->classes[i];
+		printf("%s (%zu bytes)\n", cl->label, cl->len);
+		for (j = cl->first; j < cl->first + cl->anchor_ct; j++) {
+			const struct fp_anchor *a = &ix->anchors[j];
+			printf("  0x%04" PRIx32 " ", a->offset);
+			for (k = 0; k < FP_WINDOW; k++)
+				printf("%02x", a->bytes[k]);
+			putchar('\n');
+		}
+	}
+}
+
+/* returns the number of images that could not be identified */
+static size_t
+identify(struct fp_index *ix, char **paths, size_t ct, bool timing)
+{
+	size_t i, unknown = 0;
+	for (i = 0; i < ct; i++) {
+		struct image img;
+		if (image_load(&img, paths[i])) {
+			unknown++;
+			continue;
+		}
+
+		struct fp_result r;
+		uint64_t start = now_ns();
+		fp_classify(ix, img.data, img.len, &r);
+		uint64_t ns = now_ns() - start;
+
+		if (r.model_only)
+			printf("%s: %.*s (%s or %s, %zu/%zu anchors)\n", img.path,
+					(int)strcspn(r.best->label, "/"), r.best->label,
+					r.best->label, r.tie->label, r.hits, r.best->anchor_ct);
+		else if (r.identified)
+			printf("%s: %s (%zu/%zu anchors)\n", img.path, r.best->label,
+					r.hits, r.best->anchor_ct);
+		else if (r.shifted)
+			printf("%s: unknown, has the anchors of %s (%zu bytes) at other offsets\n",
+					img.path, r.best->label, r.best->len);
+		else if (r.tie)
+			printf("%s: unknown, %s or %s (%zu/%zu anchors)\n", img.path,
+					r.best->label, r.tie->label, r.hits, r.best->anchor_ct);
+		else if (r.best)
+			printf("%s: unknown, closest is %s (%zu/%zu anchors)\n", img.path,
+					r.best->label, r.hits, r.best->anchor_ct);
+		else
+			printf("%s: unknown\n", img.path);
+
+		if (timing)
+			fprintf(stderr, "I: '%s' classified in %.1f us\n", img.path, ns / 1e3);
+
+		unknown += !r.identified;
+		if (img.len)
+			munmap((void *)img.data, img.len);
+	}
+	return unknown;
+}
+
+static const char *opts = "hi:t";
+
+static void usage_(const char *prgm, int e)
+{
+	FILE *f;
+	if (e)
+		f = stderr;
+	else
+		f = stdout;
+
+	fprintf(f,
+"%sUsage: %s -i <index> <action>\n"
+"Actions:\n"
+"  learn <manifest>  learn <index> from the images listed in <manifest>, one\n"
+"                    '<label> <image>' per line, labels are '<model>' or\n"
+"                    '<model>/<variant>'\n"
+"  show              print the anchors of each kind in <index>\n"
+"  <image>...        identify each image (exits with 1 if any are unknown)\n"
+"Options: -%s\n"
+"  -t	print how long learning or each classification took\n"
+	, e?"\n":"", prgm, opts);
+
+	exit(e);
+}
+#define usage(e) usage_(argc?argv[0]:"img-id", e)
+
+int main(int argc, char *argv[])
+{
+	const char *index_file = NULL;
+	bool timing = false;
+	int opt, e = 0;
+
+	while ((opt = getopt(argc, argv, opts)) != -1) {
+		switch (opt) {
+		case 'h':
+			usage(EXIT_SUCCESS);
+			break;
+		case 'i':
+			index_file = optarg;
+			break;
+		case 't':
+			timing = true;
+			break;
+		default:
+			e++;
+			break;
+		}
+	}
+
+	if (!index_file) {
+		fprintf(stderr, "E: no index (-i) specified\n");
+		e++;
+	}
+
+	if (optind == argc) {
+		fprintf(stderr, "E: require an <action> after options\n");
+		e++;
+	}
+
+	if (e)
+		usage(EXIT_FAILURE);
+
+	const char *action = argv[optind];
+	if (!strcmp(action, "learn")) {
+		if (optind + 2 != argc) {
+			fprintf(stderr, "E: learn takes a single <manifest>\n");
+			usage(EXIT_FAILURE);
+		}
+		return learn(index_file, argv[optind + 1], timing) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	struct fp_index ix;
+	if (fp_load(&ix, index_file))
+		exit(EXIT_FAILURE);
+
+	int r = EXIT_SUCCESS;
+	if (!strcmp(action, "show") && optind + 1 == argc)
+		show(&ix);
+	else if (identify(&ix, argv + optind, argc - optind, timing))
+		r = EXIT_FAILURE;
+
+	fp_destroy(&ix);
+	return r;
+}
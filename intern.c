@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+
+#define CHUNK_SIZE 65536
+
+struct intern_chunk {
+	struct intern_chunk *next;
+	size_t size;
+	char data[];
+};
+
+static uint64_t
+hash_str(const char *s, size_t len)
+{
+	/* FNV-1a, the strings are short */
+	uint64_t h = 0xcbf29ce484222325;
+	size_t i;
+	for (i = 0; i < len; i++)
+		h = (h ^ (uint8_t)s[i]) * 0x100000001b3;
+	return h;
+}
+
+void intern_init(struct intern *t)
+{
+	memset(t, 0, sizeof(*t));
+}
+
+void intern_destroy(struct intern *t)
+{
+	while (t->chunk) {
+		struct intern_chunk *c = t->chunk;
+		t->chunk = c->next;
+		free(c);
+	}
+	free(t->str);
+	free(t->len);
+	free(t->hash);
+	free(t->slots);
+	intern_init(t);
+}
+
+/* the slot holding @s, or the empty one it would go in */
+static size_t
+find_slot(const struct intern *t, const char *s, size_t len, uint64_t h)
+{
+	size_t i = h & t->slot_mask;
+	for (;;) {
+		uint32_t id = t->slots[i];
+		if (!id)
+			return i;
+		id--;
+		if (t->hash[id] == h && t->len[id] == len && !memcmp(t->str[id], s, len))
+			return i;
+		i = (i + 1) & t->slot_mask;
+	}
+}
+
+uint32_t intern_find(const struct intern *t, const char *s, size_t len)
+{
+	if (!t->slots)
+		return INTERN_NONE;
+	uint32_t id = t->slots[find_slot(t, s, len, hash_str(s, len))];
+	return id ? id - 1 : INTERN_NONE;
+}
+
+static int
+grow_slots(struct intern *t)
+{
+	size_t n = t->slots ? (t->slot_mask + 1) * 2 : 256, i;
+	uint32_t *slots = calloc(n, sizeof(*slots));
+	if (!slots)
+		return -1;
+
+	free(t->slots);
+	t->slots = slots;
+	t->slot_mask = n - 1;
+	for (i = 0; i < t->ct; i++) {
+		size_t s = t->hash[i] & t->slot_mask;
+		while (t->slots[s])
+			s = (s + 1) & t->slot_mask;
+		t->slots[s] = i + 1;
+	}
+	return 0;
+}
+
+static char *
+arena_copy(struct intern *t, const char *s, size_t len)
+{
+	struct intern_chunk *c = t->chunk;
+	if (!c || c->size - t->chunk_used < len + 1) {
+		size_t size = len + 1 > CHUNK_SIZE ? len + 1 : CHUNK_SIZE;
+		c = malloc(sizeof(*c) + size);
+		if (!c)
+			return NULL;
+		c->size = size;
+		c->next = t->chunk;
+		t->chunk = c;
+		t->chunk_used = 0;
+	}
+
+	char *p = c->data + t->chunk_used;
+	memcpy(p, s, len);
+	p[len] = '\0';
+	t->chunk_used += len + 1;
+	return p;
+}
+
+uint32_t intern_add(struct intern *t, const char *s, size_t len)
+{
+	/* keep the table at most half full */
+	if ((t->ct + 1) * 2 > (t->slots ? t->slot_mask + 1 : 0) && grow_slots(t))
+		return INTERN_NONE;
+
+	uint64_t h = hash_str(s, len);
+	size_t slot = find_slot(t, s, len, h);
+	if (t->slots[slot])
+		return t->slots[slot] - 1;
+
+	if (t->ct == t->alloc) {
+		size_t n = t->alloc ? t->alloc * 2 : 256;
+		const char **str = realloc(t->str, n * sizeof(*str));
+		if (str)
+			t->str = str;
+		uint32_t *l = realloc(t->len, n * sizeof(*l));
+		if (l)
+			t->len = l;
+		uint64_t *hs = realloc(t->hash, n * sizeof(*hs));
+		if (hs)
+			t->hash = hs;
+		if (!str || !l || !hs)
+			return INTERN_NONE;
+		t->alloc = n;
+	}
+
+	char *p = arena_copy(t, s, len);
+	if (!p)
+		return INTERN_NONE;
+
+	uint32_t id = t->ct++;
+	t->str[id] = p;
+	t->len[id] = len;
+	t->hash[id] = h;
+	t->slots[slot] = id + 1;
+	return id;
+}
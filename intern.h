@@ -0,0 +1,45 @@
+#pragma once
+
+/*
+ * String interning: each distinct string gets a dense id (0, 1, 2, ...), so
+ * strings can be stored and compared as small integers.
+ *
+ * The strings are copied (with a terminating 0) into an arena of large chunks
+ * that never move, so intern_str() stays valid until intern_destroy(). Lookup
+ * is an open addressing hash table of ids.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define INTERN_NONE UINT32_MAX
+
+struct intern_chunk;
+
+struct intern {
+	/* id -> string */
+	const char **str;
+	uint32_t *len;
+	uint64_t *hash;
+	size_t ct, alloc;
+
+	/* id + 1 for each used slot, 0 for empty */
+	uint32_t *slots;
+	size_t slot_mask;
+
+	struct intern_chunk *chunk;
+	size_t chunk_used;
+};
+
+void intern_init(struct intern *t);
+void intern_destroy(struct intern *t);
+
+/* the id of @s (@len bytes), adding it if needed. INTERN_NONE if out of memory */
+uint32_t intern_add(struct intern *t, const char *s, size_t len);
+/* the id of @s, INTERN_NONE if it hasn't been added */
+uint32_t intern_find(const struct intern *t, const char *s, size_t len);
+
+static inline const char *intern_str(const struct intern *t, uint32_t id)
+{
+	return t->str[id];
+}
@@ -1,13 +1,378 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "memory.h"
+
 void memory_init(struct memory *m)
 {
 	*m = (struct memory){
 		.range_ct = 0,
-		.ranges = NULL
+		.root = NULL,
+		.seed = 0x9e3779b9,
+	};
+}
+
+static void
+range_free(struct memory_range *r)
+{
+	free(r->buf);
+	free(r);
+}
+
+static void
+tree_free(struct memory_range *t)
+{
+	while (t) {
+		struct memory_range *right = t->right;
+		tree_free(t->left);
+		range_free(t);
+		t = right;
+	}
+}
+
+void memory_destroy(struct memory *m)
+{
+	tree_free(m->root);
+	memory_init(m);
+}
+
+static uint32_t
+memory_prio(struct memory *m)
+{
+	/* xorshift32, only used to keep the treap balanced */
+	uint32_t x = m->seed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	m->seed = x;
+	return x;
+}
+
+/*
+ * Split @t into @l (all ranges with off < key) and @r (the rest)
+ */
+static void
+tree_split(struct memory_range *t, size_t key, struct memory_range **l, struct memory_range **r)
+{
+	if (!t) {
+		*l = *r = NULL;
+		return;
+	}
+
+	if (t->off < key) {
+		tree_split(t->right, key, &t->right, r);
+		*l = t;
+	} else {
+		tree_split(t->left, key, l, &t->left);
+		*r = t;
+	}
+}
+
+/*
+ * All ranges in @l must come before all ranges in @r
+ */
+static struct memory_range *
+tree_merge(struct memory_range *l, struct memory_range *r)
+{
+	if (!l)
+		return r;
+	if (!r)
+		return l;
+
+	if (l->prio > r->prio) {
+		l->right = tree_merge(l->right, r);
+		return l;
+	} else {
+		r->left = tree_merge(l, r->left);
+		return r;
+	}
+}
+
+/* range with the largest off <= key */
+static struct memory_range *
+tree_find_le(struct memory_range *t, size_t key)
+{
+	struct memory_range *best = NULL;
+	while (t) {
+		if (t->off <= key) {
+			best = t;
+			t = t->right;
+		} else
+			t = t->left;
+	}
+	return best;
+}
+
+static struct memory_range *
+tree_largest(struct memory_range *t, struct memory_range *best)
+{
+	while (t) {
+		if (!best || t->len > best->len)
+			best = t;
+		best = tree_largest(t->left, best);
+		t = t->right;
+	}
+	return best;
+}
+
+static struct memory_range *
+tree_last(struct memory_range *t)
+{
+	while (t && t->right)
+		t = t->right;
+	return t;
+}
+
+/*
+ * Copy every range in @t other than @keep into @keep (which has already been
+ * grown to cover them) and free them.
+ */
+static size_t
+tree_absorb(struct memory_range *t, struct memory_range *keep)
+{
+	size_t ct = 0;
+	while (t) {
+		struct memory_range *right = t->right;
+		ct += tree_absorb(t->left, keep);
+		if (t != keep) {
+			memcpy(keep->data + (t->off - keep->off), t->data, t->len);
+			range_free(t);
+			ct++;
+		}
+		t = right;
+	}
+	return ct;
+}
+
+/*
+ * Make @r's buffer able to hold [start, end) without moving any data that is
+ * already present.
+ */
+static int
+range_grow(struct memory_range *r, size_t start, size_t end)
+{
+	size_t front = r->off - start;
+	size_t back = end - (r->off + r->len);
+	size_t have_front = r->data - r->buf;
+	size_t have_back = r->buf_len - have_front - r->len;
+
+	if (have_front >= front && have_back >= back) {
+		r->data -= front;
+		r->off = start;
+		r->len = end - start;
+		return 0;
+	}
+
+	size_t need = end - start;
+	size_t slack = need;
+	if (need > SIZE_MAX - slack)
+		slack = 0;
+
+	uint8_t *buf = malloc(need + slack);
+	if (!buf)
+		return -1;
+
+	/* put the slack on whichever side(s) we are growing towards */
+	size_t front_slack;
+	if (front && back)
+		front_slack = slack / 2;
+	else if (front)
+		front_slack = slack;
+	else
+		front_slack = 0;
+
+	memcpy(buf + front_slack + front, r->data, r->len);
+	free(r->buf);
+	r->buf = buf;
+	r->buf_len = need + slack;
+	r->data = buf + front_slack;
+	r->off = start;
+	r->len = need;
+	return 0;
+}
+
+static struct memory_range *
+range_new(struct memory *m, size_t off, size_t len)
+{
+	struct memory_range *r = malloc(sizeof(*r));
+	if (!r)
+		return NULL;
+
+	uint8_t *buf = malloc(len);
+	if (!buf) {
+		free(r);
+		return NULL;
+	}
+
+	*r = (struct memory_range){
+		.prio = memory_prio(m),
+		.off = off,
+		.len = len,
+		.data = buf,
+		.buf = buf,
+		.buf_len = len,
 	};
+	return r;
 }
 
-void memory_insert(struct memory *m, char *data, size_t data_len, uint64_t offset)
+int memory_insert(struct memory *m, const void *data, size_t data_len, uint64_t offset)
 {
-	/* i need a fast insert mechanism */
+	if (!data_len)
+		return 0;
+
+	if (offset > SIZE_MAX || data_len > SIZE_MAX - offset)
+		return -1;
+
+	size_t lo = offset;
+	size_t hi = offset + data_len;
+
+	/* find our neighbours: pred has the largest off <= lo, succ the smallest
+	 * off > lo */
+	struct memory_range *pred = NULL, *succ = NULL, *t = m->root;
+	while (t) {
+		if (t->off <= lo) {
+			pred = t;
+			t = t->right;
+		} else {
+			succ = t;
+			t = t->left;
+		}
+	}
+
+	bool pred_touch = pred && pred->off + pred->len >= lo;
+	bool succ_touch = succ && succ->off <= hi;
+
+	/*
+	 * Fast paths: if at most one neighbour is involved the tree order can't
+	 * change, so either extend that neighbour in place or link in a new
+	 * range without a full split & merge.
+	 */
+	if (!succ_touch) {
+		if (pred_touch) {
+			size_t end = pred->off + pred->len;
+			if (end < hi && range_grow(pred, pred->off, hi))
+				return -1;
+			memcpy(pred->data + (offset - pred->off), data, data_len);
+			return 0;
+		}
+
+		struct memory_range *n = range_new(m, offset, data_len);
+		if (!n)
+			return -1;
+		memcpy(n->data, data, data_len);
+
+		struct memory_range **link = &m->root;
+		while (*link && (*link)->prio > n->prio)
+			link = n->off < (*link)->off ? &(*link)->left : &(*link)->right;
+		tree_split(*link, n->off, &n->left, &n->right);
+		*link = n;
+		m->range_ct++;
+		return 0;
+	}
+
+	if (!pred_touch && succ->off + succ->len >= hi) {
+		if (range_grow(succ, lo, succ->off + succ->len))
+			return -1;
+		memcpy(succ->data, data, data_len);
+		return 0;
+	}
+
+	/* a preceding range that overlaps or touches us gets merged in */
+	if (pred_touch)
+		lo = pred->off;
+
+	/* a: before us, mid: overlapping or adjacent, c: after us */
+	struct memory_range *a, *b, *mid, *c;
+	tree_split(m->root, lo, &a, &b);
+	if (hi == SIZE_MAX) {
+		mid = b;
+		c = NULL;
+	} else
+		tree_split(b, hi + 1, &mid, &c);
+
+	struct memory_range *n;
+	if (!mid) {
+		n = range_new(m, offset, data_len);
+		if (!n)
+			goto undo;
+		m->range_ct++;
+	} else {
+		struct memory_range *last = tree_last(mid);
+		size_t end = last->off + last->len;
+		if (end < hi)
+			end = hi;
+
+		/* grow the biggest range so merges copy as little as possible */
+		n = tree_largest(mid, NULL);
+		if (range_grow(n, lo, end))
+			goto undo;
+
+		m->range_ct -= tree_absorb(mid, n);
+		n->left = n->right = NULL;
+	}
+
+	memcpy(n->data + (offset - n->off), data, data_len);
+	m->root = tree_merge(tree_merge(a, n), c);
+	return 0;
+
+undo:
+	m->root = tree_merge(tree_merge(a, mid), c);
+	return -1;
+}
+
+const struct memory_range *memory_find(const struct memory *m, uint64_t offset)
+{
+	if (offset > SIZE_MAX)
+		return NULL;
+
+	const struct memory_range *r = tree_find_le(m->root, offset);
+	if (r && offset - r->off < r->len)
+		return r;
+	return NULL;
+}
+
+bool memory_contains(const struct memory *m, uint64_t offset, size_t len)
+{
+	if (!len)
+		return true;
+
+	const struct memory_range *r = memory_find(m, offset);
+	if (!r)
+		return false;
+
+	return len <= r->len - (offset - r->off);
 }
 
+int memory_read(const struct memory *m, uint64_t offset, void *buf, size_t len)
+{
+	if (!len)
+		return 0;
+
+	const struct memory_range *r = memory_find(m, offset);
+	if (!r || len > r->len - (offset - r->off))
+		return -1;
+
+	memcpy(buf, r->data + (offset - r->off), len);
+	return 0;
+}
+
+const struct memory_range *memory_first(const struct memory *m)
+{
+	const struct memory_range *t = m->root;
+	while (t && t->left)
+		t = t->left;
+	return t;
+}
+
+const struct memory_range *memory_next(const struct memory *m, const struct memory_range *r)
+{
+	const struct memory_range *t = m->root, *best = NULL;
+	while (t) {
+		if (t->off > r->off) {
+			best = t;
+			t = t->left;
+		} else
+			t = t->right;
+	}
+	return best;
+}
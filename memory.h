@@ -2,22 +2,65 @@
 
 /*
  * Tracks discontiguous byte ranges in a single structure
+ *
+ * Ranges are kept disjoint and non-adjacent: inserting data that overlaps or
+ * touches an existing range merges them into a single range (with the newly
+ * inserted bytes taking precedence). Ranges are stored in a treap ordered by
+ * offset, so insert & lookup are O(log n) expected.
  */
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
 struct memory_range {
+	struct memory_range *left, *right;
+	uint32_t prio;
+
 	size_t off;
 	size_t len;
-	uint8_t data[];
+	uint8_t *data;
+
+	/* backing storage, @data points somewhere inside it. Slack is kept
+	 * on both ends so growing a range in either direction is amortized
+	 * O(1) per byte */
+	uint8_t *buf;
+	size_t buf_len;
 };
 
 struct memory {
-	RBTREE(struct memory_range, ranges);
+	struct memory_range *root;
+	size_t range_ct;
+	uint32_t seed;
 };
 
 void memory_init(struct memory *m);
-void memory_insert(struct memory *m, char *data, size_t data_len, uint64_t offset);
+void memory_destroy(struct memory *m);
+
+/*
+ * Returns 0 on success, -1 if memory could not be allocated (in which case
+ * @m is unchanged) or [offset, offset + data_len) does not fit in a size_t.
+ */
+int memory_insert(struct memory *m, const void *data, size_t data_len, uint64_t offset);
+
+/* the range containing @offset, or NULL if @offset is not present */
+const struct memory_range *memory_find(const struct memory *m, uint64_t offset);
+
+/* true if every byte in [offset, offset + len) is present */
+bool memory_contains(const struct memory *m, uint64_t offset, size_t len);
+
+/* copy [offset, offset + len) into @buf, returns -1 (leaving @buf alone)
+ * unless every byte is present */
+int memory_read(const struct memory *m, uint64_t offset, void *buf, size_t len);
+
+/* in-order iteration, memory_next() is O(log n) */
+const struct memory_range *memory_first(const struct memory *m);
+const struct memory_range *memory_next(const struct memory *m, const struct memory_range *r);
+
+#define memory_for_each(m, r) \
+	for ((r) = memory_first(m); (r); (r) = memory_next((m), (r)))
 
-/* TODO: iteration */
+static inline size_t memory_range_ct(const struct memory *m)
+{
+	return m->range_ct;
+}
@@ -1,72 +1,224 @@
+#include <stdbool.h>
 #include <stdio.h>
-#include <ctype.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "print.h"
 
-static void print_hex_byte(char byte, FILE *f)
+/*
+ * Output is built up in a buffer and handed to stdio a chunk at a time.
+ * Runs of bytes that need no escaping are found 16 at a time and copied
+ * whole, only the exceptions are handled a byte at a time.
+ */
+
+/* input bytes handled per chunk, a chunk's output is at most 4x this */
+#define CHUNK 512
+
+static const char hex_lookup[] = "0123456789abcdef";
+
+/* printable ASCII, in the C locale */
+static inline bool
+is_print(unsigned char c)
 {
-	static const char hex_lookup[] = "0123456789abcdef";
-	putc(hex_lookup[(byte >> 4) & 0x0f], f);
-	putc(hex_lookup[byte & 0x0f], f);
+	return c >= 0x20 && c < 0x7f;
 }
 
-static void print_cstring_char(int c, FILE *f)
+/* stands for itself inside a C string */
+static inline bool
+is_plain(unsigned char c)
 {
-	if (iscntrl(c) || !isprint(c)) {
-		switch (c) {
-		case '\0':
-			putc('\\', f);
-			putc('0', f);
-			break;
-		case '\n':
-			putc('\\', f);
-			putc('n', f);
-			break;
-		case '\r':
-			putc('\\', f);
-			putc('r', f);
+	return is_print(c) && c != '"' && c != '\\';
+}
+
+#ifdef __SSE2__
+/* 0xff in each lane holding a printable byte */
+static inline __m128i
+print_mask(__m128i v)
+{
+	/* signed compares, so bytes >= 0x80 are negative and fail the first */
+	return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)),
+			_mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+}
+#endif
+
+/* how many bytes from the start of @p are plain */
+static size_t
+plain_run(const unsigned char *p, size_t len)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+		__m128i quote = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+				_mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+		unsigned m = _mm_movemask_epi8(_mm_andnot_si128(quote, print_mask(v)));
+		if (m != 0xffff)
+			return i + __builtin_ctz(~m);
+	}
+#endif
+	while (i < len && is_plain(p[i]))
+		i++;
+	return i;
+}
+
+static char *
+escape_char(char *o, unsigned char c)
+{
+	*o++ = '\\';
+	switch (c) {
+	case '\0':
+		*o++ = '0';
+		break;
+	case '\n':
+		*o++ = 'n';
+		break;
+	case '\r':
+		*o++ = 'r';
+		break;
+	case '"':
+	case '\\':
+		*o++ = c;
+		break;
+	default:
+		*o++ = 'x';
+		*o++ = hex_lookup[c >> 4];
+		*o++ = hex_lookup[c & 0x0f];
+	}
+	return o;
+}
+
+size_t print_escape_cstring(char *out, const void *data, size_t data_len)
+{
+	const unsigned char *p = data;
+	char *o = out;
+	size_t i = 0;
+	for (;;) {
+		size_t n = plain_run(p + i, data_len - i);
+		memcpy(o, p + i, n);
+		o += n;
+		i += n;
+		if (i == data_len)
 			break;
-		default:
-			putc('\\', f);
-			putc('x', f);
-			print_hex_byte(c, f);
-		}
-	} else  {
-		switch (c) {
-		case '"':
-		case '\\':
-			putc('\\', f);
-		default:
-			putc(c, f);
+		o = escape_char(o, p[i++]);
+	}
+	return o - out;
+}
+
+/* escaped @data, optionally between quotes, in as few writes as possible */
+static void
+print_escaped(const void *data, size_t data_len, bool quote, FILE *f)
+{
+	char buf[CHUNK * 4 + 2];
+	const unsigned char *p = data;
+	size_t o = 0;
+
+	if (quote)
+		buf[o++] = '"';
+
+	for (;;) {
+		size_t n = data_len < CHUNK ? data_len : CHUNK;
+		o += print_escape_cstring(buf + o, p, n);
+		p += n;
+		data_len -= n;
+
+		if (!data_len) {
+			if (quote)
+				buf[o++] = '"';
+			fwrite(buf, 1, o, f);
+			return;
 		}
+
+		fwrite(buf, 1, o, f);
+		o = 0;
 	}
 }
 
 void print_string_as_cstring_(const void *data, size_t data_len, FILE *f)
 {
-	const char *p = data;
-	size_t i;
-	for (i = 0; i < data_len; i++) {
-		char c = p[i];
-		if (c == '\0')
-			break;
-		print_cstring_char(c, f);
+	const char *end = memchr(data, '\0', data_len);
+	if (end)
+		data_len = end - (const char *)data;
+	print_escaped(data, data_len, false, f);
+}
+
+void print_bytes_as_cstring(const void *data, size_t data_len, FILE *f)
+{
+	print_escaped(data, data_len, true, f);
+}
+
+#define HEXDUMP_LINE 16
+/* "xxxxxxxx: " + 8 groups of "xxxx " + " " + 16 chars + "\n", 16 digit addresses at most */
+#define HEXDUMP_LINE_MAX (16 + 2 + 8 * 5 + 1 + HEXDUMP_LINE + 1)
+
+/* the text column: printable bytes as themselves, others as '.' */
+static void
+text_column(char *o, const unsigned char *p, size_t len)
+{
+#ifdef __SSE2__
+	if (len == 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i m = print_mask(v);
+		v = _mm_or_si128(_mm_and_si128(m, v), _mm_andnot_si128(m, _mm_set1_epi8('.')));
+		_mm_storeu_si128((__m128i *)o, v);
+		return;
 	}
+#endif
+	size_t i;
+	for (i = 0; i < len; i++)
+		o[i] = is_print(p[i]) ? p[i] : '.';
 }
 
-static void print_bytes_as_cstring_(const void *data, size_t data_len, FILE *f)
+static char *
+hexdump_line(char *o, const unsigned char *p, size_t len, uint64_t addr)
 {
-	const char *p = data;
+	int digits = addr >> 32 ? 16 : 8;
+	int d;
+	for (d = digits - 1; d >= 0; d--)
+		*o++ = hex_lookup[(addr >> (d * 4)) & 0x0f];
+	*o++ = ':';
+	*o++ = ' ';
+
 	size_t i;
-	for (i = 0; i < data_len; i++) {
-		char c = p[i];
-		print_cstring_char(c, f);
+	for (i = 0; i < HEXDUMP_LINE; i++) {
+		if (i < len) {
+			*o++ = hex_lookup[p[i] >> 4];
+			*o++ = hex_lookup[p[i] & 0x0f];
+		} else {
+			*o++ = ' ';
+			*o++ = ' ';
+		}
+		if (i & 1)
+			*o++ = ' ';
 	}
+
+	*o++ = ' ';
+	text_column(o, p, len);
+	o += len;
+	*o++ = '\n';
+	return o;
 }
 
-void print_bytes_as_cstring(const void *data, size_t data_len, FILE *f)
+void print_hexdump(const void *data, size_t data_len, uint64_t addr, FILE *f)
 {
-	putc('"', f);
-	print_bytes_as_cstring_(data, data_len, f);
-	putc('"', f);
+	char buf[CHUNK * 8];
+	const unsigned char *p = data;
+	size_t o = 0;
+
+	while (data_len) {
+		size_t n = data_len < HEXDUMP_LINE ? data_len : HEXDUMP_LINE;
+		if (sizeof(buf) - o < HEXDUMP_LINE_MAX) {
+			fwrite(buf, 1, o, f);
+			o = 0;
+		}
+
+		o = hexdump_line(buf + o, p, n, addr) - buf;
+		p += n;
+		addr += n;
+		data_len -= n;
+	}
+
+	fwrite(buf, 1, o, f);
 }
@@ -1,4 +1,19 @@
 #pragma once
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+
+/*
+ * Escape @data_len bytes as the inside of a C string literal into @out, which
+ * needs room for 4 bytes per input byte. Returns the number of bytes written.
+ */
+size_t print_escape_cstring(char *out, const void *data, size_t data_len);
+
 void print_string_as_cstring_(const void *data, size_t data_len, FILE *f);
 void print_bytes_as_cstring(const void *data, size_t data_len, FILE *f);
+
+/*
+ * xxd style dump: each line is the address (starting at @addr), 16 bytes in
+ * hex in groups of 2, then those bytes as text with '.' for the unprintable.
+ */
+void print_hexdump(const void *data, size_t data_len, uint64_t addr, FILE *f);
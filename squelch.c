@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "squelch.h"
+
+enum {
+	SQ_TRUE,
+	SQ_TONE,
+	SQ_S,
+	SQ_PAGE,
+	SQ_NOT,
+	SQ_AND,
+	SQ_OR,
+};
+
+/*
+ * The most signals sq_match() evaluates at: (tones + 2) * (levels + 1) *
+ * (pages + 2) for tones + levels + pages <= SQ_MAX_ATOMS.
+ */
+#define SQ_MAX_POINTS 343
+
+struct parse {
+	struct sq_prog *p;
+	const char *at;
+	const char *err;
+	unsigned depth;
+};
+
+static void
+skip_space(struct parse *ps)
+{
+	while (*ps->at == ' ' || *ps->at == '\t')
+		ps->at++;
+}
+
+static bool
+eat(struct parse *ps, const char *s)
+{
+	size_t l = strlen(s);
+	if (strncmp(ps->at, s, l))
+		return false;
+	ps->at += l;
+	return true;
+}
+
+static bool
+push(struct parse *ps, struct sq_op op)
+{
+	if (ps->p->op_ct == SQ_MAX_OPS) {
+		ps->err = "too many operations";
+		return false;
+	}
+	if (op.op < SQ_NOT && ps->p->atom_ct++ == SQ_MAX_ATOMS) {
+		ps->err = "too many conditions";
+		return false;
+	}
+	ps->p->ops[ps->p->op_ct++] = op;
+	return true;
+}
+
+/* "<digits>[.<digit>]" in tenths */
+static bool
+parse_dhz(struct parse *ps, unsigned *v)
+{
+	unsigned n = 0;
+	if (*ps->at < '0' || *ps->at > '9')
+		return false;
+	for (; *ps->at >= '0' && *ps->at <= '9'; ps->at++) {
+		n = n * 10 + (*ps->at - '0');
+		if (n > 10000)
+			return false;
+	}
+	n *= 10;
+	if (*ps->at == '.') {
+		ps->at++;
+		if (*ps->at < '0' || *ps->at > '9')
+			return false;
+		n += *ps->at++ - '0';
+	}
+	*v = n;
+	return true;
+}
+
+static bool
+parse_atom(struct parse *ps)
+{
+	struct sq_op op = { 0 };
+	const char *start = ps->at;
+	unsigned v = 0;
+	size_t i;
+	int digits;
+
+	if (eat(ps, "carrier")) {
+		op.op = SQ_TRUE;
+	} else if (eat(ps, "ctcss=")) {
+		if (!parse_dhz(ps, &v)) {
+			ps->err = "expected a tone in Hz";
+			goto bad;
+		}
+		for (i = 0; i < chan_ctcss_ct && chan_ctcss_dhz[i] != v; i++)
+			;
+		if (i == chan_ctcss_ct) {
+			ps->err = "not a standard CTCSS tone";
+			goto bad;
+		}
+		op = (struct sq_op){ .op = SQ_TONE, .kind = CHAN_TONE_CTCSS, .code = i };
+	} else if (eat(ps, "dcs=")) {
+		/* the octal digits, as chan_dcs[] writes them */
+		for (digits = 0; *ps->at >= '0' && *ps->at <= '7' && digits < 3; digits++)
+			v = v * 10 + (*ps->at++ - '0');
+		for (i = 0; i < chan_dcs_ct && chan_dcs[i] != v; i++)
+			;
+		if (!digits || i == chan_dcs_ct) {
+			ps->err = "not a standard DCS code";
+			goto bad;
+		}
+		op = (struct sq_op){ .op = SQ_TONE, .kind = CHAN_TONE_DCS, .code = i };
+		if (*ps->at == 'i') {
+			op.kind = CHAN_TONE_DCS_INV;
+			ps->at++;
+		}
+	} else if (eat(ps, "s>=")) {
+		if (*ps->at < '0' || *ps->at > '9') {
+			ps->err = "expected an S unit, 0 to 9";
+			goto bad;
+		}
+		op = (struct sq_op){ .op = SQ_S, .n = *ps->at++ - '0' };
+	} else if (eat(ps, "page=")) {
+		for (digits = 0; *ps->at >= '0' && *ps->at <= '9'; digits++) {
+			v = v * 10 + (*ps->at++ - '0');
+			if (v > UINT16_MAX)
+				break;
+		}
+		if (!digits || !v || v > UINT16_MAX) {
+			ps->err = "expected a paging code, 1 to 65535";
+			goto bad;
+		}
+		op = (struct sq_op){ .op = SQ_PAGE, .n = v };
+	} else {
+		ps->err = "expected carrier, ctcss=, dcs=, s>=, page=, ! or (";
+		goto bad;
+	}
+
+	return push(ps, op);
+
+bad:
+	ps->at = start;
+	return false;
+}
+
+static bool parse_or(struct parse *ps);
+
+static bool
+parse_unary(struct parse *ps)
+{
+	skip_space(ps);
+	if (ps->depth++ > SQ_MAX_OPS) {
+		ps->err = "nested too deeply";
+		return false;
+	}
+
+	bool ok;
+	if (eat(ps, "!")) {
+		ok = parse_unary(ps) && push(ps, (struct sq_op){ .op = SQ_NOT });
+	} else if (eat(ps, "(")) {
+		ok = parse_or(ps);
+		skip_space(ps);
+		if (ok && !eat(ps, ")")) {
+			ps->err = "expected )";
+			ok = false;
+		}
+	} else {
+		ok = parse_atom(ps);
+	}
+	ps->depth--;
+	return ok;
+}
+
+static bool
+parse_and(struct parse *ps)
+{
+	if (!parse_unary(ps))
+		return false;
+	for (;;) {
+		skip_space(ps);
+		if (!eat(ps, "&"))
+			return true;
+		if (!parse_unary(ps) || !push(ps, (struct sq_op){ .op = SQ_AND }))
+			return false;
+	}
+}
+
+static bool
+parse_or(struct parse *ps)
+{
+	if (!parse_and(ps))
+		return false;
+	for (;;) {
+		skip_space(ps);
+		if (!eat(ps, "|"))
+			return true;
+		if (!parse_and(ps) || !push(ps, (struct sq_op){ .op = SQ_OR }))
+			return false;
+	}
+}
+
+int sq_compile(struct sq_prog *p, const char *text)
+{
+	struct parse ps = { .p = p, .at = text };
+	p->op_ct = 0;
+	p->atom_ct = 0;
+
+	if (parse_or(&ps)) {
+		skip_space(&ps);
+		if (!*ps.at)
+			return 0;
+		ps.err = "expected &, | or the end";
+	}
+
+	fprintf(stderr, "E: unsquelch condition '%s': %s at '%s'\n",
+			text, ps.err, ps.at);
+	return -1;
+}
+
+void sq_from_chan(struct sq_prog *p, uint8_t tone, uint8_t code)
+{
+	p->op_ct = 1;
+	p->atom_ct = 1;
+	if (tone >= CHAN_TONE_CTCSS)
+		p->ops[0] = (struct sq_op){ .op = SQ_TONE, .kind = tone, .code = code };
+	else
+		p->ops[0] = (struct sq_op){ .op = SQ_TRUE };
+}
+
+bool sq_eval(const struct sq_prog *p, const struct sq_signal *s)
+{
+	/* bit 0 is the top of the stack, which is never deeper than the
+	 * number of atoms */
+	uint32_t st = 0;
+	size_t i;
+	for (i = 0; i < p->op_ct; i++) {
+		const struct sq_op *o = &p->ops[i];
+		switch (o->op) {
+		case SQ_TRUE:
+			st = st << 1 | 1;
+			break;
+		case SQ_TONE:
+			st = st << 1 | (s->tone == o->kind && s->code == o->code);
+			break;
+		case SQ_S:
+			st = st << 1 | (s->s >= o->n);
+			break;
+		case SQ_PAGE:
+			st = st << 1 | (s->page == o->n);
+			break;
+		case SQ_NOT:
+			st ^= 1;
+			break;
+		case SQ_AND:
+			st = (st >> 1) & (st | ~1u);
+			break;
+		case SQ_OR:
+			st = (st >> 1) | (st & 1);
+			break;
+		}
+	}
+	return st & 1;
+}
+
+void sq_caps_from_chan(struct sq_caps *sc, const struct chan_caps *c)
+{
+	*sc = (struct sq_caps){ .tones = c->rx_tones };
+}
+
+enum sq_match sq_match(const struct sq_prog *p, const struct sq_caps *c,
+		struct sq_setting *out)
+{
+	struct sq_signal tones[SQ_MAX_ATOMS + 2];
+	uint8_t levels[SQ_MAX_ATOMS + 1];
+	uint16_t pages[SQ_MAX_ATOMS + 2];
+	size_t tone_ct = 0, level_ct = 1, page_ct = 1, i, j, k;
+	bool ctcss_used[64] = { false };
+
+	/* first the signals the condition mentions, then ones standing in
+	 * for everything else */
+	levels[0] = 0;
+	pages[0] = 0;
+	for (i = 0; i < p->op_ct; i++) {
+		const struct sq_op *o = &p->ops[i];
+		switch (o->op) {
+		case SQ_TONE:
+			for (j = 0; j < tone_ct; j++)
+				if (tones[j].tone == o->kind && tones[j].code == o->code)
+					break;
+			if (j == tone_ct)
+				tones[tone_ct++] = (struct sq_signal){ .tone = o->kind, .code = o->code };
+			if (o->kind == CHAN_TONE_CTCSS && o->code < 64)
+				ctcss_used[o->code] = true;
+			break;
+		case SQ_S:
+			for (j = 0; j < level_ct && levels[j] != o->n; j++)
+				;
+			if (j == level_ct)
+				levels[level_ct++] = o->n;
+			break;
+		case SQ_PAGE:
+			for (j = 0; j < page_ct && pages[j] != o->n; j++)
+				;
+			if (j == page_ct)
+				pages[page_ct++] = o->n;
+			break;
+		}
+	}
+	size_t mentioned = tone_ct;
+	for (i = 0; ctcss_used[i]; i++)
+		;
+	tones[tone_ct++] = (struct sq_signal){ .tone = CHAN_TONE_CTCSS, .code = i };
+	tones[tone_ct++] = (struct sq_signal){ .tone = CHAN_TONE_NONE };
+	uint16_t other = 1;
+	for (j = 1; j < page_ct; j++)
+		if (pages[j] == other) {
+			other++;
+			j = 0;
+		}
+	pages[page_ct++] = other;
+
+	/* pages can't be set on a radio, so only the tone and level matter
+	 * to a setting: count the pages each is wanted at */
+	uint8_t want[SQ_MAX_POINTS];
+	size_t n = 0, wanted = 0;
+	for (i = 0; i < tone_ct; i++) {
+		for (j = 0; j < level_ct; j++, n++) {
+			struct sq_signal s = tones[i];
+			s.s = levels[j];
+			want[n] = 0;
+			for (k = 0; k < page_ct; k++) {
+				s.page = pages[k];
+				want[n] += sq_eval(p, &s);
+			}
+			wanted += want[n];
+		}
+	}
+	if (!wanted)
+		return SQ_NEVER;
+
+	/* the mentioned tones, then none: each with each level the radio has */
+	size_t best_extra = SIZE_MAX;
+	for (i = 0; i <= mentioned; i++) {
+		const struct sq_signal *set = &tones[i == mentioned ? tone_ct - 1 : i];
+		if (set->tone != CHAN_TONE_NONE && !chan_enum_fits(c->tones, set->tone))
+			continue;
+
+		for (j = 0; j < level_ct; j++) {
+			uint8_t lvl = levels[j];
+			if (lvl && (lvl > c->s_max ||
+					(set->tone != CHAN_TONE_NONE && !c->tone_and_s)))
+				continue;
+
+			size_t extra = 0;
+			for (k = 0; k < n; k++) {
+				const struct sq_signal *at = &tones[k / level_ct];
+				bool open = (set->tone == CHAN_TONE_NONE ||
+						(at->tone == set->tone && at->code == set->code))
+					&& levels[k % level_ct] >= lvl;
+				if (!open && want[k])
+					break;
+				if (open)
+					extra += page_ct - want[k];
+			}
+			if (k == n && extra < best_extra) {
+				best_extra = extra;
+				*out = (struct sq_setting){ .tone = set->tone, .code = set->code, .s = lvl };
+			}
+		}
+	}
+
+	return best_extra ? SQ_WIDER : SQ_EXACT;
+}
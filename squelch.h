@@ -0,0 +1,103 @@
+#pragma once
+
+/*
+ * Unsquelch conditions beyond a single tone (the "minimal script-like thing"
+ * of DESIGN): an expression over what is received, compiled once and then
+ * evaluated or matched against what a radio can do, with no allocation.
+ *
+ *   carrier              anything (carrier squelch)
+ *   ctcss=<Hz>           that CTCSS tone (ctcss=88.5)
+ *   dcs=<code>[i]        that DCS code, 'i' for inverted (dcs=023, dcs=754i)
+ *   s>=<n>               at least S<n> (0 to 9)
+ *   page=<n>             that paging code (DTMF, 2-tone, ...)
+ *   !<e>  <e>&<e>  <e>|<e>  (<e>)
+ *
+ * '!' binds tightest, then '&', then '|'. For example
+ * "(ctcss=88.5 | dcs=023) & s>=3".
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chan.h"
+
+/* ops of a compiled condition, and how many atoms (ops other than
+ * !, & and |) it may use */
+#define SQ_MAX_OPS 32
+#define SQ_MAX_ATOMS 16
+
+struct sq_op {
+	uint8_t op;
+	/* SQ_TONE: a chan_tone and its code */
+	uint8_t kind, code;
+	/* SQ_S: the level, SQ_PAGE: the code */
+	uint16_t n;
+};
+
+/* postfix, evaluated with a stack of bits */
+struct sq_prog {
+	uint8_t op_ct, atom_ct;
+	struct sq_op ops[SQ_MAX_OPS];
+};
+
+/* what is being received */
+struct sq_signal {
+	/* a chan_tone (CHAN_TONE_NONE for none) and its code */
+	uint8_t tone, code;
+	/* S units */
+	uint8_t s;
+	/* 0 for none */
+	uint16_t page;
+};
+
+/*
+ * Compile @text into @p. Returns 0 on success, -1 (after printing why) if it
+ * doesn't parse or is too long.
+ */
+int sq_compile(struct sq_prog *p, const char *text);
+
+/* a condition that is just what a channel's rx_tone and rx_code say */
+void sq_from_chan(struct sq_prog *p, uint8_t tone, uint8_t code);
+
+bool sq_eval(const struct sq_prog *p, const struct sq_signal *s);
+
+/* what a radio's squelch can be set to */
+struct sq_caps {
+	/* bit n set: chan_tone n can be used */
+	uint32_t tones;
+	/* highest S-meter squelch level, 0 for none */
+	uint8_t s_max;
+	/* the S-meter squelch can be combined with a tone */
+	bool tone_and_s;
+};
+
+/* tones from @c's rx_tones, no S-meter squelch (layouts don't have one yet) */
+void sq_caps_from_chan(struct sq_caps *sc, const struct chan_caps *c);
+
+/* how a radio is set to approximate a condition */
+struct sq_setting {
+	/* a chan_tone and its code, as for a chan_table */
+	uint8_t tone, code;
+	/* S-meter squelch level, 0 for off */
+	uint8_t s;
+};
+
+enum sq_match {
+	/* the setting opens on exactly what the condition does */
+	SQ_EXACT,
+	/* it opens on everything the condition does, and more */
+	SQ_WIDER,
+	/* the condition never holds, so nothing can match it (@out is left
+	 * alone) */
+	SQ_NEVER,
+};
+
+/*
+ * Find the setting of a radio that can do @c which opens on everything @p
+ * does and as little else as possible. Conditions only depend on which of
+ * the tones, levels and pages they mention is received, so they are evaluated
+ * at one signal for each combination of those (plus one standing in for
+ * all the others) rather than at every possible signal.
+ */
+enum sq_match sq_match(const struct sq_prog *p, const struct sq_caps *c,
+		struct sq_setting *out);
@@ -0,0 +1,32 @@
+#pragma once
+
+/*
+ * Small helpers shared by the tools, benchmarks and simulators: a monotonic
+ * clock and a seedable random number generator.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* splitmix64, @s is the state (any value will do as a seed) */
+static inline uint64_t rng_next(uint64_t *s)
+{
+	uint64_t z = (*s += 0x9e3779b97f4a7c15);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	return z ^ (z >> 31);
+}
+
+/* true with probability @prob */
+static inline bool rng_chance(uint64_t *s, double prob)
+{
+	return prob > 0 && (rng_next(s) >> 11) * 0x1.0p-53 < prob;
+}
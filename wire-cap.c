@@ -0,0 +1,293 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wire-cap.h"
+
+/* the most a record header can take: 3 varints of up to 10 bytes */
+#define REC_HDR_MAX 30
+
+static void
+put_le64(uint8_t *p, uint64_t v)
+{
+	size_t i;
+	for (i = 0; i < 8; i++)
+		p[i] = v >> (i * 8);
+}
+
+static uint64_t
+get_le64(const uint8_t *p)
+{
+	uint64_t v = 0;
+	size_t i;
+	for (i = 0; i < 8; i++)
+		v |= (uint64_t)p[i] << (i * 8);
+	return v;
+}
+
+static size_t
+put_varint(uint8_t *p, uint64_t v)
+{
+	size_t i = 0;
+	while (v >= 0x80) {
+		p[i++] = v | 0x80;
+		v >>= 7;
+	}
+	p[i++] = v;
+	return i;
+}
+
+/* returns the bytes used, 0 if @p..@end does not hold a whole varint */
+static size_t
+get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+	size_t i;
+	*v = 0;
+	for (i = 0; i < 10 && p + i < end; i++) {
+		*v |= (uint64_t)(p[i] & 0x7f) << (i * 7);
+		if (!(p[i] & 0x80))
+			return i + 1;
+	}
+	return 0;
+}
+
+static int
+write_all(int fd, const uint8_t *buf, size_t len)
+{
+	while (len) {
+		ssize_t r = write(fd, buf, len);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += r;
+		len -= r;
+	}
+	return 0;
+}
+
+int wire_cap_open(struct wire_cap *c, const char *path, size_t buf_size, uint64_t now)
+{
+	*c = (struct wire_cap){ .fd = -1, .last = now };
+
+	if (buf_size < WIRE_CAP_HDR_LEN + REC_HDR_MAX + 1) {
+		fprintf(stderr, "E: capture buffer of %zu bytes is too small\n", buf_size);
+		return -1;
+	}
+
+	c->buf = malloc(buf_size);
+	if (!c->buf) {
+		fprintf(stderr, "E: could not allocate a %zu byte capture buffer\n", buf_size);
+		return -1;
+	}
+	c->size = buf_size;
+
+	c->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (c->fd < 0) {
+		fprintf(stderr, "E: could not create capture '%s': %s\n", path, strerror(errno));
+		free(c->buf);
+		c->buf = NULL;
+		return -1;
+	}
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	memcpy(c->buf, WIRE_CAP_MAGIC, 8);
+	put_le64(c->buf + 8, now);
+	put_le64(c->buf + 16, (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+	c->len = WIRE_CAP_HDR_LEN;
+	return 0;
+}
+
+static void
+cap_stop(struct wire_cap *c)
+{
+	if (c->fd >= 0)
+		close(c->fd);
+	c->fd = -1;
+	free(c->buf);
+	c->buf = NULL;
+}
+
+void wire_cap_flush(struct wire_cap *c)
+{
+	if (c->fd < 0 || !c->len)
+		return;
+
+	if (write_all(c->fd, c->buf, c->len)) {
+		fprintf(stderr, "W: writing capture failed, capture stopped: %s\n", strerror(errno));
+		cap_stop(c);
+		return;
+	}
+	c->len = 0;
+}
+
+void wire_cap_record(struct wire_cap *c, unsigned chan, enum wire_kind kind,
+		const void *data, size_t len, uint64_t now)
+{
+	const uint8_t *d = data;
+	do {
+		if (c->fd < 0)
+			return;
+
+		if (c->size - c->len < REC_HDR_MAX + 1)
+			wire_cap_flush(c);
+		if (c->fd < 0)
+			return;
+
+		/* split anything too big to fit into several records */
+		size_t room = c->size - c->len - REC_HDR_MAX;
+		size_t n = len < room ? len : room;
+
+		uint8_t *p = c->buf + c->len;
+		p += put_varint(p, (uint64_t)chan << 2 | kind);
+		p += put_varint(p, now - c->last);
+		p += put_varint(p, n);
+		memcpy(p, d, n);
+		c->len = p + n - c->buf;
+		c->last = now;
+
+		d += n;
+		len -= n;
+	} while (len);
+}
+
+void wire_cap_note(struct wire_cap *c, unsigned chan, uint64_t now, const char *fmt, ...)
+{
+	char note[256];
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vsnprintf(note, sizeof(note), fmt, ap);
+	va_end(ap);
+
+	if (n < 0)
+		return;
+	if ((size_t)n >= sizeof(note))
+		n = sizeof(note) - 1;
+	wire_cap_record(c, chan, WIRE_NOTE, note, n, now);
+}
+
+void wire_cap_chan(struct wire_cap *c, unsigned chan, enum wire_dir dir,
+		const char *port, uint64_t now)
+{
+	uint8_t rec[256];
+	size_t len = strlen(port);
+	if (len > sizeof(rec) - 1)
+		len = sizeof(rec) - 1;
+	rec[0] = dir;
+	memcpy(rec + 1, port, len);
+	wire_cap_record(c, chan, WIRE_CHAN, rec, len + 1, now);
+}
+
+enum wire_dir wire_rec_dir(const struct wire_rec *r)
+{
+	if (r->kind != WIRE_CHAN || !r->len || r->data[0] > WIRE_DIR_RECV)
+		return WIRE_DIR_UNKNOWN;
+	return r->data[0];
+}
+
+void wire_cap_close(struct wire_cap *c)
+{
+	wire_cap_flush(c);
+	cap_stop(c);
+}
+
+int wire_cap_load(struct wire_trace *t, const char *path)
+{
+	*t = (struct wire_trace){ 0 };
+
+	FILE *in = fopen(path, "rb");
+	if (!in) {
+		fprintf(stderr, "E: could not open capture '%s': %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	size_t cap = 0;
+	for (;;) {
+		if (t->file_len == cap) {
+			cap = cap ? cap * 2 : 1 << 16;
+			uint8_t *n = realloc(t->file, cap);
+			if (!n) {
+				fprintf(stderr, "E: out of memory reading capture '%s'\n", path);
+				fclose(in);
+				goto err;
+			}
+			t->file = n;
+		}
+		size_t r = fread(t->file + t->file_len, 1, cap - t->file_len, in);
+		if (!r)
+			break;
+		t->file_len += r;
+	}
+
+	bool err = ferror(in);
+	fclose(in);
+	if (err) {
+		fprintf(stderr, "E: error reading capture '%s'\n", path);
+		goto err;
+	}
+
+	if (t->file_len < WIRE_CAP_HDR_LEN || memcmp(t->file, WIRE_CAP_MAGIC, 8)) {
+		fprintf(stderr, "E: '%s' is not a wire capture\n", path);
+		goto err;
+	}
+
+	t->start = get_le64(t->file + 8);
+	t->start_real = get_le64(t->file + 16);
+
+	const uint8_t *p = t->file + WIRE_CAP_HDR_LEN, *end = t->file + t->file_len;
+	uint64_t time = t->start;
+	size_t rec_cap = 0;
+	while (p < end) {
+		uint64_t h, dt, len;
+		size_t a, b, c;
+		if (!(a = get_varint(p, end, &h))
+				|| !(b = get_varint(p + a, end, &dt))
+				|| !(c = get_varint(p + a + b, end, &len))
+				|| len > (size_t)(end - p - a - b - c)) {
+			fprintf(stderr, "W: '%s' ends with a truncated record at %zu, dropping it\n",
+					path, (size_t)(p - t->file));
+			break;
+		}
+
+		if (t->ct == rec_cap) {
+			rec_cap = rec_cap ? rec_cap * 2 : 1024;
+			struct wire_rec *n = realloc(t->recs, rec_cap * sizeof(*n));
+			if (!n) {
+				fprintf(stderr, "E: out of memory reading capture '%s'\n", path);
+				goto err;
+			}
+			t->recs = n;
+		}
+
+		time += dt;
+		p += a + b + c;
+		t->recs[t->ct++] = (struct wire_rec){
+			.chan = h >> 2,
+			.kind = h & 3,
+			.time = time,
+			.data = p,
+			.len = len,
+		};
+		p += len;
+	}
+
+	return 0;
+
+err:
+	wire_cap_unload(t);
+	return -1;
+}
+
+void wire_cap_unload(struct wire_trace *t)
+{
+	free(t->file);
+	free(t->recs);
+	*t = (struct wire_trace){ 0 };
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+/*
+ * Raw wire capture
+ *
+ * Every chunk of bytes read from or written to a port is appended, with its
+ * direction and a CLOCK_MONOTONIC timestamp, to a buffer that is allocated
+ * once up front and only written out (with a single write()) when it fills,
+ * is flushed or the capture is closed. Capturing is therefore cheap enough to
+ * leave on; tools flush after each transfer and when interrupted, so the
+ * sessions worth looking at aren't lost.
+ *
+ * File format (integers are unsigned LEB128 varints unless noted):
+ *
+ *   header:
+ *     8 bytes   "RPWIRE1\n"
+ *     8 bytes   le64, CLOCK_MONOTONIC ns when the capture started
+ *     8 bytes   le64, CLOCK_REALTIME ns when the capture started
+ *
+ *   records, until the end of the file:
+ *     varint    channel << 2 | kind
+ *     varint    ns since the previous record (or the start)
+ *     varint    length
+ *     length bytes
+ *
+ * The channel tells apart ports captured into the same file. Each channel
+ * starts with a channel record, whose data is one byte of enum wire_dir
+ * followed by the port's name, so readers don't have to guess what it was
+ * doing. A note (free form text) is for people.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WIRE_CAP_MAGIC "RPWIRE1\n"
+#define WIRE_CAP_HDR_LEN 24
+
+enum wire_kind {
+	/* bytes read from the port */
+	WIRE_RX,
+	/* bytes written to the port */
+	WIRE_TX,
+	/* text describing the capture */
+	WIRE_NOTE,
+	/* what the channel is, see above */
+	WIRE_CHAN,
+};
+
+enum wire_dir {
+	WIRE_DIR_UNKNOWN,
+	/* the tool sent an image to the radio */
+	WIRE_DIR_SEND,
+	/* the radio sent an image to the tool */
+	WIRE_DIR_RECV,
+};
+
+struct wire_cap {
+	int fd;
+	uint8_t *buf;
+	size_t size, len;
+	uint64_t last;
+};
+
+/*
+ * Create @path and start capturing into it, buffering up to @buf_size bytes
+ * between writes. Returns 0 on success, -1 (after printing why) on failure.
+ */
+int wire_cap_open(struct wire_cap *c, const char *path, size_t buf_size, uint64_t now);
+
+/*
+ * Append a record. If writing the file fails, a warning is printed and the
+ * capture stops, the transfer itself carries on.
+ */
+void wire_cap_record(struct wire_cap *c, unsigned chan, enum wire_kind kind,
+		const void *data, size_t len, uint64_t now);
+void wire_cap_note(struct wire_cap *c, unsigned chan, uint64_t now, const char *fmt, ...)
+	__attribute__((format(printf, 4, 5)));
+
+/* start channel @chan: a transfer in direction @dir over @port */
+void wire_cap_chan(struct wire_cap *c, unsigned chan, enum wire_dir dir,
+		const char *port, uint64_t now);
+
+/* write out whatever is buffered */
+void wire_cap_flush(struct wire_cap *c);
+void wire_cap_close(struct wire_cap *c);
+
+/* a capture read back into memory */
+struct wire_rec {
+	unsigned chan;
+	enum wire_kind kind;
+	/* CLOCK_MONOTONIC ns, on the clock of the machine that captured it */
+	uint64_t time;
+	const uint8_t *data;
+	size_t len;
+};
+
+struct wire_trace {
+	uint8_t *file;
+	size_t file_len;
+	uint64_t start, start_real;
+	struct wire_rec *recs;
+	size_t ct;
+};
+
+/* the direction a WIRE_CHAN record gives, WIRE_DIR_UNKNOWN if it is bad */
+enum wire_dir wire_rec_dir(const struct wire_rec *r);
+
+/*
+ * Read the capture at @path. A truncated final record (the capturing process
+ * died mid-write) is dropped with a warning. Returns 0 on success, -1 (after
+ * printing why) if it is not a capture or is corrupt.
+ */
+int wire_cap_load(struct wire_trace *t, const char *path);
+void wire_cap_unload(struct wire_trace *t);